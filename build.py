@@ -10,14 +10,38 @@ debug_flags = "-std=c++23 -Wall -Wno-c++98-compat -Wno-padded"
 release_flags = "-std=c++23 -Wall -Wno-c++98-compat -Wno-padded -O3 -flto=auto"
 
 project_name = "tiny-calc"
+# Executables and the unit that contains their main function
+targets = {
+    project_name: "main",
+    f"{project_name}-conformance": "conformance",
+    f"{project_name}-gen": "gen",
+}
 units = [
+    "alloc_stats",
+    "batch",
+    "budget",
     "chunk",
     "compile",
+    "compile_parallel",
+    "dual",
+    "environment",
+    "fold",
+    "generate",
+    "ingest",
+    "inliner",
     "interpret",
-    "main",
+    "output",
+    "parallel",
+    "pool",
+    "progress",
+    "reduction",
     "repl",
     "report",
+    "stream",
     "tokenize",
+    "trace",
+    "verify",
+    "watch",
 ]
 
 sccache = "sccache"
@@ -30,29 +54,31 @@ if shutil.which("mold") is None:
     use_mold = False
     print("Warning: mold is not installed, linking will be slower")
 
-# Generate compile command
+# Generate compile commands
 with open("COMPILE.txt", "w", encoding="ascii") as file:
-    files = ' '.join(map(lambda unit : f"src/{unit}.cpp", units))
-    file.write(
-        f"{compiler} {files} {release_flags} -o {project_name}\n"
-    )
+    for target, main in targets.items():
+        files = ' '.join(map(lambda unit : f"src/{unit}.cpp", sorted(units + [main])))
+        file.write(
+            f"{compiler} {files} {release_flags} -o {target}\n"
+        )
 
 if not os.path.exists("build"):
     os.makedirs("build")
 
 # Compile each module into an object file
 error = False
-for unit in units:
+for unit in units + list(targets.values()):
     cmd = f"{sccache} {compiler} -c {debug_flags} -fdiagnostics-color src/{unit}.cpp -o build/{unit}.o"
     result = subprocess.call(cmd, shell=True)
     if result != 0:
         error = True
 
-# Link object files into executable
+# Link object files into executables
 if not error:
-    paths = " ".join([f"build/{unit}.o" for unit in units])
     mold = "-fuse-ld=mold" if use_mold else ""
-    cmd = f"{sccache} {compiler} {paths} -o {project_name} {mold}"
-    subprocess.call(cmd, shell=True)
+    for target, main in targets.items():
+        paths = " ".join([f"build/{unit}.o" for unit in units + [main]])
+        cmd = f"{sccache} {compiler} {paths} -o {target} {mold}"
+        subprocess.call(cmd, shell=True)
 else:
     sys.exit(-1)
@@ -0,0 +1,146 @@
+#include "alloc_stats.hpp"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "format.hpp"
+
+/**
+ * @brief Counters of a single phase, updated by every thread.
+ */
+struct AtomicCounts {
+    std::atomic<size_t> count = 0;
+    std::atomic<size_t> bytes = 0;
+    std::atomic<int64_t> peak = 0;
+};
+
+static std::atomic<AllocPhase> g_phase = AllocPhase::None;
+static std::array<AtomicCounts, ALLOC_PHASES> g_counts;
+/// Bytes allocated minus bytes freed while counting
+static std::atomic<int64_t> g_live = 0;
+/// `g_live` when the current phase began
+static std::atomic<int64_t> g_phase_live = 0;
+/// `g_live` at the last `take_alloc_stats`
+static std::atomic<int64_t> g_stats_live = 0;
+static std::atomic<int64_t> g_stats_peak = 0;
+static AllocStats g_total;
+
+static constexpr std::array<std::string_view, ALLOC_PHASES> PHASE_NAMES = {
+    "tokenize", "compile", "interpret", "report", "output",
+};
+
+/**
+ * @brief Raises `peak` to `value`, if it is higher.
+ */
+static void raise_peak(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current &&
+           !peak.compare_exchange_weak(
+               current, value, std::memory_order_relaxed
+           )) {
+    }
+}
+
+static void count_allocation(AllocPhase phase, void* ptr, size_t size) {
+    AtomicCounts& counts = g_counts[static_cast<size_t>(phase)];
+    counts.count.fetch_add(1, std::memory_order_relaxed);
+    counts.bytes.fetch_add(size, std::memory_order_relaxed);
+
+    const auto usable = static_cast<int64_t>(malloc_usable_size(ptr));
+    const int64_t live =
+        g_live.fetch_add(usable, std::memory_order_relaxed) + usable;
+    const int64_t phase_live = g_phase_live.load(std::memory_order_relaxed);
+    const int64_t stats_live = g_stats_live.load(std::memory_order_relaxed);
+    raise_peak(counts.peak, live - phase_live);
+    raise_peak(g_stats_peak, live - stats_live);
+}
+
+auto operator new(size_t size) -> void* {
+    void* ptr = std::malloc(std::max(size, size_t(1)));
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    const AllocPhase phase = g_phase.load(std::memory_order_relaxed);
+    if (phase != AllocPhase::None) {
+        count_allocation(phase, ptr, size);
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr != nullptr &&
+        g_phase.load(std::memory_order_relaxed) != AllocPhase::None) {
+        const auto usable = static_cast<int64_t>(malloc_usable_size(ptr));
+        g_live.fetch_sub(usable, std::memory_order_relaxed);
+    }
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+auto alloc_phase_name(AllocPhase phase) -> std::string_view {
+    if (phase == AllocPhase::None) return "none";
+    return PHASE_NAMES[static_cast<size_t>(phase)];
+}
+
+void AllocStats::merge(const AllocStats& other) {
+    for (size_t i = 0; i < ALLOC_PHASES; i += 1) {
+        phases[i].count += other.phases[i].count;
+        phases[i].bytes += other.phases[i].bytes;
+        phases[i].peak = std::max(phases[i].peak, other.phases[i].peak);
+    }
+    peak = std::max(peak, other.peak);
+}
+
+void set_alloc_phase(AllocPhase phase) {
+    g_phase_live.store(
+        g_live.load(std::memory_order_relaxed), std::memory_order_relaxed
+    );
+    g_phase.store(phase, std::memory_order_relaxed);
+}
+
+auto take_alloc_stats() -> AllocStats {
+    AllocStats stats;
+    for (size_t i = 0; i < ALLOC_PHASES; i += 1) {
+        stats.phases[i] = AllocCounts{
+            .count = g_counts[i].count.exchange(0),
+            .bytes = g_counts[i].bytes.exchange(0),
+            .peak = static_cast<size_t>(g_counts[i].peak.exchange(0)),
+        };
+    }
+    stats.peak = static_cast<size_t>(g_stats_peak.exchange(0));
+    g_stats_live.store(g_live.load());
+    g_phase_live.store(g_live.load());
+
+    g_total.merge(stats);
+    return stats;
+}
+
+auto alloc_stats_total() -> const AllocStats& { return g_total; }
+
+void write_alloc_stats(
+    std::ostream& out, std::string_view label, const AllocStats& stats
+) {
+    write(out, "Allocations of ", label, ":");
+    bool any = false;
+    for (size_t i = 0; i < ALLOC_PHASES; i += 1) {
+        const AllocCounts& counts = stats.phases[i];
+        if (counts.count == 0) {
+            continue;
+        }
+        write(
+            out, any ? ", " : " ", PHASE_NAMES[i], " ", counts.count, " (",
+            counts.bytes, " B, peak ", counts.peak, " B)"
+        );
+        any = true;
+    }
+    if (any) {
+        writeln(out, ", peak ", stats.peak, " B");
+    } else {
+        writeln(out, " none");
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+/**
+ * @brief Part of the pipeline that allocations are attributed to.
+ */
+enum class AllocPhase : uint8_t {
+    Tokenize,
+    Compile,
+    Interpret,
+    Report,
+    Output,
+    /// Allocations are not counted at all
+    None,
+};
+
+/// Amount of phases that are counted (all but `AllocPhase::None`)
+constexpr size_t ALLOC_PHASES = static_cast<size_t>(AllocPhase::None);
+
+/**
+ * @brief Display name of a phase, e.g. "compile".
+ */
+auto alloc_phase_name(AllocPhase phase) -> std::string_view;
+
+/**
+ * @brief Allocations of a single phase.
+ */
+struct AllocCounts {
+    size_t count = 0;
+    /// Requested bytes
+    size_t bytes = 0;
+    /// Most bytes that were live at once, on top of those that were already
+    /// live when the phase began (includes the rounding of `malloc`)
+    size_t peak = 0;
+};
+
+/**
+ * @brief Allocations of every phase since the last `take_alloc_stats`.
+ */
+struct AllocStats {
+    std::array<AllocCounts, ALLOC_PHASES> phases{};
+    /// Most bytes that were live at once over all phases
+    size_t peak = 0;
+
+    /**
+     * @brief Adds the counts of `other` and keeps the higher peaks.
+     */
+    void merge(const AllocStats& other);
+};
+
+/**
+ * @brief Attributes all following allocations (of every thread) to `phase`.
+ *
+ * The global `operator new` and `operator delete` are replaced by counting
+ * ones. While the phase is `AllocPhase::None` (the default), they only check
+ * the phase and do not count anything.
+ */
+void set_alloc_phase(AllocPhase phase);
+
+/**
+ * @brief Returns the allocations since the last call and resets them.
+ *
+ * The returned statistics are also added to `alloc_stats_total`.
+ */
+auto take_alloc_stats() -> AllocStats;
+
+/**
+ * @brief Sum of everything that was returned by `take_alloc_stats`.
+ */
+auto alloc_stats_total() -> const AllocStats&;
+
+/**
+ * @brief Writes the phases with allocations on a single line.
+ * @param out Stream to write into.
+ * @param label What the statistics belong to, e.g. "line 3".
+ * @param stats The statistics to write.
+ */
+void write_alloc_stats(
+    std::ostream& out, std::string_view label, const AllocStats& stats
+);
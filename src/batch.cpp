@@ -0,0 +1,354 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+#include "format.hpp"
+#include "interpret.hpp"
+#include "lanes.hpp"
+
+using Lanes = LaneStack<BATCH_LANES>::Lanes;
+
+/**
+ * @brief Evaluates `BATCH_LANES` chunks of the same shape at once.
+ */
+struct BatchEvaluator {
+    BatchEvaluator(const Environment& environment)
+        : m_environment(environment) {}
+
+    /**
+     * @brief Evaluates the opcodes of `shape` with the literals of each lane.
+     * @param shape Any of the chunks, for its opcodes and operands.
+     * @param columns Every literal for all lanes.
+     * @param active Lanes from the first one that hold a chunk, the others
+     *               do not call functions.
+     * @return Value of the chunk of each lane.
+     */
+    auto evaluate(
+        const Chunk& shape, std::span<const Lanes> columns, size_t active
+    ) -> Lanes {
+        size_t opcode_index = 0;
+        size_t literal_index = 0;
+        size_t operand_index = 0;
+        // Verified chunks never need more space
+        m_lanes.reset(shape.limits.value().max_stack_depth, active);
+
+        auto jump = [&]() {
+            opcode_index += shape.operands[operand_index];
+            literal_index += shape.operands[operand_index + 1];
+            operand_index += JUMP_OPERANDS + shape.operands[operand_index + 2];
+        };
+
+        while (true) {
+            m_lanes.finish_blends(opcode_index);
+            if (opcode_index == shape.opcodes.size()) {
+                break;
+            }
+            const OpCode opcode = shape.opcodes[opcode_index];
+            opcode_index += 1;
+
+            switch (opcode) {
+                case OpCode::Load:
+                    m_lanes.push(columns[literal_index]);
+                    literal_index += 1;
+                    break;
+                case OpCode::Variable:
+                    m_lanes.broadcast(
+                        m_environment.values[shape.operands[operand_index]]
+                    );
+                    operand_index += 1;
+                    break;
+                case OpCode::Add:
+                    m_lanes.binary<OpCode::Add>();
+                    break;
+                case OpCode::Sub:
+                    m_lanes.binary<OpCode::Sub>();
+                    break;
+                case OpCode::Mul:
+                    m_lanes.binary<OpCode::Mul>();
+                    break;
+                case OpCode::Div:
+                    m_lanes.binary<OpCode::Div>();
+                    break;
+                case OpCode::Less:
+                    m_lanes.binary<OpCode::Less>();
+                    break;
+                case OpCode::LessEqual:
+                    m_lanes.binary<OpCode::LessEqual>();
+                    break;
+                case OpCode::Greater:
+                    m_lanes.binary<OpCode::Greater>();
+                    break;
+                case OpCode::GreaterEqual:
+                    m_lanes.binary<OpCode::GreaterEqual>();
+                    break;
+                case OpCode::Equal:
+                    m_lanes.binary<OpCode::Equal>();
+                    break;
+                case OpCode::NotEqual:
+                    m_lanes.binary<OpCode::NotEqual>();
+                    break;
+                case OpCode::Pow:
+                    m_lanes.binary<OpCode::Pow>();
+                    break;
+                case OpCode::Min:
+                    m_lanes.binary<OpCode::Min>();
+                    break;
+                case OpCode::Max:
+                    m_lanes.binary<OpCode::Max>();
+                    break;
+                case OpCode::Hypot:
+                    m_lanes.binary<OpCode::Hypot>();
+                    break;
+                case OpCode::Atan2:
+                    m_lanes.binary<OpCode::Atan2>();
+                    break;
+                case OpCode::Cos:
+                case OpCode::Sin:
+                case OpCode::Tan:
+                case OpCode::Exp:
+                case OpCode::Log:
+                case OpCode::Sqrt:
+                case OpCode::Abs:
+                case OpCode::Atan:
+                    m_lanes.unary(opcode);
+                    break;
+                case OpCode::Call:
+                    m_lanes.call(
+                        shape.operands[operand_index], m_environment, nullptr
+                    );
+                    operand_index += 1;
+                    break;
+                case OpCode::JumpIfZero: {
+                    const size_t else_start =
+                        opcode_index + shape.operands[operand_index];
+                    if (m_lanes.branch(else_start) == LaneBranch::Else) {
+                        jump();
+                    } else {
+                        operand_index += JUMP_OPERANDS;
+                    }
+                    break;
+                }
+                case OpCode::Jump: {
+                    // The end of the then branch of a blended conditional
+                    // continues with its else branch instead of skipping it
+                    const size_t end =
+                        opcode_index + shape.operands[operand_index];
+                    if (m_lanes.enter_else(opcode_index, end)) {
+                        operand_index += JUMP_OPERANDS;
+                    } else {
+                        jump();
+                    }
+                    break;
+                }
+                default:
+                    panic(
+                        "Internal Error: OpCode <",
+                        static_cast<uint8_t>(opcode),
+                        "> is not allowed in a batch"
+                    );
+            }
+        }
+
+        return m_lanes.top();
+    }
+
+   private:
+    const Environment& m_environment;
+    LaneStack<BATCH_LANES> m_lanes;
+};
+
+/**
+ * @brief Mixes the bytes of a vector into `hash`, 8 at a time.
+ */
+template <typename T>
+static void hash_bytes(uint64_t& hash, const std::vector<T>& values) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(values.data());
+    const size_t size = values.size() * sizeof(T);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+    }
+    if (i < size) {
+        uint64_t word = 0;
+        for (size_t shift = 0; i < size; i += 1, shift += 8) {
+            word |= uint64_t(bytes[i]) << shift;
+        }
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+    }
+}
+
+/**
+ * @brief Hashes the opcodes and operands of a chunk, but not its literals.
+ */
+static auto hash_shape(const Chunk& chunk) -> uint64_t {
+    uint64_t hash = chunk.opcodes.size();
+    hash_bytes(hash, chunk.opcodes);
+    hash_bytes(hash, chunk.operands);
+    // The table only uses the lowest bits
+    return hash ^ (hash >> 32);
+}
+
+static auto same_shape(const Chunk& lhs, const Chunk& rhs) -> bool {
+    return lhs.opcodes == rhs.opcodes && lhs.operands == rhs.operands;
+}
+
+/**
+ * @brief Chunks of a window sorted by their shape, reused for every window.
+ */
+struct ShapeGroups {
+    /// Open addressing table of `group + 1` by hash, 0 for empty entries
+    std::vector<uint32_t> table;
+    /// First chunk and hash of each group, in order of their first chunk
+    std::vector<const Chunk*> shapes;
+    std::vector<uint64_t> hashes;
+    /// Group of each chunk, or `UINT32_MAX` for chunks that are interpreted
+    /// on their own
+    std::vector<uint32_t> chunk_groups;
+    /// Where each group starts in `order`, followed by the end of the last
+    std::vector<uint32_t> starts;
+    /// Chunks of each group, group after group
+    std::vector<uint32_t> order;
+
+    /**
+     * @brief Finds the group of a chunk, adding a group for a new shape.
+     */
+    auto find(const Chunk& chunk) -> uint32_t {
+        const uint64_t hash = hash_shape(chunk);
+        // The table has a power of 2 size and is never more than half full
+        const size_t mask = table.size() - 1;
+        for (size_t entry = hash & mask;; entry = (entry + 1) & mask) {
+            if (table[entry] == 0) {
+                const auto group = static_cast<uint32_t>(shapes.size());
+                table[entry] = group + 1;
+                shapes.push_back(&chunk);
+                hashes.push_back(hash);
+                starts.push_back(0);
+                return group;
+            }
+            const uint32_t group = table[entry] - 1;
+            if (hashes[group] == hash && same_shape(*shapes[group], chunk)) {
+                return group;
+            }
+        }
+    }
+};
+
+/**
+ * @brief Whether a chunk could be evaluated together with others.
+ */
+static auto can_group(const Chunk* chunk) -> bool {
+    return chunk->reductions.empty() &&
+           chunk->opcodes.size() >= BATCH_MIN_OPCODES;
+}
+
+/**
+ * @brief Evaluates a window of chunks, @see `interpret_batch`.
+ */
+static void interpret_window(
+    std::span<const Chunk* const> chunks, std::span<Number> results,
+    ShapeGroups& groups, BatchEvaluator& evaluator,
+    const Environment& environment, BatchStats& stats
+) {
+    // Finding shapes does not pay off if few chunks could share one
+    const auto candidates = std::ranges::count_if(chunks, can_group);
+    if (static_cast<size_t>(candidates) * BATCH_MIN_GROUPED < chunks.size()) {
+        for (size_t i = 0; i < chunks.size(); i += 1) {
+            results[i] = interpret(*chunks[i], environment);
+        }
+        return;
+    }
+
+    groups.table.assign(2 * BATCH_WINDOW, 0);
+    groups.shapes.clear();
+    groups.hashes.clear();
+    groups.chunk_groups.clear();
+    groups.starts.clear();
+    for (size_t i = 0; i < chunks.size(); i += 1) {
+        if (!can_group(chunks[i])) {
+            results[i] = interpret(*chunks[i], environment);
+            groups.chunk_groups.push_back(UINT32_MAX);
+            continue;
+        }
+        const uint32_t group = groups.find(*chunks[i]);
+        groups.chunk_groups.push_back(group);
+        groups.starts[group] += 1;
+    }
+
+    // Sorts the chunks by their group, keeping their order within it
+    uint32_t start = 0;
+    for (uint32_t& size : groups.starts) {
+        start += std::exchange(size, start);
+    }
+    groups.starts.push_back(start);
+    groups.order.resize(start);
+    for (size_t i = 0; i < chunks.size(); i += 1) {
+        const uint32_t group = groups.chunk_groups[i];
+        if (group != UINT32_MAX) {
+            groups.order[groups.starts[group]] = static_cast<uint32_t>(i);
+            groups.starts[group] += 1;
+        }
+    }
+    // Every group now starts where the next one started
+    std::shift_right(groups.starts.begin(), groups.starts.end(), 1);
+    groups.starts[0] = 0;
+
+    std::vector<Lanes> columns;
+    for (size_t g = 0; g + 1 < groups.starts.size(); g += 1) {
+        const std::span<const uint32_t> group(
+            groups.order.begin() + groups.starts[g],
+            groups.order.begin() + groups.starts[g + 1]
+        );
+        if (group.size() == 1) {
+            results[group[0]] = interpret(*chunks[group[0]], environment);
+            continue;
+        }
+        stats.grouped += group.size();
+        stats.shapes += 1;
+
+        const Chunk& shape = *chunks[group[0]];
+        columns.resize(shape.literals.size());
+        for (size_t first = 0; first < group.size(); first += BATCH_LANES) {
+            // Lanes after the end of the group repeat its last chunk
+            for (size_t lane = 0; lane < BATCH_LANES; lane += 1) {
+                const size_t member = std::min(first + lane, group.size() - 1);
+                const std::vector<Number>& literals =
+                    chunks[group[member]]->literals;
+                for (size_t i = 0; i < literals.size(); i += 1) {
+                    columns[i][lane] = literals[i];
+                }
+            }
+            const size_t lanes = std::min(BATCH_LANES, group.size() - first);
+            const Lanes values = evaluator.evaluate(shape, columns, lanes);
+            for (size_t lane = 0; lane < lanes; lane += 1) {
+                results[group[first + lane]] = values[lane];
+            }
+        }
+    }
+}
+
+auto interpret_batch(
+    std::span<const Chunk* const> chunks, const Environment& environment,
+    BatchStats* stats
+) -> std::vector<Number> {
+    BatchEvaluator evaluator(environment);
+    ShapeGroups groups;
+    BatchStats totals{.chunks = chunks.size()};
+    std::vector<Number> results(chunks.size());
+    for (size_t start = 0; start < chunks.size(); start += BATCH_WINDOW) {
+        const size_t size = std::min(BATCH_WINDOW, chunks.size() - start);
+        interpret_window(
+            chunks.subspan(start, size),
+            std::span(results).subspan(start, size), groups, evaluator,
+            environment, totals
+        );
+    }
+    if (stats) {
+        *stats = totals;
+    }
+    return results;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "chunk.hpp"
+#include "environment.hpp"
+
+/// Chunks of the same shape that are evaluated at once, every operation is
+/// applied to all of them in a loop that can be vectorized
+constexpr size_t BATCH_LANES = 8;
+
+/// Chunks with fewer opcodes are interpreted on their own, finding their
+/// shape would take longer than interpreting them
+constexpr size_t BATCH_MIN_OPCODES = 8;
+
+/// Windows where less than 1 in this many chunks could be grouped are
+/// interpreted one chunk at a time, as hashing the few that could costs
+/// more than their lanes save
+constexpr size_t BATCH_MIN_GROUPED = 2;
+
+/// Chunks that are grouped by their shape at once, few enough that they
+/// are still cached when they are evaluated
+constexpr size_t BATCH_WINDOW = 1024;
+
+/**
+ * @brief How many chunks of a batch could be evaluated together with others.
+ */
+struct BatchStats {
+    size_t chunks = 0;
+    /// Chunks that shared their shape with at least one other chunk
+    size_t grouped = 0;
+    /// Groups of chunks of the same shape, summed over all windows
+    size_t shapes = 0;
+};
+
+/**
+ * @brief Evaluates many chunks, executing each opcode once for up to
+ *        `BATCH_LANES` chunks of the same shape.
+ *
+ * Chunks have the same shape if their opcodes and operands are identical,
+ * so that they only differ in their literals (like a formula that is
+ * evaluated for different numbers). The literals of each group of chunks are
+ * laid out in columns, with one lane per chunk. Conditionals whose condition
+ * differs between lanes evaluate both branches, which are blended
+ * afterwards.
+ *
+ * Chunks are grouped within windows of `BATCH_WINDOW` consecutive chunks.
+ * Chunks with a unique shape or with reductions are interpreted one at a
+ * time, like all chunks of windows where too few could be grouped. Every
+ * operation is applied to the same operands as in `interpret`, so the
+ * results are bit identical.
+ *
+ * @pre Every chunk passed `verify`.
+ * @param chunks The chunks to evaluate.
+ * @param environment Variables and functions that the chunks were compiled
+ *                    with.
+ * @param stats Receives how well the chunks could be grouped, if set.
+ * @return Result of each chunk.
+ */
+auto interpret_batch(
+    std::span<const Chunk* const> chunks, const Environment& environment,
+    BatchStats* stats = nullptr
+) -> std::vector<Number>;
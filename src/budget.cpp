@@ -0,0 +1,129 @@
+#include "budget.hpp"
+
+#include <signal.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <vector>
+
+#include "format.hpp"
+
+static std::atomic<StopReason> g_stop_reason = StopReason::None;
+/// Whether a line is being evaluated, CTRL+C ends the process otherwise
+static std::atomic<bool> g_evaluating = false;
+static bool g_alarm_installed = false;
+static bool g_alarm_armed = false;
+
+auto budget_report(
+    size_t limit, std::string_view unit, std::string_view option,
+    std::optional<Span> span
+) -> Report {
+    std::vector<Span> spans;
+    if (span) {
+        spans.push_back(*span);
+    }
+    return Report{
+        .kind = ReportKind::Error,
+        .message = concat("Line exceeds the budget of ", limit, " ", unit),
+        .spans = std::move(spans),
+        .comments =
+            {{ReportKind::Note, concat("Use ", option, " N to change it")}}
+    };
+}
+
+static void on_alarm(int /* signal */) {
+    if (g_evaluating.load(std::memory_order_relaxed)) {
+        g_stop_reason.store(StopReason::TimedOut, std::memory_order_relaxed);
+    }
+}
+
+static void on_interrupt(int signal) {
+    if (g_evaluating.load(std::memory_order_relaxed)) {
+        g_stop_reason.store(
+            StopReason::Interrupted, std::memory_order_relaxed
+        );
+        return;
+    }
+    // Behave as if there was no handler (both calls are signal safe)
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+}
+
+/**
+ * @brief Installs a handler that restarts interrupted system calls.
+ */
+static void install_handler(int signal, void (*handler)(int)) {
+    struct sigaction action {};
+    action.sa_handler = handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, nullptr);
+}
+
+/**
+ * @brief Arms (or with 0 disarms) the `SIGALRM` timer.
+ */
+static void set_alarm(std::chrono::milliseconds time) {
+    const auto milliseconds = static_cast<uint64_t>(time.count());
+    const itimerval timer{
+        .it_interval = {},
+        .it_value =
+            {
+                .tv_sec = static_cast<time_t>(milliseconds / 1000),
+                .tv_usec = static_cast<suseconds_t>(milliseconds % 1000 * 1000),
+            },
+    };
+    setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+void begin_evaluation(std::chrono::milliseconds max_time) {
+    g_stop_reason.store(StopReason::None, std::memory_order_relaxed);
+    g_evaluating.store(true, std::memory_order_relaxed);
+    if (max_time.count() > 0) {
+        if (!g_alarm_installed) {
+            install_handler(SIGALRM, on_alarm);
+            g_alarm_installed = true;
+        }
+        set_alarm(max_time);
+        g_alarm_armed = true;
+    }
+}
+
+void end_evaluation() {
+    if (g_alarm_armed) {
+        set_alarm(std::chrono::milliseconds(0));
+        g_alarm_armed = false;
+    }
+    g_evaluating.store(false, std::memory_order_relaxed);
+    g_stop_reason.store(StopReason::None, std::memory_order_relaxed);
+}
+
+auto stop_reason() -> StopReason {
+    return g_stop_reason.load(std::memory_order_relaxed);
+}
+
+auto stopped_report(const Budget& budget, std::optional<Span> span)
+    -> std::optional<Report> {
+    switch (stop_reason()) {
+        case StopReason::None:
+            return {};
+        case StopReason::Interrupted:
+            return Report{
+                .kind = ReportKind::Error,
+                .message = "Evaluation cancelled with CTRL+C",
+                .spans = span ? std::vector{*span} : std::vector<Span>{}
+            };
+        case StopReason::TimedOut:
+            return budget_report(
+                static_cast<size_t>(budget.max_time.count()), "ms",
+                "--max-time", span
+            );
+        default:
+            panic(
+                "Internal Error: StopReason <",
+                static_cast<uint8_t>(stop_reason()), "> not covered"
+            );
+    }
+}
+
+void cancel_on_interrupt() { install_handler(SIGINT, on_interrupt); }
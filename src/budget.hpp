@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "report.hpp"
+
+/// Expressions nested deeper than this are rejected by default, as the
+/// recursive compiler would run out of stack at around 15000 levels
+constexpr size_t DEFAULT_MAX_DEPTH = 4096;
+
+/**
+ * @brief Limits for the work spent on a single line, so that one
+ *        pathological line can not stall everything after it.
+ *
+ * Lines that exceed a limit are rejected with a `Report` instead of being
+ * evaluated (or while they are evaluated).
+ */
+struct Budget {
+    /// Length of the line
+    size_t max_bytes = SIZE_MAX;
+    /// Tokens pulled by the compiler, including invalid ones
+    size_t max_tokens = SIZE_MAX;
+    /// Expressions nested inside of each other
+    size_t max_depth = DEFAULT_MAX_DEPTH;
+    /// Opcodes of the compiled line, including the bodies of reductions
+    size_t max_opcodes = SIZE_MAX;
+    /// Wall time from compiling the line up to its result, 0 for no limit
+    std::chrono::milliseconds max_time{0};
+};
+
+/**
+ * @brief Report for a line that exceeds one of the limits of its `Budget`.
+ * @param limit Value of the limit.
+ * @param unit What the limit counts, e.g. "tokens".
+ * @param option Command line option that sets the limit.
+ * @param span Where the limit was exceeded, nothing for the whole line.
+ * @return The report.
+ */
+auto budget_report(
+    size_t limit, std::string_view unit, std::string_view option,
+    std::optional<Span> span
+) -> Report;
+
+/**
+ * @brief Why the current evaluation has to stop early.
+ */
+enum class StopReason : uint8_t {
+    None,
+    /// CTRL+C was pressed
+    Interrupted,
+    /// `Budget::max_time` has passed
+    TimedOut,
+};
+
+/**
+ * @brief Starts counting the wall time of a line and lets `SIGINT` stop it,
+ *        if `cancel_on_interrupt` was called.
+ *
+ * The time limit is enforced by a `SIGALRM` timer, whose handler only sets
+ * the reason to stop. Compiling and interpreting poll it at points that
+ * bound their work (expressions, calls and groups of reduction indices),
+ * so that checks stay a single relaxed load.
+ *
+ * @param max_time Time until the evaluation stops, 0 for no limit.
+ */
+void begin_evaluation(std::chrono::milliseconds max_time);
+
+/**
+ * @brief Stops the timer of `begin_evaluation` and clears the reason to stop.
+ */
+void end_evaluation();
+
+/**
+ * @brief Why the current evaluation has to stop, may be polled by any thread.
+ */
+auto stop_reason() -> StopReason;
+
+/**
+ * @brief Whether the current evaluation has to stop, cheap enough for hot
+ *        loops.
+ */
+inline auto evaluation_stopped() -> bool {
+    return stop_reason() != StopReason::None;
+}
+
+/**
+ * @brief Report for an evaluation that stopped early.
+ * @param budget The budget whose time limit may have been exceeded.
+ * @param span Where compilation stopped, nothing for interpreting.
+ * @return The report or nothing if the evaluation did not stop.
+ */
+auto stopped_report(const Budget& budget, std::optional<Span> span = {})
+    -> std::optional<Report>;
+
+/**
+ * @brief Makes CTRL+C stop the current evaluation instead of the process.
+ *
+ * Between evaluations (e.g. while waiting for input) CTRL+C still ends the
+ * process, as if no handler was installed.
+ */
+void cancel_on_interrupt();
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "chunk.hpp"
+
+/**
+ * @brief A function or constant that is always available.
+ */
+struct Builtin {
+    /// `OpCode::Load` for constants, the function or reduction otherwise
+    OpCode opcode;
+    /// Values that the opcode pops from the stack, 0 for constants
+    uint32_t arity = 0;
+    /// Value of constants
+    Number value = 0;
+};
+
+/**
+ * @brief A builtin together with the names it can be referred to by.
+ */
+struct BuiltinEntry {
+    std::string_view name;
+    /// Shorter (or longer) name, empty if there is none
+    std::string_view alias;
+    Builtin builtin;
+};
+
+/**
+ * @brief Every builtin function and constant.
+ *
+ * This is the only place where names are bound to opcodes. A new function
+ * also needs its `OpCode`, its operation in `apply_unary` or `apply_binary`
+ * and its derivative in the overloads for `Dual`.
+ */
+inline constexpr std::array BUILTINS = std::to_array<BuiltinEntry>({
+    // Constants
+    {"pi", "π", {.opcode = OpCode::Load, .value = M_PIf64}},
+    // Functions
+    {"cos", "c", {.opcode = OpCode::Cos, .arity = 1}},
+    {"sin", "s", {.opcode = OpCode::Sin, .arity = 1}},
+    {"tan", "", {.opcode = OpCode::Tan, .arity = 1}},
+    {"exp", "", {.opcode = OpCode::Exp, .arity = 1}},
+    {"log", "ln", {.opcode = OpCode::Log, .arity = 1}},
+    {"sqrt", "", {.opcode = OpCode::Sqrt, .arity = 1}},
+    {"abs", "", {.opcode = OpCode::Abs, .arity = 1}},
+    {"atan", "", {.opcode = OpCode::Atan, .arity = 1}},
+    {"pow", "", {.opcode = OpCode::Pow, .arity = 2}},
+    {"min", "", {.opcode = OpCode::Min, .arity = 2}},
+    {"max", "", {.opcode = OpCode::Max, .arity = 2}},
+    {"hypot", "", {.opcode = OpCode::Hypot, .arity = 2}},
+    // Takes y before x, like `atan2` in C
+    {"atan2", "", {.opcode = OpCode::Atan2, .arity = 2}},
+    // Reductions, which also take an index and a body
+    {"sum", "", {.opcode = OpCode::Sum, .arity = 2}},
+    {"prod", "", {.opcode = OpCode::Prod, .arity = 2}},
+});
+
+/// Slots of the hash table of builtin names, a power of 2
+constexpr size_t BUILTIN_SLOTS = 128;
+
+/**
+ * @brief FNV-1a hash of a name, mixed with a seed.
+ */
+constexpr auto hash_builtin_name(std::string_view name, uint32_t seed)
+    -> uint32_t {
+    uint32_t hash = 2166136261u ^ seed;
+    for (const char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Perfect hash table of all names of all builtins.
+ */
+struct BuiltinTable {
+    /// Seed for which no two names share a slot
+    uint32_t seed = 0;
+    /// `2 * entry + 1` for names, `2 * entry + 2` for aliases, 0 if empty
+    std::array<uint8_t, BUILTIN_SLOTS> slots{};
+    /// Longest name, longer identifiers are rejected without hashing
+    size_t max_length = 0;
+};
+
+/// Searches seeds until every name of `BUILTINS` has its own slot
+inline constexpr BuiltinTable BUILTIN_TABLE = []() {
+    static_assert(2 * BUILTINS.size() < UINT8_MAX);
+    for (uint32_t seed = 0;; seed += 1) {
+        BuiltinTable table{.seed = seed};
+        bool perfect = true;
+        for (size_t i = 0; i < BUILTINS.size() && perfect; i += 1) {
+            for (size_t alias = 0; alias < 2 && perfect; alias += 1) {
+                const std::string_view name =
+                    alias ? BUILTINS[i].alias : BUILTINS[i].name;
+                if (name.empty()) {
+                    continue;
+                }
+                uint8_t& slot = table.slots
+                    [hash_builtin_name(name, seed) % BUILTIN_SLOTS];
+                perfect = slot == 0;
+                slot = static_cast<uint8_t>(2 * i + alias + 1);
+                table.max_length = std::max(table.max_length, name.size());
+            }
+        }
+        if (perfect) {
+            return table;
+        }
+    }
+}();
+
+/**
+ * @brief Looks up builtin functions and constants by name (or alias).
+ *
+ * Hashes the name once and compares it with the only builtin that could
+ * have it, so identifiers that are not builtins are rejected just as fast.
+ *
+ * @param name Identifier to look up.
+ * @return The builtin or nothing if no builtin is called `name`.
+ */
+constexpr auto find_builtin(std::string_view name) -> std::optional<Builtin> {
+    if (name.size() > BUILTIN_TABLE.max_length) {
+        return {};
+    }
+    const uint8_t slot = BUILTIN_TABLE.slots
+        [hash_builtin_name(name, BUILTIN_TABLE.seed) % BUILTIN_SLOTS];
+    if (slot == 0) {
+        return {};
+    }
+    const BuiltinEntry& entry = BUILTINS[(slot - 1) / 2];
+    if (name != ((slot - 1) % 2 == 0 ? entry.name : entry.alias)) {
+        return {};
+    }
+    return entry.builtin;
+}
@@ -16,8 +16,60 @@ auto opcode_to_string(OpCode opcode) -> std::string_view {
             return "Cos";
         case OpCode::Sin:
             return "Sin";
+        case OpCode::Tan:
+            return "Tan";
+        case OpCode::Exp:
+            return "Exp";
+        case OpCode::Log:
+            return "Log";
+        case OpCode::Sqrt:
+            return "Sqrt";
+        case OpCode::Abs:
+            return "Abs";
+        case OpCode::Atan:
+            return "Atan";
+        case OpCode::Pow:
+            return "Pow";
+        case OpCode::Min:
+            return "Min";
+        case OpCode::Max:
+            return "Max";
+        case OpCode::Hypot:
+            return "Hypot";
+        case OpCode::Atan2:
+            return "Atan2";
         case OpCode::Load:
             return "Literal";
+        case OpCode::Variable:
+            return "Variable";
+        case OpCode::Call:
+            return "Call";
+        case OpCode::Ret:
+            return "Ret";
+        case OpCode::LoadArg:
+            return "LoadArg";
+        case OpCode::Sum:
+            return "Sum";
+        case OpCode::Prod:
+            return "Prod";
+        case OpCode::Index:
+            return "Index";
+        case OpCode::Less:
+            return "Less";
+        case OpCode::LessEqual:
+            return "LessEqual";
+        case OpCode::Greater:
+            return "Greater";
+        case OpCode::GreaterEqual:
+            return "GreaterEqual";
+        case OpCode::Equal:
+            return "Equal";
+        case OpCode::NotEqual:
+            return "NotEqual";
+        case OpCode::Jump:
+            return "Jump";
+        case OpCode::JumpIfZero:
+            return "JumpIfZero";
         default:
             panic(
                 "Internal Error: OpCode <", static_cast<uint8_t>(opcode),
@@ -26,5 +78,28 @@ auto opcode_to_string(OpCode opcode) -> std::string_view {
     }
 }
 
-Chunk::Chunk(std::vector<OpCode>&& opcodes, std::vector<Number>&& literals)
-    : opcodes(std::move(opcodes)), literals(std::move(literals)) {}
+auto opcode_operands(OpCode opcode) -> uint32_t {
+    switch (opcode) {
+        case OpCode::Variable:
+        case OpCode::Call:
+        case OpCode::LoadArg:
+        case OpCode::Sum:
+        case OpCode::Prod:
+        case OpCode::Index:
+            return 1;
+        case OpCode::Jump:
+        case OpCode::JumpIfZero:
+            return JUMP_OPERANDS;
+        default:
+            return 0;
+    }
+}
+
+Chunk::Chunk(
+    std::vector<OpCode>&& opcodes, std::vector<Number>&& literals,
+    std::vector<uint32_t>&& operands, std::vector<Chunk>&& reductions
+)
+    : opcodes(std::move(opcodes)),
+      literals(std::move(literals)),
+      operands(std::move(operands)),
+      reductions(std::move(reductions)) {}
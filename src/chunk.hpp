@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <string_view>
 #include <vector>
 
@@ -16,22 +18,89 @@ using Number = double;
  * @brief Operations/Instructions to be executed by the interpreter.
  */
 enum class OpCode : uint8_t {
-    /// pop A, pop B, push A + B
+    /// pop B, pop A, push A + B
     Add,
-    /// pop A, pop B, push A - B
+    /// pop B, pop A, push A - B
     Sub,
-    /// pop A, pop B, push A * B
+    /// pop B, pop A, push A * B
     Mul,
-    /// pop A, pop B, push A / B
+    /// pop B, pop A, push A / B
     Div,
     /// pop A, push cos(A)
     Cos,
     /// pop A, push sin(A)
     Sin,
+    /// pop A, push tan(A)
+    Tan,
+    /// pop A, push e^A
+    Exp,
+    /// pop A, push the natural logarithm of A
+    Log,
+    /// pop A, push the square root of A
+    Sqrt,
+    /// pop A, push |A|
+    Abs,
+    /// pop A, push the arctangent of A
+    Atan,
+    /// pop B, pop A, push A^B
+    Pow,
+    /// pop B, pop A, push the smaller one of A and B
+    Min,
+    /// pop B, pop A, push the larger one of A and B
+    Max,
+    /// pop B, pop A, push sqrt(A^2 + B^2) without overflowing early
+    Hypot,
+    /// pop B, pop A, push the angle of the point (B, A) (atan(A / B) in the
+    /// right quadrant)
+    Atan2,
     /// push next literal
     Load,
+    /// push value of the variable in the slot of the next operand
+    Variable,
+    /// call the function in the slot of the next operand, its arguments stay
+    /// on the stack until it returns
+    Call,
+    /// pop A, drop the arguments of the current function, push A and continue
+    /// after the call
+    Ret,
+    /// push the argument of the current function with the index of the next
+    /// operand
+    LoadArg,
+    /// pop B, pop A, push the sum of the reduction in the slot of the next
+    /// operand over all indices from A up to B
+    Sum,
+    /// pop B, pop A, push the product of the reduction in the slot of the next
+    /// operand over all indices from A up to B
+    Prod,
+    /// push the index of the enclosing reduction with the nesting level of the
+    /// next operand (0 for the outermost one)
+    Index,
+    /// pop B, pop A, push 1 if A < B, otherwise 0
+    Less,
+    /// pop B, pop A, push 1 if A <= B, otherwise 0
+    LessEqual,
+    /// pop B, pop A, push 1 if A > B, otherwise 0
+    Greater,
+    /// pop B, pop A, push 1 if A >= B, otherwise 0
+    GreaterEqual,
+    /// pop B, pop A, push 1 if A == B, otherwise 0
+    Equal,
+    /// pop B, pop A, push 1 if A != B, otherwise 0
+    NotEqual,
+    /// skip as many opcodes, literals and operands as the next three operands
+    /// say (always forwards)
+    Jump,
+    /// pop A, `Jump` if A is 0, otherwise only consume the three operands
+    JumpIfZero,
 };
 
+/// Amount of opcodes, every value below is a valid `OpCode`
+constexpr size_t OPCODE_COUNT = static_cast<size_t>(OpCode::JumpIfZero) + 1;
+
+/// Operands of `Jump` and `JumpIfZero`: the skipped opcodes, literals and
+/// operands (counted from the end of the jump's own operands)
+constexpr uint32_t JUMP_OPERANDS = 3;
+
 /**
  * @brief String name of an OpCode.
  * @param opcode The OpCode.
@@ -39,13 +108,114 @@ enum class OpCode : uint8_t {
  */
 auto opcode_to_string(OpCode opcode) -> std::string_view;
 
+/**
+ * @brief How many operands of a `Chunk` an OpCode consumes.
+ * @param opcode The OpCode.
+ * @return One for opcodes that refer to slots or arguments,
+ *         `JUMP_OPERANDS` for jumps and zero for all others.
+ */
+auto opcode_operands(OpCode opcode) -> uint32_t;
+
+/**
+ * @brief Bounds that hold for every execution of a `Chunk`, computed by
+ *        `verify`.
+ */
+struct ChunkLimits {
+    /// Highest amount of values on the stack, including the values of all
+    /// (nested) function calls
+    uint32_t max_stack_depth = 0;
+    /// Highest amount of nested function calls
+    uint32_t max_call_depth = 0;
+};
+
 /**
  * @brief Represents a validated expression, compiled to opcodes and
  *        literals.
  */
 struct Chunk {
-    Chunk(std::vector<OpCode>&& m_opcodes, std::vector<Number>&& m_literals);
+    Chunk(
+        std::vector<OpCode>&& m_opcodes, std::vector<Number>&& m_literals,
+        std::vector<uint32_t>&& m_operands = {},
+        std::vector<Chunk>&& m_reductions = {}
+    );
 
     const std::vector<OpCode> opcodes;
     const std::vector<Number> literals;
+    /// Indices used by opcodes like `Variable`, in the order they are used
+    const std::vector<uint32_t> operands;
+    /// Bodies of the `Sum` and `Prod` opcodes, compiled once and evaluated
+    /// for every index
+    const std::vector<Chunk> reductions;
+    /// Set once the chunk has passed `verify`, which also guarantees that
+    /// every literal and operand is consumed exactly once
+    std::optional<ChunkLimits> limits;
+};
+
+/**
+ * @brief Where the code of a value on the stack starts, in each of the
+ *        vectors of a `Chunk`.
+ */
+struct Segment {
+    size_t opcode_start;
+    size_t literal_start;
+    size_t operand_start;
+};
+
+/**
+ * @brief A `Chunk` that is still being built.
+ */
+struct ChunkBuilder {
+    std::vector<OpCode> opcodes;
+    std::vector<Number> literals;
+    std::vector<uint32_t> operands;
+
+    /**
+     * @brief Where the next value would start.
+     */
+    auto end() const -> Segment {
+        return {opcodes.size(), literals.size(), operands.size()};
+    }
+
+    /**
+     * @brief Appends code, that has been removed from this builder before.
+     * @param code The code to append.
+     * @param start Start of the code to append.
+     * @param end End of the code to append.
+     */
+    void append(const ChunkBuilder& code, Segment start, Segment end) {
+        opcodes.insert(
+            opcodes.end(), code.opcodes.begin() + start.opcode_start,
+            code.opcodes.begin() + end.opcode_start
+        );
+        literals.insert(
+            literals.end(), code.literals.begin() + start.literal_start,
+            code.literals.begin() + end.literal_start
+        );
+        operands.insert(
+            operands.end(), code.operands.begin() + start.operand_start,
+            code.operands.begin() + end.operand_start
+        );
+    }
+
+    /**
+     * @brief Removes all code.
+     */
+    void clear() {
+        opcodes.clear();
+        literals.clear();
+        operands.clear();
+    }
+
+    /**
+     * @brief Moves all code after `start` into `code`, replacing its contents.
+     * @param start Start of the removed code.
+     * @param code Builder that receives the removed code.
+     */
+    void split_off(Segment start, ChunkBuilder& code) {
+        code.clear();
+        code.append(*this, start, end());
+        opcodes.resize(start.opcode_start);
+        literals.resize(start.literal_start);
+        operands.resize(start.operand_start);
+    }
 };
@@ -1,52 +1,166 @@
 #include "compile.hpp"
 
 #include <algorithm>
+#include <charconv>
 #include <cmath>
 #include <ranges>
+#include <utility>
 
 #include "format.hpp"
 
-auto Compiler::compile(std::span<const Token> tokens, std::string_view source)
-    -> std::expected<Chunk, Report> {
-    Compiler compiler(tokens, source);
+auto Compiler::compile(
+    const TokenBuffer& tokens, std::string_view source,
+    const Environment& environment, const Budget& budget
+) -> std::expected<Chunk, Report> {
+    Compiler compiler(TokenStream(tokens), source, environment, budget);
+    return compiler.compile_chunk();
+}
+
+auto Compiler::compile(
+    TokenCursor tokens, std::string_view source, const Environment& environment,
+    const Budget& budget
+) -> std::expected<Chunk, Report> {
+    Compiler compiler(TokenStream(tokens), source, environment, budget);
+    return compiler.compile_chunk();
+}
+
+auto Compiler::compile_statement(
+    const TokenBuffer& tokens, std::string_view source,
+    const Environment& environment, const Budget& budget
+) -> std::expected<Statement, Report> {
+    Compiler compiler(TokenStream(tokens), source, environment, budget);
+    return compiler.compile_statement();
+}
+
+auto Compiler::compile_statement(
+    TokenCursor tokens, std::string_view source, const Environment& environment,
+    const Budget& budget
+) -> std::expected<Statement, Report> {
+    Compiler compiler(TokenStream(tokens), source, environment, budget);
+    return compiler.compile_statement();
+}
 
-    if (const auto maybe_report = compiler.compile_expr()) {
+auto Compiler::compile_chunk() -> std::expected<Chunk, Report> {
+    if (const auto maybe_report = compile_expr()) {
         return std::unexpected(maybe_report.value());
     }
-    if (const auto maybe_report =
-            compiler.m_tokens.expect(TokenKind::EndOfInput)) {
+    if (const auto maybe_report = m_tokens.expect(TokenKind::EndOfInput)) {
         return std::unexpected(maybe_report.value());
     }
-
-    // opcodes and literals are pushed back in reverse order,
-    // reversing them puts them in the correct order for execution
-    std::reverse(compiler.m_opcodes.begin(), compiler.m_opcodes.end());
-    std::reverse(compiler.m_literals.begin(), compiler.m_literals.end());
-
-    return Chunk(std::move(compiler.m_opcodes), std::move(compiler.m_literals));
+    if (!m_parameters.empty()) {
+        emit(OpCode::Ret);
+    }
+    // Operators are emitted after the last check of their operands
+    if (const auto maybe_report = check_budget(m_tokens.peek())) {
+        return std::unexpected(maybe_report.value());
+    }
+    return take_chunk();
 }
 
-Compiler::Compiler(std::span<const Token> tokens, std::string_view source)
-    : m_source(source), m_tokens(TokenStream(tokens)) {}
+auto Compiler::take_chunk() -> Chunk {
+    return Chunk(
+        std::exchange(m_opcodes, {}), std::exchange(m_literals, {}),
+        std::exchange(m_operands, {}), std::exchange(m_reductions, {})
+    );
+}
 
 /**
- * @brief Parse a number from the substring that `span` points to.
- *
- * Generates a `Report` referencing the `span` if parsing fails.
- *
- * @param span Describes the substring of `source` to parse.
- * @param source String used to generate `span`.
- * @return Either a `Number` or a `Report`.
+ * @brief Checks whether a name may be used for a definition or parameter.
+ * @param token Identifier token of the name.
+ * @param source Input used to generate the token.
+ * @return A `Report` if the name refers to a builtin.
  */
-static auto parse_number(Span span, std::string_view source)
+static auto validate_name(const Token& token, std::string_view source)
+    -> std::optional<Report> {
+    if (token.kind != TokenKind::Identifier) {
+        return Report{
+            .kind = ReportKind::Error,
+            .message = concat("Expected <Identifier> found <", token.name(), ">"),
+            .spans = {token.span}
+        };
+    }
+    const std::string_view ident = token.source(source);
+    if (ident == "let" || find_builtin(ident)) {
+        return Report{
+            .kind = ReportKind::Error,
+            .message = concat("Cannot redefine builtin <", ident, ">"),
+            .spans = {token.span}
+        };
+    }
+    return {};
+}
+
+auto Compiler::compile_statement() -> std::expected<Statement, Report> {
+    std::optional<Span> definition;
+    std::vector<Span> parameters;
+
+    const Token first = m_tokens.peek();
+    if (first.kind == TokenKind::Identifier && first.source(m_source) == "let") {
+        m_tokens.next();
+
+        const Token name = m_tokens.next();
+        if (const auto maybe_report = validate_name(name, m_source)) {
+            return std::unexpected(maybe_report.value());
+        }
+        definition = name.span;
+
+        while (m_tokens.peek().kind == TokenKind::Identifier) {
+            if (const auto maybe_report = check_budget(m_tokens.peek())) {
+                return std::unexpected(maybe_report.value());
+            }
+            const Token parameter = m_tokens.next();
+            if (const auto maybe_report = validate_name(parameter, m_source)) {
+                return std::unexpected(maybe_report.value());
+            }
+
+            const std::string_view ident = parameter.source(m_source);
+            if (std::ranges::find(m_parameters, ident) != m_parameters.end()) {
+                return std::unexpected(Report{
+                    .kind = ReportKind::Error,
+                    .message = concat("Duplicate parameter <", ident, ">"),
+                    .spans = {parameter.span}
+                });
+            }
+            m_parameters.push_back(ident);
+            parameters.push_back(parameter.span);
+        }
+
+        if (const auto maybe_report = m_tokens.expect(TokenKind::Equals)) {
+            return std::unexpected(maybe_report.value());
+        }
+    }
+
+    auto maybe_chunk = compile_chunk();
+    if (!maybe_chunk.has_value()) {
+        return std::unexpected(maybe_chunk.error());
+    }
+    return Statement{
+        .definition = definition,
+        .parameters = std::move(parameters),
+        .chunk = std::move(maybe_chunk.value())
+    };
+}
+
+Compiler::Compiler(
+    TokenStream tokens, std::string_view source, const Environment& environment,
+    const Budget& budget
+)
+    : m_source(source),
+      m_environment(environment),
+      m_budget(budget),
+      m_tokens(std::move(tokens)) {}
+
+auto parse_number(Span span, std::string_view source)
     -> std::expected<Number, Report> {
     auto no_underscores = span.source(source) |
                           std::views::filter([](char c) { return c != '_'; });
     std::string filtered(no_underscores.begin(), no_underscores.end());
 
-    try {
-        return std::stod(filtered);
-    } catch (const std::out_of_range& _) {
+    Number value = 0;
+    const char* end = filtered.data() + filtered.size();
+    const auto [ptr, error] = std::from_chars(filtered.data(), end, value);
+
+    if (error == std::errc::result_out_of_range) {
         std::pair<ReportKind, std::string> note = {
             ReportKind::Note,
             concat(std::numeric_limits<Number>::max(), " is the maximum")
@@ -57,21 +171,18 @@ static auto parse_number(Span span, std::string_view source)
             .spans = {span},
             .comments = {note}
         });
-    } catch (const std::invalid_argument& _) {
+    }
+    if (error != std::errc() || ptr != end) {
         return std::unexpected(Report{
             .kind = ReportKind::Error,
             .message = "Number literal invalid",
             .spans = {span}
         });
     }
+    return value;
 }
 
-/**
- * @brief The corresponding binary operation for tokens that describe one.
- * @param kind The `TokenKind` to analyze.
- * @return The corresponding opcode or nothing.
- */
-static auto token_kind_to_binary_op(TokenKind kind) -> std::optional<OpCode> {
+auto token_kind_to_binary_op(TokenKind kind) -> std::optional<OpCode> {
     switch (kind) {
         case TokenKind::Plus:
             return OpCode::Add;
@@ -81,14 +192,65 @@ static auto token_kind_to_binary_op(TokenKind kind) -> std::optional<OpCode> {
             return OpCode::Mul;
         case TokenKind::Slash:
             return OpCode::Div;
+        case TokenKind::Less:
+            return OpCode::Less;
+        case TokenKind::LessEqual:
+            return OpCode::LessEqual;
+        case TokenKind::Greater:
+            return OpCode::Greater;
+        case TokenKind::GreaterEqual:
+            return OpCode::GreaterEqual;
+        case TokenKind::EqualEqual:
+            return OpCode::Equal;
+        case TokenKind::BangEqual:
+            return OpCode::NotEqual;
         default:
             return {};
     }
 }
 
+auto Compiler::check_budget(const Token& token) const
+    -> std::optional<Report> {
+    if (m_source.size() > m_budget.max_bytes) {
+        return budget_report(m_budget.max_bytes, "bytes", "--max-bytes", {});
+    }
+    if (m_tokens.popped() > m_budget.max_tokens) {
+        return budget_report(
+            m_budget.max_tokens, "tokens", "--max-tokens", token.span
+        );
+    }
+    if (m_emitted > m_budget.max_opcodes) {
+        return budget_report(
+            m_budget.max_opcodes, "opcodes", "--max-opcodes", token.span
+        );
+    }
+    return stopped_report(m_budget, token.span);
+}
+
 auto Compiler::compile_expr() -> std::optional<Report> {
-    const Token& token = m_tokens.next();
+    const Token token = m_tokens.next();
+    if (m_depth == m_budget.max_depth) {
+        return budget_report(
+            m_budget.max_depth, "nested expressions", "--max-depth",
+            token.span
+        );
+    }
+    if (auto report = check_budget(token)) {
+        return report;
+    }
 
+    // Restores the depth on every way out, so that the report can be
+    // returned without a copy
+    struct Nesting {
+        size_t& depth;
+        ~Nesting() { depth -= 1; }
+    };
+    m_depth += 1;
+    const Nesting nesting{m_depth};
+    return compile_expr_from(token);
+}
+
+auto Compiler::compile_expr_from(const Token& token) -> std::optional<Report> {
     if (token.kind == TokenKind::Number) {
         const auto maybe_number = parse_number(token.span, m_source);
         if (maybe_number.has_value()) {
@@ -101,17 +263,48 @@ auto Compiler::compile_expr() -> std::optional<Report> {
     if (token.kind == TokenKind::Identifier) {
         std::string_view ident = token.source(m_source);
 
-        // Constants
-        if (ident == "π" || ident == "pi") {
-            compile_literal(M_PIf64);
+        // Inner indices shadow outer ones
+        const auto index =
+            std::ranges::find(m_indices.rbegin(), m_indices.rend(), ident);
+        if (index != m_indices.rend()) {
+            emit(OpCode::Index);
+            m_operands.push_back(
+                static_cast<uint32_t>(m_indices.rend() - index - 1)
+            );
             return {};
         }
 
-        // Functions
-        if (ident == "cos" || ident == "c")
-            return compile_unary(OpCode::Cos);
-        else if (ident == "sin" || ident == "s")
-            return compile_unary(OpCode::Sin);
+        const auto parameter = std::ranges::find(m_parameters, ident);
+        if (parameter != m_parameters.end()) {
+            compile_argument(
+                static_cast<uint32_t>(parameter - m_parameters.begin())
+            );
+            return {};
+        }
+
+        if (const auto builtin = find_builtin(ident)) {
+            if (builtin->opcode == OpCode::Load) {
+                compile_literal(builtin->value);
+                return {};
+            }
+            if (builtin->opcode == OpCode::Sum ||
+                builtin->opcode == OpCode::Prod) {
+                return compile_reduction(builtin->opcode);
+            }
+            if (builtin->arity == 2) {
+                return compile_binary(builtin->opcode);
+            }
+            return compile_unary(builtin->opcode);
+        }
+
+        if (const auto slot = m_environment.find(ident)) {
+            const uint32_t arity = m_environment.arity(slot.value());
+            if (arity > 0) {
+                return compile_call(slot.value(), arity);
+            }
+            compile_variable(slot.value());
+            return {};
+        }
 
         return Report{
             ReportKind::Error,
@@ -124,6 +317,10 @@ auto Compiler::compile_expr() -> std::optional<Report> {
         return compile_binary(maybe_opcode.value());
     }
 
+    if (token.kind == TokenKind::Question) {
+        return compile_conditional();
+    }
+
     return Report{
         .kind = ReportKind::Error,
         .message = concat("Expected expression, found <", token.name(), ">"),
@@ -131,67 +328,192 @@ auto Compiler::compile_expr() -> std::optional<Report> {
     };
 }
 
+void Compiler::emit(OpCode opcode) {
+    m_opcodes.push_back(opcode);
+    m_emitted += 1;
+}
+
 void Compiler::compile_literal(Number value) {
-    m_opcodes.push_back(OpCode::Load);
+    emit(OpCode::Load);
     m_literals.push_back(value);
 }
 
+void Compiler::compile_variable(uint32_t slot) {
+    emit(OpCode::Variable);
+    m_operands.push_back(slot);
+}
+
+void Compiler::compile_argument(uint32_t index) {
+    emit(OpCode::LoadArg);
+    m_operands.push_back(index);
+}
+
+auto Compiler::compile_call(uint32_t slot, uint32_t arity)
+    -> std::optional<Report> {
+    for (uint32_t i = 0; i < arity; i += 1) {
+        if (const std::optional<Report> report = compile_expr()) {
+            return report;
+        }
+    }
+    emit(OpCode::Call);
+    m_operands.push_back(slot);
+    return {};
+}
+
 auto Compiler::compile_unary(OpCode opcode) -> std::optional<Report> {
-    m_opcodes.push_back(opcode);
-    return compile_expr();
+    if (const std::optional<Report> report = compile_expr()) {
+        return report;
+    }
+    emit(opcode);
+    return {};
 }
 
 auto Compiler::compile_binary(OpCode opcode) -> std::optional<Report> {
-    m_opcodes.push_back(opcode);
     if (const std::optional<Report> report_lhs = compile_expr()) {
         return report_lhs;
     }
-    if (const std::optional<Report> report_lhs = compile_expr()) {
-        return report_lhs;
+    if (const std::optional<Report> report_rhs = compile_expr()) {
+        return report_rhs;
     }
+    emit(opcode);
     return {};
 }
 
-/**
- * @brief Creates a new span that points to the index after the last character
- *        of the last token.
- * @param tokens The tokens to analyze.
- * @return Span of the end of input token.
- */
-static auto end_of_input_span(std::span<const Token> tokens) -> Span {
-    // Index of last character of last token
-    size_t last_index = 0;
-    if (!tokens.empty()) {
-        Span last_span = tokens.back().span;
-        last_index = last_span.start + last_span.length;
+auto Compiler::compile_jump(OpCode opcode) -> PendingJump {
+    emit(opcode);
+    const size_t operand = m_operands.size();
+    m_operands.resize(operand + JUMP_OPERANDS);
+    return PendingJump{
+        .operand = operand,
+        .opcodes = m_opcodes.size(),
+        .literals = m_literals.size(),
+        .operands = m_operands.size(),
+    };
+}
+
+void Compiler::patch_jump(const PendingJump& jump) {
+    m_operands[jump.operand] =
+        static_cast<uint32_t>(m_opcodes.size() - jump.opcodes);
+    m_operands[jump.operand + 1] =
+        static_cast<uint32_t>(m_literals.size() - jump.literals);
+    m_operands[jump.operand + 2] =
+        static_cast<uint32_t>(m_operands.size() - jump.operands);
+}
+
+auto Compiler::compile_conditional() -> std::optional<Report> {
+    if (const std::optional<Report> report = compile_expr()) {
+        return report;
     }
-    return Span(last_index, 0);
+    const PendingJump to_else = compile_jump(OpCode::JumpIfZero);
+
+    if (const std::optional<Report> report = compile_expr()) {
+        return report;
+    }
+    const PendingJump to_end = compile_jump(OpCode::Jump);
+    patch_jump(to_else);
+
+    if (const std::optional<Report> report = compile_expr()) {
+        return report;
+    }
+    patch_jump(to_end);
+    return {};
 }
 
-Compiler::TokenStream::TokenStream(std::span<const Token> tokens)
-    : m_end_of_input(Token(TokenKind::EndOfInput, end_of_input_span(tokens))),
-      m_tokens(tokens) {}
+auto Compiler::compile_reduction(OpCode opcode) -> std::optional<Report> {
+    const Token index = m_tokens.next();
+    if (const auto maybe_report = validate_name(index, m_source)) {
+        return maybe_report;
+    }
 
-auto Compiler::TokenStream::next() -> const Token& {
-    if (m_tokens.empty()) {
-        // last token is always the end of file token (see constructor)
-        return m_end_of_input;
+    for (size_t i = 0; i < 2; i += 1) {
+        if (const std::optional<Report> report = compile_expr()) {
+            return report;
+        }
     }
 
-    const Token& token = *m_tokens.begin();
-    m_tokens = m_tokens.subspan(1);
+    // The body is compiled on its own, with only the index being added to
+    // the names it may refer to
+    std::vector<OpCode> opcodes = std::exchange(m_opcodes, {});
+    std::vector<Number> literals = std::exchange(m_literals, {});
+    std::vector<uint32_t> operands = std::exchange(m_operands, {});
+    std::vector<Chunk> reductions = std::exchange(m_reductions, {});
+    m_indices.push_back(index.source(m_source));
+
+    const std::optional<Report> report = compile_expr();
+    Chunk body = take_chunk();
+
+    m_indices.pop_back();
+    m_opcodes = std::move(opcodes);
+    m_literals = std::move(literals);
+    m_operands = std::move(operands);
+    m_reductions = std::move(reductions);
+    if (report) {
+        return report;
+    }
+
+    emit(opcode);
+    m_operands.push_back(static_cast<uint32_t>(m_reductions.size()));
+    m_reductions.push_back(std::move(body));
+    return {};
+}
+
+Compiler::TokenStream::TokenStream(const TokenBuffer& tokens)
+    : m_tokens(BufferPosition{.tokens = &tokens}) {}
+
+Compiler::TokenStream::TokenStream(TokenCursor tokens) : m_tokens(tokens) {}
+
+auto Compiler::TokenStream::pop() -> std::optional<Token> {
+    if (m_peeked) {
+        return std::exchange(m_peeked, {});
+    }
+
+    if (auto* position = std::get_if<BufferPosition>(&m_tokens)) {
+        if (position->index == position->tokens->size()) {
+            return {};
+        }
+        const Token token = (*position->tokens)[position->index];
+        position->index += 1;
+        m_popped += 1;
+        return token;
+    }
+    std::optional<Token> token = std::get<TokenCursor>(m_tokens).next();
+    m_popped += token ? 1 : 0;
     return token;
 }
 
+auto Compiler::TokenStream::next() -> Token {
+    const std::optional<Token> token = pop();
+    if (!token) {
+        // end of input points to the index after the last token
+        return Token(TokenKind::EndOfInput, Span(m_end, 0));
+    }
+
+    m_end = token->span.start + token->span.length;
+    return token.value();
+}
+
+auto Compiler::TokenStream::peek() -> Token {
+    if (!m_peeked) {
+        m_peeked = pop();
+    }
+    if (!m_peeked) {
+        return Token(TokenKind::EndOfInput, Span(m_end, 0));
+    }
+    return m_peeked.value();
+}
+
 auto Compiler::TokenStream::expect(TokenKind expected_kind)
     -> std::optional<Report> {
-    const Token& token = next();
+    const Token token = next();
     if (token.kind == expected_kind) {
         return {};
     }
     return Report{
         .kind = ReportKind::Error,
-        .message = concat("Excpected <EndOfInput> found <", token.name(), ">"),
+        .message = concat(
+            "Excpected <", token_kind_to_string(expected_kind), "> found <",
+            token.name(), ">"
+        ),
         .spans = {token.span}
     };
 }
@@ -1,11 +1,45 @@
 #pragma once
 
 #include <expected>
-#include <span>
+#include <variant>
 
+#include "budget.hpp"
+#include "builtins.hpp"
 #include "chunk.hpp"
+#include "environment.hpp"
 #include "tokenize.hpp"
 
+/**
+ * @brief Parse a number from the substring that `span` points to.
+ *
+ * Generates a `Report` referencing the `span` if parsing fails.
+ *
+ * @param span Describes the substring of `source` to parse.
+ * @param source String used to generate `span`.
+ * @return Either a `Number` or a `Report`.
+ */
+auto parse_number(Span span, std::string_view source)
+    -> std::expected<Number, Report>;
+
+/**
+ * @brief The corresponding binary operation for tokens that describe one.
+ * @param kind The `TokenKind` to analyze.
+ * @return The corresponding opcode or nothing.
+ */
+auto token_kind_to_binary_op(TokenKind kind) -> std::optional<OpCode>;
+
+/**
+ * @brief A compiled line of input, either an expression or a definition.
+ */
+struct Statement {
+    /// Name of the defined variable or function, nothing for expressions
+    std::optional<Span> definition;
+    /// Names of the parameters of defined functions
+    std::vector<Span> parameters;
+    /// The expression (value of the variable or body of the function)
+    Chunk chunk;
+};
+
 /**
  * @brief Transforms tokens into a `Chunk`.
  */
@@ -15,35 +49,141 @@ struct Compiler {
      *
      * Only expression of this form are valid:
      * ```
-     * expr ::= constant | number | unary | binary
+     * expr ::= constant | number | variable | unary | binary | call | reduction
+     *        | conditional
      * binary ::= binary_op expr expr
-     * binary_op ::= "+" | "-" | "*" | "/"
+     * binary_op ::= "+" | "-" | "*" | "/" | "<" | "<=" | ">" | ">=" | "=="
+     *             | "!=" | "pow" | "min" | "max" | "hypot" | "atan2"
      * unary ::= unary_op expr
-     * unary_op ::= "c" | "cos" | "s" | "sin"
+     * unary_op ::= "c" | "cos" | "s" | "sin" | "tan" | "exp" | "log" | "ln"
+     *            | "sqrt" | "abs" | "atan"
      * number ::= digit (digit | "_")* ("." (digit | "_")*)?
      * constant ::= "π" | "pi"
+     * identifier ::= letter (letter | digit)*
+     * variable ::= identifier
+     * call ::= identifier expr*
+     * reduction ::= reduction_op index expr expr expr
+     * reduction_op ::= "sum" | "prod"
+     * index ::= identifier
+     * conditional ::= "?" expr expr expr
      * ```
      *
-     * @param tokens Enforcing move here to avoid accidental copying.
+     * A `letter` is any character but whitespace, punctuation and digits.
+     * Builtin constants and functions are listed in `BUILTINS`. Variables
+     * and functions have to be defined in `environment`, calls take exactly
+     * as many arguments as the function has parameters.
+     *
+     * Reductions like `sum i 1 10 * i i` add up (or multiply) the last
+     * expression for every integer step of `i` from the first bound up to
+     * the second one. The index may only be used in that last expression,
+     * which is compiled into a separate chunk in `Chunk::reductions`.
+     *
+     * Comparisons result in 1 if they hold and 0 otherwise. Conditionals like
+     * `? < x 0 0 x` evaluate the second expression if the first one is not 0
+     * (NaN included) and the third one otherwise. The other one is skipped
+     * with `OpCode::JumpIfZero` and `OpCode::Jump`, so it costs nothing.
+     *
+     * Opcodes are emitted in post-order (operands before their operator),
+     * so the last operand ends up on top of the stack.
+     *
+     * Compilation stops with a report as soon as the source exceeds a limit
+     * of `budget` or the evaluation has to stop (@see `begin_evaluation`).
+     *
+     * @param tokens All tokens of `source`.
+     * @param source Input used to generate the tokens.
+     * @param environment Variables that may be referenced.
+     * @param budget Limits of the source.
+     * @return Compiled chunk or an error.
+     */
+    static auto compile(
+        const TokenBuffer& tokens, std::string_view source,
+        const Environment& environment = {}, const Budget& budget = {}
+    ) -> std::expected<Chunk, Report>;
+
+    /**
+     * @brief Validate and transform tokens into a compiled chunk, pulling
+     *        them from `tokens` one at a time.
+     *
+     * Tokens are never materialized, so memory usage only depends on the
+     * nesting depth of the expression and the size of the resulting `Chunk`.
+     * Invalid tokens are reported like any other unexpected token.
+     *
+     * @see `Compiler::compile` on what valid expressions are
+     * @param tokens Cursor over the tokens of `source`.
      * @param source Input used to generate the tokens.
+     * @param environment Variables that may be referenced.
+     * @param budget Limits of the source.
      * @return Compiled chunk or an error.
      */
-    static auto compile(std::span<const Token> tokens, std::string_view source)
-        -> std::expected<Chunk, Report>;
+    static auto compile(
+        TokenCursor tokens, std::string_view source,
+        const Environment& environment = {}, const Budget& budget = {}
+    ) -> std::expected<Chunk, Report>;
+
+    /**
+     * @brief Validate and transform tokens into a compiled statement.
+     *
+     * Statements are either expressions or variable definitions:
+     * ```
+     * statement ::= definition | expr
+     * definition ::= "let" identifier parameter* "=" expr
+     * parameter ::= identifier
+     * ```
+     *
+     * Definitions with parameters define functions, their parameters may be
+     * used like variables inside of the body, which ends with `OpCode::Ret`.
+     *
+     * The defined variable is not added to `environment`, the expression may
+     * only refer to it, if it has already been defined before.
+     *
+     * @see `Compiler::compile` on what valid expressions are
+     * @param tokens All tokens of `source`.
+     * @param source Input used to generate the tokens.
+     * @param environment Variables that may be referenced.
+     * @param budget Limits of the source.
+     * @return Compiled statement or an error.
+     */
+    static auto compile_statement(
+        const TokenBuffer& tokens, std::string_view source,
+        const Environment& environment, const Budget& budget = {}
+    ) -> std::expected<Statement, Report>;
+
+    /**
+     * @brief Validate and transform tokens into a compiled statement, pulling
+     *        them from `tokens` one at a time.
+     * @see `Compiler::compile_statement`
+     * @param tokens Cursor over the tokens of `source`.
+     * @param source Input used to generate the tokens.
+     * @param environment Variables that may be referenced.
+     * @param budget Limits of the source.
+     * @return Compiled statement or an error.
+     */
+    static auto compile_statement(
+        TokenCursor tokens, std::string_view source,
+        const Environment& environment, const Budget& budget = {}
+    ) -> std::expected<Statement, Report>;
 
    private:
     /**
-     * @brief Iterator over `Token`s. Does not implement the iterator
-     *        specification, as it is simply not needed.
+     * @brief Iterator over `Token`s, either from an already tokenized
+     *        `TokenBuffer` or lazily from a `TokenCursor`. Does not implement
+     *        the iterator specification, as it is simply not needed.
      */
     struct TokenStream {
-        TokenStream(std::span<const Token> tokens);
+        TokenStream(const TokenBuffer& tokens);
+        TokenStream(TokenCursor tokens);
 
         /**
          * @brief Pops the next token off of the stream.
          * @return The token that was removed from the front of the stream.
          */
-        auto next() -> const Token&;
+        auto next() -> Token;
+
+        /**
+         * @brief The next token of the stream, without popping it.
+         * @return The token that `next` is going to return.
+         */
+        auto peek() -> Token;
 
         /**
          * @brief Pops the next token from the stream and generates a report
@@ -53,12 +193,56 @@ struct Compiler {
          */
         auto expect(TokenKind expected_kind) -> std::optional<Report>;
 
+        /**
+         * @brief Amount of tokens that have been popped (or peeked) so far.
+         */
+        auto popped() const -> size_t { return m_popped; }
+
        private:
-        const Token m_end_of_input;
-        std::span<const Token> m_tokens;
+        /**
+         * @brief Pops the next token from the underlying tokens.
+         * @return The token or nothing if the end of input was reached.
+         */
+        auto pop() -> std::optional<Token>;
+
+        /**
+         * @brief Position within a `TokenBuffer`.
+         */
+        struct BufferPosition {
+            const TokenBuffer* tokens;
+            size_t index = 0;
+        };
+
+        std::variant<BufferPosition, TokenCursor> m_tokens;
+        /// Token that has been peeked but not popped yet
+        std::optional<Token> m_peeked;
+        /// Index after the last character of the last popped token
+        size_t m_end = 0;
+        size_t m_popped = 0;
     };
 
-    Compiler(std::span<const Token> tokens, std::string_view source);
+    Compiler(
+        TokenStream tokens, std::string_view source,
+        const Environment& environment, const Budget& budget
+    );
+
+    /**
+     * @brief Moves all compiled code into a `Chunk`.
+     * @return The chunk, in the order it is executed.
+     */
+    auto take_chunk() -> Chunk;
+
+    /**
+     * @brief Compiles the whole `TokenStream` into a single `Chunk`.
+     * @return Compiled chunk or an error.
+     */
+    auto compile_chunk() -> std::expected<Chunk, Report>;
+
+    /**
+     * @brief Compiles the whole `TokenStream` into a single `Statement`.
+     * @return Compiled statement or an error.
+     */
+    auto compile_statement() -> std::expected<Statement, Report>;
 
     /**
      * @brief Parses an expression from the internal `TokenStream` and generates
@@ -68,12 +252,53 @@ struct Compiler {
      */
     auto compile_expr() -> std::optional<Report>;
 
+    /**
+     * @brief Compiles the rest of the expression that starts with `token`.
+     * @see `Compiler::compile_expr`
+     * @param token First token of the expression, already popped.
+     * @return A `Report` explaining where and why compilation failed.
+     */
+    auto compile_expr_from(const Token& token) -> std::optional<Report>;
+
+    /**
+     * @brief Checks every limit of the budget, except for the depth.
+     * @param token The next token, where the report points to.
+     * @return A `Report` if a limit was exceeded or the evaluation stopped.
+     */
+    auto check_budget(const Token& token) const -> std::optional<Report>;
+
+    /**
+     * @brief Push an opcode, counting it for the budget.
+     * @param opcode The opcode.
+     */
+    void emit(OpCode opcode);
+
     /**
      * @brief Push literal value to literals and the `OpCode` for loading it.
      * @param value The literal.
      */
     void compile_literal(Number value);
 
+    /**
+     * @brief Push the `OpCode` for loading a variable and its slot.
+     * @param slot Slot of the variable in the `Environment`.
+     */
+    void compile_variable(uint32_t slot);
+
+    /**
+     * @brief Push the `OpCode` for loading a function argument and its index.
+     * @param index Index of the parameter.
+     */
+    void compile_argument(uint32_t index);
+
+    /**
+     * @brief Compiles the arguments of a function call (after the name).
+     * @param slot Slot of the function in the `Environment`.
+     * @param arity Amount of arguments to compile.
+     * @return A `Report` explaining where and why compilation failed.
+     */
+    auto compile_call(uint32_t slot, uint32_t arity) -> std::optional<Report>;
+
     /**
      * @brief Compiles the rest of a unary expression (after the operator).
      * @param opcode
@@ -88,8 +313,63 @@ struct Compiler {
      */
     auto compile_binary(OpCode opcode) -> std::optional<Report>;
 
+    /**
+     * @brief A jump whose target has not been compiled yet.
+     */
+    struct PendingJump {
+        /// Index of its first operand
+        size_t operand;
+        /// Sizes of the code right after it
+        size_t opcodes;
+        size_t literals;
+        size_t operands;
+    };
+
+    /**
+     * @brief Push a jump, whose operands are filled in by `patch_jump`.
+     * @param opcode `OpCode::Jump` or `OpCode::JumpIfZero`.
+     * @return The jump, to be patched once its target is known.
+     */
+    auto compile_jump(OpCode opcode) -> PendingJump;
+
+    /**
+     * @brief Makes a jump skip all code that was compiled after it.
+     * @param jump The jump returned by `compile_jump`.
+     */
+    void patch_jump(const PendingJump& jump);
+
+    /**
+     * @brief Compiles the rest of a conditional (after the `?`).
+     *
+     * The condition is followed by a `JumpIfZero` to the else branch,
+     * the then branch ends with a `Jump` over the else branch.
+     *
+     * @return A `Report` explaining where and why compilation failed.
+     */
+    auto compile_conditional() -> std::optional<Report>;
+
+    /**
+     * @brief Compiles the rest of a reduction (after the operator).
+     * @param opcode `OpCode::Sum` or `OpCode::Prod`
+     * @return A `Report` explaining where and why compilation failed.
+     */
+    auto compile_reduction(OpCode opcode) -> std::optional<Report>;
+
     const std::string_view m_source;
+    const Environment& m_environment;
+    const Budget& m_budget;
+    /// Expressions that the current one is nested in
+    size_t m_depth = 0;
+    /// Opcodes emitted into all chunks, including the bodies of reductions
+    size_t m_emitted = 0;
+    /// Names of the parameters, if a function body is being compiled
+    std::vector<std::string_view> m_parameters = {};
+    /// Names of the indices of all reductions around the current expression,
+    /// outermost first
+    std::vector<std::string_view> m_indices = {};
     TokenStream m_tokens;
     std::vector<OpCode> m_opcodes = {};
     std::vector<Number> m_literals = {};
+    std::vector<uint32_t> m_operands = {};
+    std::vector<Chunk> m_reductions = {};
 };
@@ -0,0 +1,349 @@
+#include "compile_parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include "pool.hpp"
+
+/**
+ * @brief How a single token is compiled.
+ */
+struct FlatToken {
+    OpCode opcode;
+    uint32_t arity;
+    /// Slot of variables and functions
+    uint32_t slot = 0;
+    /// Value of literals
+    Number value = 0;
+};
+
+/**
+ * @brief Compiles a token on its own, like `Compiler::compile_expr_from`
+ *        without any parameters or indices.
+ * @return How the token is compiled or nothing if it is invalid or has to be
+ *         compiled recursively.
+ */
+static auto flatten_token(
+    const Token& token, std::string_view source, const Environment& environment
+) -> std::optional<FlatToken> {
+    if (token.kind == TokenKind::Number) {
+        const auto number = parse_number(token.span, source);
+        if (!number.has_value()) {
+            return {};
+        }
+        return FlatToken{
+            .opcode = OpCode::Load, .arity = 0, .value = number.value()
+        };
+    }
+    if (const auto opcode = token_kind_to_binary_op(token.kind)) {
+        return FlatToken{.opcode = opcode.value(), .arity = 2};
+    }
+    if (token.kind != TokenKind::Identifier) {
+        return {};
+    }
+
+    const std::string_view ident = token.source(source);
+    if (const auto builtin = find_builtin(ident)) {
+        if (builtin->opcode == OpCode::Load) {
+            return FlatToken{
+                .opcode = OpCode::Load, .arity = 0, .value = builtin->value
+            };
+        }
+        // Reductions also take an index and a body
+        if (builtin->opcode == OpCode::Sum || builtin->opcode == OpCode::Prod) {
+            return {};
+        }
+        return FlatToken{.opcode = builtin->opcode, .arity = builtin->arity};
+    }
+    if (const auto slot = environment.find(ident)) {
+        const uint32_t arity = environment.arity(slot.value());
+        return FlatToken{
+            .opcode = arity > 0 ? OpCode::Call : OpCode::Variable,
+            .arity = arity,
+            .slot = slot.value(),
+        };
+    }
+    return {};
+}
+
+/**
+ * @brief State of a block of tokens, shared between the passes.
+ */
+struct Block {
+    /// Tokens of the block, the block owns the levels and ends after each of
+    /// them, so positions in (begin, end]
+    size_t begin;
+    size_t end;
+    /// Whether every token could be compiled and the levels are valid
+    bool valid = true;
+    /// Sum of `arity - 1` of all tokens
+    int64_t change = 0;
+    /// Level at `begin`
+    uint32_t level = 0;
+    /// Lowest level of the positions of the block
+    uint32_t min_level = 0;
+    /// Position where the level first drops to `level - 1 - i`, for each i
+    std::vector<uint32_t> lows;
+    /// Tokens whose expression ends after the block
+    std::vector<uint32_t> open;
+    std::vector<Number> literals;
+    size_t literal_start = 0;
+    bool has_operands = false;
+    /// Expressions that ended at positions in [begin, end), then the
+    /// amount of them before `begin`
+    uint32_t ended = 0;
+    /// Operands of the opcodes at indices in [begin, end), then the
+    /// amount of them before `begin`
+    size_t operands = 0;
+};
+
+/**
+ * @brief Compiles the expression without recursion, @see `compile_parallel`.
+ * @return The chunk or nothing if the expression has to be compiled by
+ *         `Compiler::compile`.
+ */
+static auto compile_flat(
+    const TokenBuffer& tokens, std::string_view source,
+    const Environment& environment, ThreadPool& pool, const Budget& budget,
+    size_t grain
+) -> std::optional<Chunk> {
+    const size_t size = tokens.size();
+    // A few blocks per thread, so that threads that finish early can steal
+    const size_t block_count = std::clamp(
+        size / std::max(grain, size_t(1)), size_t(1), pool.size() * 4
+    );
+    std::vector<Block> blocks;
+    blocks.reserve(block_count);
+    for (size_t i = 0; i < block_count; i += 1) {
+        blocks.push_back(Block{
+            .begin = size * i / block_count,
+            .end = size * (i + 1) / block_count,
+        });
+    }
+    auto all_valid = [&]() {
+        return !evaluation_stopped() &&
+               std::ranges::all_of(blocks, &Block::valid);
+    };
+
+    // Opcodes of the tokens, levels relative to the start of each block and
+    // slots of variables and functions
+    std::vector<OpCode> token_opcodes(size);
+    std::vector<uint32_t> levels(size + 1);
+    std::vector<uint32_t> slots(size);
+    pool.for_each(0, blocks.size(), [&](size_t b) {
+        Block& block = blocks[b];
+        for (size_t i = block.begin; i < block.end; i += 1) {
+            const auto token = flatten_token(tokens[i], source, environment);
+            // Calls with more arguments than tokens are left can not be
+            // valid, which also keeps every level below 2 * size
+            if (!token || token->arity > size - i) {
+                block.valid = false;
+                return;
+            }
+            token_opcodes[i] = token->opcode;
+            slots[i] = token->slot;
+            if (token->opcode == OpCode::Load) {
+                block.literals.push_back(token->value);
+            }
+            block.has_operands |= opcode_operands(token->opcode) > 0;
+            block.change += static_cast<int64_t>(token->arity) - 1;
+            levels[i + 1] = static_cast<uint32_t>(block.change);
+        }
+    });
+    if (!all_valid()) {
+        return {};
+    }
+
+    // Levels at the start of each block, the expression is missing at first
+    int64_t level = 1;
+    size_t literals = 0;
+    bool has_operands = false;
+    for (Block& block : blocks) {
+        // Every token lowers the level by at most 1
+        if (level < 1 || level > static_cast<int64_t>(size - block.begin)) {
+            return {};
+        }
+        block.level = static_cast<uint32_t>(level);
+        block.literal_start = literals;
+        level += block.change;
+        literals += block.literals.size();
+        has_operands |= block.has_operands;
+    }
+    if (level != 0) {
+        return {};
+    }
+
+    // Absolute levels, ends of the expressions that end within the block
+    // (found with a stack of the tokens whose end is still unknown) and the
+    // first position of each lower level
+    levels[0] = 1;
+    std::vector<uint32_t> ends(size);
+    std::vector<uint32_t> ended(size + 1);
+    std::vector<Number> chunk_literals(literals);
+    pool.for_each(0, blocks.size(), [&](size_t b) {
+        Block& block = blocks[b];
+        std::vector<uint32_t>& open = block.open;
+        // The level at the start belongs to the previous block, which might
+        // still be writing it
+        auto level_of = [&](size_t token) {
+            return token == block.begin ? block.level : levels[token];
+        };
+        block.min_level = block.level;
+        for (size_t i = block.begin; i < block.end; i += 1) {
+            open.push_back(static_cast<uint32_t>(i));
+            // Wraps around like the relative level, but the first invalid
+            // level is always below 2 * size and thus detected
+            const uint32_t next = block.level + levels[i + 1];
+            levels[i + 1] = next;
+            if (i + 1 < size ? next < 1 || next > size - i - 1 : next != 0) {
+                block.valid = false;
+                return;
+            }
+            // Levels never drop by more than 1, so the expression of every
+            // token on the stack with a higher level ends here
+            while (!open.empty() && level_of(open.back()) > next) {
+                ends[open.back()] = static_cast<uint32_t>(i + 1);
+                ended[i + 1] += 1;
+                open.pop_back();
+            }
+            if (next < block.min_level) {
+                block.min_level = next;
+                block.lows.push_back(static_cast<uint32_t>(i + 1));
+            }
+        }
+        std::ranges::copy(
+            block.literals,
+            chunk_literals.begin() + static_cast<ptrdiff_t>(block.literal_start)
+        );
+    });
+    if (!all_valid()) {
+        return {};
+    }
+
+    // Expressions that end after their block end in the first later block
+    // that drops below their level. The open tokens are visited from the
+    // highest level to the lowest, so that block only moves forwards.
+    pool.for_each(0, blocks.size(), [&](size_t b) {
+        const std::vector<uint32_t>& open = blocks[b].open;
+        size_t later = b + 1;
+        for (size_t i = open.size(); i > 0; i -= 1) {
+            const uint32_t token = open[i - 1];
+            const uint32_t token_level = levels[token];
+            while (blocks[later].min_level >= token_level) {
+                later += 1;
+            }
+            const Block& block = blocks[later];
+            const uint32_t end = block.lows[block.level - token_level];
+            ends[token] = end;
+            std::atomic_ref<uint32_t>(ended[end]).fetch_add(
+                1, std::memory_order_relaxed
+            );
+        }
+    });
+
+    pool.for_each(0, blocks.size(), [&](size_t b) {
+        Block& block = blocks[b];
+        uint32_t count = 0;
+        for (size_t i = block.begin; i < block.end; i += 1) {
+            count += ended[i];
+        }
+        block.ended = count;
+    });
+    uint32_t ended_before = 0;
+    for (Block& block : blocks) {
+        ended_before += std::exchange(block.ended, ended_before);
+    }
+
+    // Opcodes (and their operands) at their index in post-order
+    std::vector<OpCode> opcodes(size);
+    std::vector<uint32_t> operand_slots(has_operands ? size : 0);
+    pool.for_each(0, blocks.size(), [&](size_t b) {
+        Block& block = blocks[b];
+        uint32_t count = block.ended;
+        for (size_t i = block.begin; i < block.end; i += 1) {
+            count += ended[i];
+            const size_t depth = i - count;
+            if (depth >= budget.max_depth) {
+                block.valid = false;
+                return;
+            }
+            const size_t index = ends[i] - 1 - depth;
+            opcodes[index] = token_opcodes[i];
+            if (has_operands) {
+                operand_slots[index] = slots[i];
+            }
+        }
+    });
+    if (!all_valid()) {
+        return {};
+    }
+
+    std::vector<uint32_t> operands;
+    if (has_operands) {
+        pool.for_each(0, blocks.size(), [&](size_t b) {
+            Block& block = blocks[b];
+            block.operands = static_cast<size_t>(std::count_if(
+                opcodes.begin() + static_cast<ptrdiff_t>(block.begin),
+                opcodes.begin() + static_cast<ptrdiff_t>(block.end),
+                [](OpCode opcode) { return opcode_operands(opcode) > 0; }
+            ));
+        });
+        size_t operands_before = 0;
+        for (Block& block : blocks) {
+            operands_before += std::exchange(block.operands, operands_before);
+        }
+        operands.resize(operands_before);
+        pool.for_each(0, blocks.size(), [&](size_t b) {
+            const Block& block = blocks[b];
+            size_t operand = block.operands;
+            for (size_t i = block.begin; i < block.end; i += 1) {
+                if (opcode_operands(opcodes[i]) > 0) {
+                    operands[operand] = operand_slots[i];
+                    operand += 1;
+                }
+            }
+        });
+    }
+
+    return Chunk(
+        std::move(opcodes), std::move(chunk_literals), std::move(operands)
+    );
+}
+
+auto compile_parallel(
+    const TokenBuffer& tokens, std::string_view source,
+    const Environment& environment, ThreadPool& pool, const Budget& budget,
+    size_t grain
+) -> std::expected<Chunk, Report> {
+    // Limits are checked up front, the recursive compiler finds the token
+    // where they were exceeded. Every token becomes exactly one opcode.
+    const bool within_budget = source.size() <= budget.max_bytes &&
+                               tokens.size() <= budget.max_tokens &&
+                               tokens.size() <= budget.max_opcodes;
+    if (within_budget && tokens.size() >= 2 * grain &&
+        tokens.size() < UINT32_MAX / 2) {
+        if (auto chunk = compile_flat(
+                tokens, source, environment, pool, budget, grain
+            )) {
+            return std::move(chunk.value());
+        }
+    }
+    return Compiler::compile(tokens, source, environment, budget);
+}
+
+auto compile_statement_parallel(
+    const TokenBuffer& tokens, std::string_view source,
+    const Environment& environment, ThreadPool& pool, const Budget& budget
+) -> std::expected<Statement, Report> {
+    if (tokens.size() == 0 ||
+        (tokens.kind(0) == TokenKind::Identifier &&
+         tokens.span(0).source(source) == "let")) {
+        return Compiler::compile_statement(tokens, source, environment, budget);
+    }
+    auto chunk = compile_parallel(tokens, source, environment, pool, budget);
+    if (!chunk.has_value()) {
+        return std::unexpected(std::move(chunk.error()));
+    }
+    return Statement{.chunk = std::move(chunk.value())};
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <expected>
+
+#include "budget.hpp"
+#include "compile.hpp"
+
+class ThreadPool;
+
+/// Expressions with fewer tokens per thread are compiled in fewer blocks (of
+/// at least this many tokens each)
+constexpr size_t PARALLEL_COMPILE_GRAIN = 1 << 16;
+
+/**
+ * @brief Compiles an expression like `Compiler::compile`, but without
+ *        recursion, in blocks of tokens on several threads.
+ *
+ * Every token has a fixed arity (2 for binary operators, the arity of
+ * builtin functions, the amount of parameters for calls and 0 for
+ * operands), so the shape of the expression follows from prefix sums alone:
+ * - The *level* before each token is the amount of expressions that are
+ *   still missing, 1 plus the sum of `arity - 1` of all tokens before it.
+ *   The tokens are a valid expression if the level stays above 0 up to the
+ *   last token and is 0 after it.
+ * - The expression that starts with a token ends right before the next
+ *   position with a lower level.
+ * - The *depth* of a token (the amount of expressions around it) is its
+ *   index minus the amount of expressions that ended up to it.
+ * - Opcodes are emitted in post-order, where the opcode of a token ends up
+ *   at `end - 1 - depth`. Literals keep the order of their tokens.
+ *
+ * Every pass is a loop over one block of tokens, only the totals of the
+ * blocks are combined on a single thread. Lower levels after a block are
+ * found through the positions where each later block first reaches each
+ * level below its start.
+ *
+ * Conditionals, reductions and anything that fails (including every limit
+ * of `budget`) are compiled by `Compiler::compile` instead, so that chunks
+ * and reports are identical.
+ *
+ * @param tokens All tokens of `source`.
+ * @param source Input used to generate the tokens.
+ * @param environment Variables and functions that may be referenced.
+ * @param pool Threads to compile the blocks on.
+ * @param budget Limits of the source.
+ * @param grain Smallest amount of tokens in a block.
+ * @return Compiled chunk or an error.
+ */
+auto compile_parallel(
+    const TokenBuffer& tokens, std::string_view source,
+    const Environment& environment, ThreadPool& pool, const Budget& budget = {},
+    size_t grain = PARALLEL_COMPILE_GRAIN
+) -> std::expected<Chunk, Report>;
+
+/**
+ * @brief Compiles a statement like `Compiler::compile_statement`, with
+ *        expressions compiled by `compile_parallel`.
+ *
+ * Definitions are always compiled by `Compiler::compile_statement`.
+ *
+ * @param tokens All tokens of `source`.
+ * @param source Input used to generate the tokens.
+ * @param environment Variables and functions that may be referenced.
+ * @param pool Threads to compile the blocks on.
+ * @param budget Limits of the source.
+ * @return Compiled statement or an error.
+ */
+auto compile_statement_parallel(
+    const TokenBuffer& tokens, std::string_view source,
+    const Environment& environment, ThreadPool& pool, const Budget& budget = {}
+) -> std::expected<Statement, Report>;
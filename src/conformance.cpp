@@ -0,0 +1,674 @@
+/**
+ * Differential conformance test and benchmark of all ways to evaluate an
+ * expression.
+ *
+ * Generates random valid and invalid expressions, evaluates each of them with
+ * every engine and compares the results bit for bit with the reference engine
+ * (`tokenize`, `Compiler::compile` and `interpret`). Prints the throughput of
+ * each engine as a table and exits with an error on any mismatch.
+ */
+
+#include <bit>
+#include <cmath>
+#include <charconv>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "batch.hpp"
+#include "compile.hpp"
+#include "compile_parallel.hpp"
+#include "fold.hpp"
+#include "format.hpp"
+#include "generate.hpp"
+#include "inliner.hpp"
+#include "interpret.hpp"
+#include "parallel.hpp"
+#include "stream.hpp"
+#include "tokenize.hpp"
+#include "verify.hpp"
+
+/**
+ * @brief Result of evaluating a single expression.
+ */
+struct Outcome {
+    std::optional<Number> value;
+    /// Formatted report if the expression was rejected
+    std::string error;
+};
+
+/**
+ * @brief A generated expression.
+ */
+struct Case {
+    std::string source;
+    /// Whether the expression refers to variables, functions or reductions
+    bool uses_environment;
+};
+
+/**
+ * @brief Evaluates all cases, filling in one outcome per case (or nothing
+ *        for cases it does not support).
+ */
+using Engine = std::function<void(
+    const std::vector<Case>& cases, std::vector<std::optional<Outcome>>& out
+)>;
+
+struct EngineResult {
+    std::string_view name;
+    size_t evaluated = 0;
+    size_t bytes = 0;
+    size_t mismatches = 0;
+    double seconds = 0;
+};
+
+static constexpr std::string_view USAGE =
+    "Usage:\n"
+    "  tiny-calc-conformance [OPTIONS]\n"
+    "\n"
+    "Options:\n"
+    "  -h, --help         Print this help message\n"
+    "  --seed N           Seed of the generated expressions (default 1)\n"
+    "  --cases N          Amount of generated expressions (default 2000)\n"
+    "  --nodes N          Maximum size of an expression (default 2000)\n"
+    "  --threads N        Threads of the parallel engine (default 4)\n";
+
+/// Definitions that the generated expressions may refer to,
+/// `poly` is too big to be inlined
+static constexpr std::string_view DEFINITIONS[] = {
+    "let a = 1.5",
+    "let b = - 0 2.25",
+    "let sq x = * x x",
+    "let avg x y = / + x y 2",
+    "let mix x y z = + * x y s z",
+    "let poly x = + + + + * x 1 * x 2 * x 3 * x 4 + + + * x 5 * x 6 * x 7 8",
+};
+
+/**
+ * @brief Compiles a line like the REPL does, checking for invalid tokens
+ *        first, so that all engines report the same error.
+ */
+static auto reject(std::string_view source, const Report& report)
+    -> Outcome {
+    if (const auto invalid = invalid_tokens_report(source)) {
+        return Outcome{.error = invalid->format(source)};
+    }
+    return Outcome{.error = report.format(source)};
+}
+
+static auto outcome_to_string(const std::optional<Outcome>& outcome)
+    -> std::string {
+    if (!outcome) {
+        return "<skipped>";
+    }
+    if (outcome->value) {
+        char bits[16];
+        const auto [end, error] = std::to_chars(
+            bits, bits + sizeof(bits),
+            std::bit_cast<uint64_t>(outcome->value.value()), 16
+        );
+        return concat(
+            outcome->value.value(), " (0x", std::string_view(bits, end), ")"
+        );
+    }
+    return outcome->error;
+}
+
+/**
+ * @brief Whether an engine agrees with the reference.
+ * @param compare_errors Whether error messages have to be identical.
+ */
+static auto same_outcome(
+    const Outcome& reference, const Outcome& outcome, bool compare_errors
+) -> bool {
+    if (reference.value.has_value() != outcome.value.has_value()) {
+        return false;
+    }
+    if (!reference.value) {
+        return !compare_errors || reference.error == outcome.error;
+    }
+    return std::bit_cast<uint64_t>(reference.value.value()) ==
+           std::bit_cast<uint64_t>(outcome.value.value());
+}
+
+/**
+ * @brief Evaluates all cases that don't use the environment with `stream`.
+ *
+ * `stream` prints 16 significant digits, so its results are compared with the
+ * reference value printed the same way.
+ */
+static void run_stream(
+    const std::vector<Case>& cases, std::vector<std::optional<Outcome>>& out
+) {
+    std::string input;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < cases.size(); i += 1) {
+        // Empty lines produce no output at all
+        if (!cases[i].uses_environment && !cases[i].source.empty()) {
+            input += cases[i].source;
+            input += "\n";
+            indices.push_back(i);
+        }
+    }
+
+    std::istringstream in(input);
+    std::ostringstream output;
+    stream(in, output);
+
+    // Errors span several lines and always end with a note on their position
+    std::istringstream lines(output.str());
+    std::string line;
+    for (size_t index : indices) {
+        if (!std::getline(lines, line)) {
+            break;
+        }
+        Outcome& outcome = out[index].emplace();
+        if (!line.starts_with("Error")) {
+            outcome.value.emplace();
+            std::from_chars(
+                line.data(), line.data() + line.size(), *outcome.value
+            );
+            continue;
+        }
+        outcome.error = line;
+        while (!line.starts_with("Note: At byte") && std::getline(lines, line)) {
+        }
+    }
+}
+
+/**
+ * @brief Amount of mutated chunks that `verify` accepted and rejected, and of
+ *        accepted ones that evaluated differently with and without checks.
+ */
+struct MutationResult {
+    size_t accepted = 0;
+    size_t rejected = 0;
+    size_t mismatches = 0;
+};
+
+/**
+ * @brief Randomly changes one opcode, literal or operand of a chunk, like a
+ *        corrupted chunk loaded from elsewhere would look.
+ */
+static auto mutate(const Chunk& chunk, std::mt19937_64& random) -> Chunk {
+    std::vector<OpCode> opcodes = chunk.opcodes;
+    std::vector<Number> literals = chunk.literals;
+    std::vector<uint32_t> operands = chunk.operands;
+
+    auto index = [&random](size_t size) {
+        return std::uniform_int_distribution<size_t>(0, size - 1)(random);
+    };
+
+    switch (index(6)) {
+        case 0:
+            opcodes.erase(opcodes.begin() + index(opcodes.size()));
+            break;
+        case 1: {
+            const size_t i = index(opcodes.size());
+            opcodes.insert(opcodes.begin() + i, opcodes[i]);
+            break;
+        }
+        case 2:
+            // `OPCODE_COUNT` itself is an unknown opcode
+            opcodes[index(opcodes.size())] =
+                static_cast<OpCode>(index(OPCODE_COUNT + 1));
+            break;
+        case 3:
+            if (literals.empty() || index(2) == 0) {
+                literals.push_back(1);
+            } else {
+                literals.pop_back();
+            }
+            break;
+        case 4:
+            if (!operands.empty()) {
+                operands[index(operands.size())] =
+                    static_cast<uint32_t>(index(8));
+            } else {
+                operands.push_back(0);
+            }
+            break;
+        default:
+            std::swap(
+                opcodes[index(opcodes.size())], opcodes[index(opcodes.size())]
+            );
+            break;
+    }
+    return Chunk(
+        std::move(opcodes), std::move(literals), std::move(operands),
+        std::vector(chunk.reductions)
+    );
+}
+
+/**
+ * @brief Verifies mutations of valid chunks, every accepted one has to give
+ *        the same result with and without runtime checks.
+ */
+static auto verify_mutations(
+    const std::vector<Case>& cases, const Environment& environment,
+    uint64_t seed
+) -> MutationResult {
+    MutationResult result;
+    std::mt19937_64 random(seed);
+
+    for (const Case& test : cases) {
+        const auto chunk =
+            Compiler::compile(TokenCursor(test.source), test.source, environment);
+        if (!chunk || chunk->opcodes.empty()) {
+            continue;
+        }
+
+        Chunk mutated = mutate(*chunk, random);
+        if (verify(mutated, environment)) {
+            result.rejected += 1;
+            continue;
+        }
+        result.accepted += 1;
+
+        const Chunk checked(
+            std::vector(mutated.opcodes), std::vector(mutated.literals),
+            std::vector(mutated.operands), std::vector(mutated.reductions)
+        );
+        const Number lhs = interpret(mutated, environment);
+        const Number rhs = interpret(checked, environment);
+        if (std::bit_cast<uint64_t>(lhs) != std::bit_cast<uint64_t>(rhs)) {
+            result.mismatches += 1;
+        }
+    }
+    return result;
+}
+
+auto main(int argc, char* argv[]) -> int {
+    size_t seed = 1;
+    size_t case_count = 2000;
+    size_t max_nodes = 2000;
+    size_t threads = 4;
+
+    const std::vector<std::string> args(argv, argv + argc);
+    for (size_t i = 1; i < args.size(); i += 1) {
+        std::string_view arg = args[i];
+        size_t* target = nullptr;
+        if (arg == "-h" || arg == "--help") {
+            writeln(std::cout, USAGE);
+            return 0;
+        } else if (arg == "--seed") {
+            target = &seed;
+        } else if (arg == "--cases") {
+            target = &case_count;
+        } else if (arg == "--nodes") {
+            target = &max_nodes;
+        } else if (arg == "--threads") {
+            target = &threads;
+        }
+
+        std::string_view value =
+            i + 1 < args.size() ? std::string_view(args[i + 1]) : "";
+        size_t parsed = 0;
+        const auto [end, error] = std::from_chars(
+            value.data(), value.data() + value.size(), parsed
+        );
+        if (target == nullptr || error != std::errc() ||
+            end != value.data() + value.size()) {
+            writeln(std::cout, "Error: Invalid argument '", arg, "'\n");
+            writeln(std::cout, USAGE);
+            return -1;
+        }
+        *target = parsed;
+        i += 1;
+    }
+
+    std::cout.precision(std::numeric_limits<Number>::digits10 + 1);
+
+    Environment environment;
+    for (std::string_view definition : DEFINITIONS) {
+        auto statement = Compiler::compile_statement(
+            TokenCursor(definition), definition, environment
+        );
+        if (!statement) {
+            panic("Internal Error: Invalid definition '", definition, "'");
+        }
+        const auto arity =
+            static_cast<uint32_t>(statement->parameters.size());
+        const uint32_t slot =
+            environment.define(statement->definition->source(definition), arity);
+        if (verify(statement->chunk, environment, arity)) {
+            panic("Internal Error: Definition '", definition, "' is invalid");
+        }
+        if (arity > 0) {
+            environment.bodies[slot].emplace(statement->chunk);
+        } else {
+            environment.values[slot] = interpret(statement->chunk, environment);
+        }
+    }
+
+    // Half of the expressions only use builtins (and no reductions), so that
+    // engines without variables can evaluate them too
+    Generator generator(seed);
+    const Environment empty;
+    std::vector<Case> cases;
+    for (size_t i = 0; i < case_count; i += 1) {
+        const bool uses_environment = i % 2 == 0;
+        generator.reductions = uses_environment;
+        const Environment& names = uses_environment ? environment : empty;
+        const size_t nodes = 1 + (i * 7919) % max_nodes;
+        cases.push_back(Case{
+            .source = i % 4 == 3 ? generator.invalid_expression(nodes, names)
+                                 : generator.expression(nodes, names),
+            .uses_environment = uses_environment,
+        });
+    }
+
+    ThreadPool pool(threads);
+
+    // Only subtrees (and pieces of sources) of this size become tasks, small
+    // enough to make the generated expressions fork
+    constexpr size_t test_grain = 8;
+
+    const std::vector<std::pair<std::string_view, Engine>> engines = {
+        {"tokenize+compile",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const TokenBuffer tokens = tokenize(source);
+                 const auto chunk =
+                     Compiler::compile(tokens, source, environment);
+                 out[i] = chunk ? Outcome{interpret(*chunk, environment)}
+                                : reject(source, chunk.error());
+             }
+         }},
+        {"tokenize(wide)+compile",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const TokenBuffer tokens(source, true);
+                 const auto chunk =
+                     Compiler::compile(tokens, source, environment);
+                 if (chunk) {
+                     out[i] = Outcome{interpret(*chunk, environment)};
+                     continue;
+                 }
+                 // Searches the buffer, instead of tokenizing again
+                 const auto invalid = invalid_tokens_report(tokens);
+                 const Report& report = invalid ? *invalid : chunk.error();
+                 out[i] = Outcome{.error = report.format(source)};
+             }
+         }},
+        {"tokenize(parallel)+compile",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const TokenBuffer tokens =
+                     tokenize_parallel(source, pool, test_grain);
+                 const auto chunk =
+                     Compiler::compile(tokens, source, environment);
+                 if (chunk) {
+                     out[i] = Outcome{interpret(*chunk, environment)};
+                     continue;
+                 }
+                 const auto invalid = invalid_tokens_report(tokens);
+                 const Report& report = invalid ? *invalid : chunk.error();
+                 out[i] = Outcome{.error = report.format(source)};
+             }
+         }},
+        {"tokenize+compile(parallel)",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const TokenBuffer tokens = tokenize(source);
+                 const auto chunk = compile_parallel(
+                     tokens, source, environment, pool, {}, test_grain
+                 );
+                 out[i] = chunk ? Outcome{interpret(*chunk, environment)}
+                                : reject(source, chunk.error());
+             }
+         }},
+        {"cursor",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const auto chunk = Compiler::compile(
+                     TokenCursor(source), source, environment
+                 );
+                 out[i] = chunk ? Outcome{interpret(*chunk, environment)}
+                                : reject(source, chunk.error());
+             }
+         }},
+        {"cursor+verify",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 auto chunk = Compiler::compile(
+                     TokenCursor(source), source, environment
+                 );
+                 if (!chunk) {
+                     out[i] = reject(source, chunk.error());
+                     continue;
+                 }
+                 if (const auto report = verify(*chunk, environment)) {
+                     out[i] = Outcome{.error = report->format("")};
+                     continue;
+                 }
+                 out[i] = Outcome{interpret(*chunk, environment)};
+             }
+         }},
+        {"cursor+inline+verify",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const auto chunk = Compiler::compile(
+                     TokenCursor(source), source, environment
+                 );
+                 if (!chunk) {
+                     out[i] = reject(source, chunk.error());
+                     continue;
+                 }
+                 Chunk inlined = inline_calls(*chunk, environment);
+                 if (const auto report = verify(inlined, environment)) {
+                     out[i] = Outcome{.error = report->format("")};
+                     continue;
+                 }
+                 out[i] = Outcome{interpret(inlined, environment)};
+             }
+         }},
+        {"cursor+inline+fold",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const auto chunk = Compiler::compile(
+                     TokenCursor(source), source, environment
+                 );
+                 if (!chunk) {
+                     out[i] = reject(source, chunk.error());
+                     continue;
+                 }
+                 Chunk inlined = inline_calls(*chunk, environment);
+                 auto folded = fold_constants(inlined, environment);
+                 Chunk& result = folded ? *folded : inlined;
+                 if (const auto report = verify(result, environment)) {
+                     out[i] = Outcome{.error = report->format("")};
+                     continue;
+                 }
+                 out[i] = Outcome{interpret(result, environment)};
+             }
+         }},
+        {"cursor+inline+parallel",
+         [&](const auto& cases, auto& out) {
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 const auto chunk = Compiler::compile(
+                     TokenCursor(source), source, environment
+                 );
+                 if (!chunk) {
+                     out[i] = reject(source, chunk.error());
+                     continue;
+                 }
+                 Chunk inlined = inline_calls(*chunk, environment);
+                 if (const auto report = verify(inlined, environment)) {
+                     out[i] = Outcome{.error = report->format("")};
+                     continue;
+                 }
+                 const Subtrees subtrees =
+                     analyze_subtrees(inlined, environment);
+                 out[i] = Outcome{interpret_parallel(
+                     inlined, subtrees, environment, pool, test_grain
+                 )};
+             }
+         }},
+        {"cursor+verify+batch",
+         [&](const auto& cases, auto& out) {
+             // Every chunk is evaluated next to a sibling of the same shape
+             // with negated literals, so that conditionals diverge
+             std::vector<Chunk> chunks;
+             std::vector<size_t> case_indices;
+             chunks.reserve(2 * cases.size());
+             for (size_t i = 0; i < cases.size(); i += 1) {
+                 const std::string& source = cases[i].source;
+                 auto chunk = Compiler::compile(
+                     TokenCursor(source), source, environment
+                 );
+                 if (!chunk) {
+                     out[i] = reject(source, chunk.error());
+                     continue;
+                 }
+                 if (const auto report = verify(*chunk, environment)) {
+                     out[i] = Outcome{.error = report->format("")};
+                     continue;
+                 }
+                 std::vector<Number> negated = chunk->literals;
+                 for (Number& literal : negated) {
+                     literal = -literal;
+                 }
+                 Chunk sibling(
+                     std::vector(chunk->opcodes), std::move(negated),
+                     std::vector(chunk->operands)
+                 );
+                 const bool paired = chunk->reductions.empty() &&
+                                     !verify(sibling, environment);
+                 chunks.push_back(std::move(chunk.value()));
+                 case_indices.push_back(i);
+                 if (paired) {
+                     chunks.push_back(std::move(sibling));
+                     case_indices.push_back(SIZE_MAX);
+                 }
+             }
+             std::vector<const Chunk*> pointers;
+             for (const Chunk& chunk : chunks) {
+                 pointers.push_back(&chunk);
+             }
+             const std::vector<Number> values =
+                 interpret_batch(pointers, environment);
+             for (size_t i = 0; i < values.size(); i += 1) {
+                 if (case_indices[i] != SIZE_MAX) {
+                     out[case_indices[i]] = Outcome{values[i]};
+                 }
+             }
+         }},
+        {"stream", run_stream},
+    };
+
+    std::vector<std::vector<std::optional<Outcome>>> outcomes;
+    std::vector<EngineResult> results;
+    for (const auto& [name, engine] : engines) {
+        auto& out = outcomes.emplace_back(cases.size());
+        const auto start = std::chrono::steady_clock::now();
+        engine(cases, out);
+        const auto end = std::chrono::steady_clock::now();
+
+        EngineResult& result = results.emplace_back(EngineResult{
+            .name = name,
+            .seconds = std::chrono::duration<double>(end - start).count(),
+        });
+        for (size_t i = 0; i < cases.size(); i += 1) {
+            if (out[i]) {
+                result.evaluated += 1;
+                result.bytes += cases[i].source.size() + 1;
+            }
+        }
+    }
+
+    // Compare every engine with the reference
+    size_t valid = 0;
+    size_t finite = 0;
+    size_t printed = 0;
+    for (size_t i = 0; i < cases.size(); i += 1) {
+        const Outcome& reference = outcomes[0][i].value();
+        valid += reference.value ? 1 : 0;
+        finite += reference.value && std::isfinite(*reference.value) ? 1 : 0;
+
+        for (size_t engine = 1; engine < engines.size(); engine += 1) {
+            const auto& outcome = outcomes[engine][i];
+            if (!outcome) {
+                continue;
+            }
+
+            const bool is_stream = engines[engine].first == "stream";
+            bool same = false;
+            if (is_stream && reference.value && outcome->value) {
+                same = concat(reference.value.value()) ==
+                       concat(outcome->value.value());
+            } else {
+                // Stream reports errors without the source
+                same = same_outcome(reference, outcome.value(), !is_stream);
+            }
+            if (same) {
+                continue;
+            }
+
+            results[engine].mismatches += 1;
+            if (printed < 10) {
+                printed += 1;
+                writeln(
+                    std::cout, "Mismatch in ", engines[engine].first,
+                    " for: ", cases[i].source.substr(0, 120),
+                    cases[i].source.size() > 120 ? "..." : "",
+                    "\n  expected: ", outcome_to_string(reference),
+                    "\n  found:    ", outcome_to_string(outcome)
+                );
+            }
+        }
+    }
+
+    writeln(
+        std::cout, cases.size(), " expressions (", valid, " valid, ", finite,
+        " with finite results, ", cases.size() - valid, " invalid), seed ",
+        seed, "\n"
+    );
+    const MutationResult mutations =
+        verify_mutations(cases, environment, seed);
+    writeln(
+        std::cout, "Verifier: ", mutations.accepted + mutations.rejected,
+        " mutated chunks, ", mutations.rejected, " rejected, ",
+        mutations.accepted, " accepted, ", mutations.mismatches,
+        " mismatches\n"
+    );
+
+    writeln(
+        std::cout,
+        "Engine                       Cases  Mismatches       MB/s   Expr/s"
+    );
+    size_t mismatches = 0;
+    for (const EngineResult& result : results) {
+        mismatches += result.mismatches;
+        std::ostringstream row;
+        row.setf(std::ios::fixed);
+        row.precision(1);
+        row.width(27);
+        row << std::left << result.name << std::right;
+        row.width(7);
+        row << result.evaluated;
+        row.width(12);
+        row << result.mismatches;
+        row.width(11);
+        row << static_cast<double>(result.bytes) / 1e6 / result.seconds;
+        row.precision(0);
+        row.width(9);
+        row << static_cast<double>(result.evaluated) / result.seconds;
+        writeln(std::cout, row.str());
+    }
+
+    return mismatches == 0 && mutations.mismatches == 0 ? 0 : 1;
+}
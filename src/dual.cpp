@@ -0,0 +1,269 @@
+#include "dual.hpp"
+
+#include <span>
+#include <vector>
+
+#include "budget.hpp"
+#include "reduction.hpp"
+
+/**
+ * @brief Everything a chunk evaluated on dual numbers may refer to, besides
+ *        its own stack.
+ */
+struct DualContext {
+    const Environment& environment;
+    /// Slot of the variable to differentiate by
+    uint32_t slot;
+};
+
+/**
+ * @brief Execution state of a `Chunk`, saved while a function it called runs.
+ */
+struct DualFrame {
+    const Chunk* chunk;
+    size_t opcode_index = 0;
+    size_t literal_index = 0;
+    size_t operand_index = 0;
+    /// Index of the first argument on the stack
+    size_t base = 0;
+    uint32_t arity = 0;
+};
+
+/**
+ * @brief Stack and saved frames of a run, reused by every index of a
+ *        reduction so that only the first one allocates.
+ */
+struct DualMemory {
+    std::vector<Dual> stack;
+    std::vector<DualFrame> frames;
+};
+
+static auto reduce_dual(
+    OpCode opcode, const Chunk& body, Dual lo, Dual hi,
+    std::span<const Dual> arguments, std::span<const Number> indices,
+    const DualContext& context
+) -> Dual;
+
+/**
+ * @brief Executes opcodes on dual numbers until the outermost frame returns
+ *        or runs out of opcodes.
+ * @param memory Stack to execute on, contains the arguments of `frame`.
+ * @param frame Outermost frame to start with.
+ * @param indices Indices of the reductions that enclose the outermost frame.
+ * @param context Variables, functions and the variable to differentiate by.
+ * @return Value on top of the stack.
+ */
+static auto run_dual(
+    DualMemory& memory, DualFrame frame, std::span<const Number> indices,
+    const DualContext& context
+) -> Dual {
+    const Environment& environment = context.environment;
+    std::vector<Dual>& stack = memory.stack;
+    std::vector<DualFrame>& frames = memory.frames;
+    frames.clear();
+
+    auto pop = [&stack]() {
+        const Dual result = stack.back();
+        stack.pop_back();
+        return result;
+    };
+
+    while (!frames.empty() ||
+           frame.opcode_index < frame.chunk->opcodes.size()) {
+        const Chunk& chunk = *frame.chunk;
+        const OpCode opcode = chunk.opcodes.at(frame.opcode_index);
+        frame.opcode_index += 1;
+
+        switch (opcode) {
+            case OpCode::Load:
+                stack.push_back({chunk.literals.at(frame.literal_index), 0});
+                frame.literal_index += 1;
+                break;
+            case OpCode::Variable: {
+                const uint32_t slot = chunk.operands.at(frame.operand_index);
+                frame.operand_index += 1;
+                const Number derivative = slot == context.slot ? 1 : 0;
+                stack.push_back({environment.values.at(slot), derivative});
+                break;
+            }
+            case OpCode::LoadArg: {
+                const uint32_t index = chunk.operands.at(frame.operand_index);
+                frame.operand_index += 1;
+                stack.push_back(stack.at(frame.base + index));
+                break;
+            }
+            case OpCode::Index: {
+                const uint32_t level = chunk.operands.at(frame.operand_index);
+                frame.operand_index += 1;
+                stack.push_back({indices[level], 0});
+                break;
+            }
+            case OpCode::Call: {
+                if (evaluation_stopped()) {
+                    return {NAN, NAN};
+                }
+                const uint32_t slot = chunk.operands.at(frame.operand_index);
+                frame.operand_index += 1;
+                const uint32_t arity = environment.arity(slot);
+
+                frames.push_back(frame);
+                frame = DualFrame{
+                    .chunk = &environment.bodies.at(slot).value(),
+                    .base = stack.size() - arity,
+                    .arity = arity,
+                };
+                break;
+            }
+            case OpCode::Ret: {
+                const Dual result = pop();
+                if (frames.empty()) {
+                    return result;
+                }
+                stack.resize(frame.base);
+                stack.push_back(result);
+                frame = frames.back();
+                frames.pop_back();
+                break;
+            }
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
+            case OpCode::Div:
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Pow:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Hypot:
+            case OpCode::Atan2: {
+                const Dual rhs = pop();
+                const Dual lhs = pop();
+                stack.push_back(apply_binary(opcode, lhs, rhs));
+                break;
+            }
+            case OpCode::Cos:
+            case OpCode::Sin:
+            case OpCode::Tan:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Sqrt:
+            case OpCode::Abs:
+            case OpCode::Atan:
+                stack.push_back(apply_unary(opcode, pop()));
+                break;
+            case OpCode::Sum:
+            case OpCode::Prod: {
+                const Chunk& body =
+                    chunk.reductions.at(chunk.operands.at(frame.operand_index));
+                frame.operand_index += 1;
+                const Dual hi = pop();
+                const Dual lo = pop();
+                // Only the body of a reduction sees the enclosing indices,
+                // not the functions it calls
+                const std::span<const Dual> arguments(
+                    stack.data() + frame.base, frame.arity
+                );
+                const Dual result = reduce_dual(
+                    opcode, body, lo, hi, arguments,
+                    frames.empty() ? indices : std::span<const Number>(),
+                    context
+                );
+                stack.push_back(result);
+                break;
+            }
+            case OpCode::JumpIfZero:
+            case OpCode::Jump: {
+                const size_t operand = frame.operand_index;
+                frame.operand_index += JUMP_OPERANDS;
+                if (opcode == OpCode::JumpIfZero && pop().value != 0) {
+                    break;
+                }
+                frame.opcode_index += chunk.operands.at(operand);
+                frame.literal_index += chunk.operands.at(operand + 1);
+                frame.operand_index += chunk.operands.at(operand + 2);
+                break;
+            }
+            default:
+                panic(
+                    "Internal Error: Unkown OpCode <",
+                    static_cast<uint8_t>(opcode), ">"
+                );
+                break;
+        }
+    }
+
+    return pop();
+}
+
+/**
+ * @brief Evaluates a `Sum` or `Prod` on dual numbers, with the same bounds as
+ *        `interpret_reduction`.
+ *
+ * The derivative of a sum is the sum of the derivatives (both with Kahan
+ * summation), products use the product rule one index at a time.
+ */
+static auto reduce_dual(
+    OpCode opcode, const Chunk& body, Dual lo, Dual hi,
+    std::span<const Dual> arguments, std::span<const Number> indices,
+    const DualContext& context
+) -> Dual {
+    const bool is_sum = opcode == OpCode::Sum;
+    if (!std::isfinite(lo.value) || !std::isfinite(hi.value)) {
+        return {NAN, NAN};
+    }
+    if (hi.value < lo.value) {
+        return {is_sum ? 0.0 : 1.0, 0};
+    }
+    const Number span = std::floor(hi.value - lo.value);
+    if (!(span < MAX_REDUCTION_LENGTH)) {
+        return {NAN, NAN};
+    }
+
+    std::vector<Number> inner(indices.begin(), indices.end());
+    inner.push_back(0);
+    const std::vector<Dual> copied(arguments.begin(), arguments.end());
+    DualMemory memory;
+
+    Dual result{is_sum ? 0.0 : 1.0, 0};
+    // Low order bits lost by the sums of the value and the derivative
+    Dual compensation;
+    const size_t length = static_cast<size_t>(span) + 1;
+    for (size_t i = 0; i < length; i += 1) {
+        if (evaluation_stopped()) {
+            return {NAN, NAN};
+        }
+        inner.back() = lo.value + static_cast<Number>(i);
+        memory.stack.assign(copied.begin(), copied.end());
+        const DualFrame frame{
+            .chunk = &body,
+            .arity = static_cast<uint32_t>(copied.size()),
+        };
+        const Dual term = run_dual(memory, frame, inner, context);
+
+        if (is_sum) {
+            kahan_add(result.value, compensation.value, term.value);
+            kahan_add(
+                result.derivative, compensation.derivative, term.derivative
+            );
+        } else {
+            result = apply_binary(OpCode::Mul, result, term);
+        }
+    }
+    return is_sum ? apply_binary(OpCode::Sub, result, compensation) : result;
+}
+
+auto interpret_dual(
+    const Chunk& chunk, const Environment& environment, uint32_t slot
+) -> Dual {
+    const DualContext context{.environment = environment, .slot = slot};
+    DualMemory memory;
+    if (const auto& limits = chunk.limits) {
+        memory.stack.reserve(limits->max_stack_depth);
+        memory.frames.reserve(limits->max_call_depth);
+    }
+    return run_dual(memory, DualFrame{.chunk = &chunk}, {}, context);
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cmath>
+
+#include "chunk.hpp"
+#include "environment.hpp"
+#include "format.hpp"
+
+/**
+ * @brief A value together with its derivative with respect to one variable.
+ *
+ * Evaluating a chunk on dual numbers (forward mode automatic differentiation)
+ * results in the exact derivative of the expression in the same pass, instead
+ * of approximating it with finite differences.
+ */
+struct Dual {
+    Number value = 0;
+    Number derivative = 0;
+};
+
+/**
+ * @brief Applies a unary operation like `Cos` to a dual number.
+ * @param opcode The operation.
+ * @param operand The operand.
+ * @return Result of the operation and its derivative (chain rule).
+ */
+inline auto apply_unary(OpCode opcode, Dual operand) -> Dual {
+    switch (opcode) {
+        case OpCode::Cos:
+            return {
+                std::cos(operand.value),
+                -std::sin(operand.value) * operand.derivative
+            };
+        case OpCode::Sin:
+            return {
+                std::sin(operand.value),
+                std::cos(operand.value) * operand.derivative
+            };
+        case OpCode::Tan: {
+            const Number cos = std::cos(operand.value);
+            return {
+                std::tan(operand.value), operand.derivative / (cos * cos)
+            };
+        }
+        case OpCode::Exp: {
+            const Number exp = std::exp(operand.value);
+            return {exp, exp * operand.derivative};
+        }
+        case OpCode::Log:
+            return {
+                std::log(operand.value), operand.derivative / operand.value
+            };
+        case OpCode::Sqrt: {
+            const Number sqrt = std::sqrt(operand.value);
+            return {sqrt, operand.derivative / (2 * sqrt)};
+        }
+        case OpCode::Abs:
+            // The derivative at 0 is taken from the right
+            return {
+                std::fabs(operand.value),
+                std::signbit(operand.value) ? -operand.derivative
+                                            : operand.derivative
+            };
+        case OpCode::Atan:
+            return {
+                std::atan(operand.value),
+                operand.derivative / (1 + operand.value * operand.value)
+            };
+        default:
+            panic(
+                "Internal Error: OpCode <", static_cast<uint8_t>(opcode),
+                "> is not unary"
+            );
+    }
+}
+
+/**
+ * @brief Applies a binary operation like `Mul` to dual numbers.
+ *
+ * Comparisons are piecewise constant, so their derivative is 0. `Min` and
+ * `Max` take the derivative of the operand they pick.
+ *
+ * @param opcode The operation.
+ * @param lhs The first operand (left hand side).
+ * @param rhs The second operand (right hand side).
+ * @return Result of the operation and its derivative.
+ */
+inline auto apply_binary(OpCode opcode, Dual lhs, Dual rhs) -> Dual {
+    switch (opcode) {
+        case OpCode::Add:
+            return {lhs.value + rhs.value, lhs.derivative + rhs.derivative};
+        case OpCode::Sub:
+            return {lhs.value - rhs.value, lhs.derivative - rhs.derivative};
+        case OpCode::Mul:
+            return {
+                lhs.value * rhs.value,
+                lhs.derivative * rhs.value + lhs.value * rhs.derivative
+            };
+        case OpCode::Div: {
+            // (a / b)' = (a' - (a / b) * b') / b
+            const Number quotient = lhs.value / rhs.value;
+            return {
+                quotient,
+                (lhs.derivative - quotient * rhs.derivative) / rhs.value
+            };
+        }
+        case OpCode::Less:
+            return {lhs.value < rhs.value ? 1.0 : 0.0, 0};
+        case OpCode::LessEqual:
+            return {lhs.value <= rhs.value ? 1.0 : 0.0, 0};
+        case OpCode::Greater:
+            return {lhs.value > rhs.value ? 1.0 : 0.0, 0};
+        case OpCode::GreaterEqual:
+            return {lhs.value >= rhs.value ? 1.0 : 0.0, 0};
+        case OpCode::Equal:
+            return {lhs.value == rhs.value ? 1.0 : 0.0, 0};
+        case OpCode::NotEqual:
+            return {lhs.value != rhs.value ? 1.0 : 0.0, 0};
+        case OpCode::Pow: {
+            // (a^b)' = b * a^(b - 1) * a' + a^b * ln(a) * b', where the second
+            // term is left out for constant exponents, so that negative bases
+            // don't result in NaN
+            const Number power = std::pow(lhs.value, rhs.value);
+            Number derivative = 0;
+            if (lhs.derivative != 0) {
+                derivative = rhs.value * std::pow(lhs.value, rhs.value - 1) *
+                             lhs.derivative;
+            }
+            if (rhs.derivative != 0) {
+                derivative += power * std::log(lhs.value) * rhs.derivative;
+            }
+            return {power, derivative};
+        }
+        case OpCode::Min:
+        case OpCode::Max: {
+            // The derivative of the operand that was picked
+            const Number value = opcode == OpCode::Min
+                                     ? std::fmin(lhs.value, rhs.value)
+                                     : std::fmax(lhs.value, rhs.value);
+            return {
+                value,
+                value == lhs.value ? lhs.derivative : rhs.derivative
+            };
+        }
+        case OpCode::Hypot: {
+            // (a * a' + b * b') / hypot(a, b)
+            const Number hypot = std::hypot(lhs.value, rhs.value);
+            return {
+                hypot,
+                (lhs.value * lhs.derivative + rhs.value * rhs.derivative) /
+                    hypot
+            };
+        }
+        case OpCode::Atan2: {
+            // (b * a' - a * b') / (a^2 + b^2)
+            const Number squares =
+                lhs.value * lhs.value + rhs.value * rhs.value;
+            return {
+                std::atan2(lhs.value, rhs.value),
+                (rhs.value * lhs.derivative - lhs.value * rhs.derivative) /
+                    squares
+            };
+        }
+        default:
+            panic(
+                "Internal Error: OpCode <", static_cast<uint8_t>(opcode),
+                "> is not binary"
+            );
+    }
+}
+
+/**
+ * @brief Evaluates a Chunk and its derivative with respect to a variable, in
+ *        a single pass over dual numbers.
+ *
+ * Other variables are treated as constants, even if they were defined in
+ * terms of `slot`. Conditionals take the branch of the value, the bounds of
+ * sums and products only select indices, so neither contributes to the
+ * derivative. Reductions are evaluated sequentially on the calling thread.
+ *
+ * @param chunk The Chunk to evaluate.
+ * @param environment Variables that the chunk was compiled with.
+ * @param slot Slot of the variable to differentiate by.
+ * @return Result of the calculation and its derivative.
+ */
+auto interpret_dual(
+    const Chunk& chunk, const Environment& environment, uint32_t slot
+) -> Dual;
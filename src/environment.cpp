@@ -0,0 +1,35 @@
+#include "environment.hpp"
+
+#include <limits>
+
+auto Environment::find(std::string_view name) const
+    -> std::optional<uint32_t> {
+    const auto slot = m_slots.find(name);
+    if (slot == m_slots.end()) {
+        return {};
+    }
+    return slot->second;
+}
+
+auto Environment::define(std::string_view name, uint32_t arity) -> uint32_t {
+    if (const auto slot = find(name)) {
+        m_arities[slot.value()] = arity;
+        return slot.value();
+    }
+
+    const auto slot = static_cast<uint32_t>(m_names.size());
+    m_names.emplace_back(name);
+    m_arities.push_back(arity);
+    m_slots.emplace(name, slot);
+    values.push_back(std::numeric_limits<Number>::quiet_NaN());
+    bodies.emplace_back();
+    return slot;
+}
+
+auto Environment::name(uint32_t slot) const -> std::string_view {
+    return m_names.at(slot);
+}
+
+auto Environment::arity(uint32_t slot) const -> uint32_t {
+    return m_arities.at(slot);
+}
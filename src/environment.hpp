@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunk.hpp"
+
+/**
+ * @brief Named variables and functions, that expressions can refer to.
+ *
+ * Every name is assigned a slot once, which stays the same even if the
+ * variable gets redefined. Compiled chunks refer to variables and functions
+ * by their slot.
+ */
+struct Environment {
+    /**
+     * @brief Looks up the slot of a variable.
+     * @param name Name of the variable.
+     * @return The slot or nothing if no variable is called `name`.
+     */
+    auto find(std::string_view name) const -> std::optional<uint32_t>;
+
+    /**
+     * @brief Creates a new variable or function, unless one with this name
+     *        exists already.
+     *
+     * New variables are initialized to NaN and new functions have no body.
+     *
+     * @param name Name of the variable or function.
+     * @param arity Amount of parameters, zero for variables.
+     * @return Slot of the variable or function.
+     */
+    auto define(std::string_view name, uint32_t arity = 0) -> uint32_t;
+
+    /**
+     * @brief Name of the variable in `slot`.
+     * @param slot Slot of an existing variable.
+     * @return The name.
+     */
+    auto name(uint32_t slot) const -> std::string_view;
+
+    /**
+     * @brief Amount of parameters of the function in `slot`.
+     * @param slot Slot of an existing variable or function.
+     * @return The amount of parameters, zero for variables.
+     */
+    auto arity(uint32_t slot) const -> uint32_t;
+
+    /// Current values of all variables, indexed by slot
+    std::vector<Number> values;
+    /// Compiled bodies of all functions (ending with `Ret`), indexed by slot
+    std::vector<std::optional<Chunk>> bodies;
+
+   private:
+    std::vector<std::string> m_names;
+    std::vector<uint32_t> m_arities;
+    std::map<std::string, uint32_t, std::less<>> m_slots;
+};
@@ -0,0 +1,429 @@
+#include "fold.hpp"
+
+#include <optional>
+#include <vector>
+
+#include "format.hpp"
+#include "interpret.hpp"
+#include "reduction.hpp"
+
+/**
+ * @brief A value on the stack of the folded chunk.
+ */
+struct FoldValue {
+    /// Where its code starts
+    Segment start;
+    /// Whether its code is a single `Load` (of the literal at
+    /// `start.literal_start`)
+    bool constant;
+};
+
+/**
+ * @brief A conditional whose end has not been reached yet.
+ */
+struct FoldConditional {
+    /// Start of the condition
+    Segment start;
+    /// Value of the condition, if it is constant
+    std::optional<Number> condition;
+    /// Index of the first operand of the `JumpIfZero` in the builder
+    size_t jump_if_zero;
+    Segment then_start;
+    /// Only known once the `Jump` before the else branch is reached
+    bool has_else = false;
+    size_t jump = 0;
+    Segment then_end{};
+    bool then_constant = false;
+    Segment else_start{};
+    /// Index of the opcode after the else branch, in the original chunk
+    size_t end = 0;
+};
+
+/**
+ * @brief Whether a reduction body refers to anything but the indices of
+ *        itself and the reductions within it.
+ * @param body Body of the reduction.
+ * @param level Nesting level of its own index.
+ */
+static auto refers_to_bindings(const Chunk& body, uint32_t level) -> bool {
+    size_t operand_index = 0;
+    for (const OpCode opcode : body.opcodes) {
+        switch (opcode) {
+            case OpCode::Variable:
+            case OpCode::LoadArg:
+            case OpCode::Call:
+                return true;
+            case OpCode::Index:
+                if (body.operands[operand_index] < level) return true;
+                break;
+            default:
+                break;
+        }
+        operand_index += opcode_operands(opcode);
+    }
+    for (const Chunk& reduction : body.reductions) {
+        if (refers_to_bindings(reduction, level)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Whether any operation of a chunk (or of its reductions) only has
+ *        literals as operands, which every constant subtree contains.
+ *
+ * Literals at the end of a conditional are mistaken for operands, so this
+ * can only rule out folding.
+ */
+static auto has_constant_operands(const Chunk& chunk) -> bool {
+    auto load = [&chunk](size_t index, size_t back) {
+        return index >= back && chunk.opcodes[index - back] == OpCode::Load;
+    };
+    for (size_t i = 0; i < chunk.opcodes.size(); i += 1) {
+        switch (chunk.opcodes[i]) {
+            case OpCode::Cos:
+            case OpCode::Sin:
+            case OpCode::Tan:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Sqrt:
+            case OpCode::Abs:
+            case OpCode::Atan:
+            case OpCode::JumpIfZero:
+                if (load(i, 1)) return true;
+                break;
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
+            case OpCode::Div:
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Pow:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Hypot:
+            case OpCode::Atan2:
+            case OpCode::Sum:
+            case OpCode::Prod:
+                if (load(i, 1) && load(i, 2)) return true;
+                break;
+            default:
+                break;
+        }
+    }
+    for (const Chunk& reduction : chunk.reductions) {
+        if (has_constant_operands(reduction)) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Moves `segment` to be relative to `origin`.
+ */
+static auto relative(Segment segment, Segment origin) -> Segment {
+    return {
+        segment.opcode_start - origin.opcode_start,
+        segment.literal_start - origin.literal_start,
+        segment.operand_start - origin.operand_start,
+    };
+}
+
+/**
+ * @brief Fills in the three operands of a jump, to skip from `from` to `to`.
+ */
+static void patch_jump(
+    ChunkBuilder& out, size_t operand, Segment from, Segment to
+) {
+    const Segment skip = relative(to, from);
+    out.operands[operand] = static_cast<uint32_t>(skip.opcode_start);
+    out.operands[operand + 1] = static_cast<uint32_t>(skip.literal_start);
+    out.operands[operand + 2] = static_cast<uint32_t>(skip.operand_start);
+}
+
+/**
+ * @brief Drops the bodies of reductions that are no longer referenced (they
+ *        were in a branch that was never taken) and renumbers the others.
+ */
+static auto compact_reductions(
+    ChunkBuilder& out, const std::vector<Chunk>& bodies
+) -> std::vector<Chunk> {
+    std::vector<Chunk> reductions;
+    size_t operand_index = 0;
+    for (const OpCode opcode : out.opcodes) {
+        if (opcode == OpCode::Sum || opcode == OpCode::Prod) {
+            uint32_t& slot = out.operands[operand_index];
+            reductions.push_back(bodies[slot]);
+            slot = static_cast<uint32_t>(reductions.size() - 1);
+        }
+        operand_index += opcode_operands(opcode);
+    }
+    return reductions;
+}
+
+/**
+ * @brief Folds a chunk that is enclosed by `depth` reductions.
+ * @param result Receives the folded chunk, which is constructed in place as
+ *               chunks can only be copied.
+ */
+static void fold(
+    const Chunk& chunk, const Environment& environment, uint32_t depth,
+    std::optional<Chunk>& result
+) {
+    // Folding only ever shrinks the code
+    ChunkBuilder out;
+    out.opcodes.reserve(chunk.opcodes.size());
+    out.literals.reserve(chunk.literals.size());
+    out.operands.reserve(chunk.operands.size());
+    std::vector<FoldValue> stack;
+    stack.reserve(chunk.opcodes.size());
+    std::vector<FoldConditional> conditionals;
+    std::vector<Chunk> reductions;
+    // Reused for every conditional with a constant condition
+    ChunkBuilder removed;
+    size_t literal_index = 0;
+    size_t operand_index = 0;
+
+    auto pop = [&stack]() -> FoldValue {
+        const FoldValue value = stack.back();
+        stack.pop_back();
+        return value;
+    };
+    auto literal = [&out](FoldValue value) -> Number {
+        return out.literals[value.start.literal_start];
+    };
+    // Replaces all code after `start` with a single `Load`
+    auto replace = [&](Segment start, Number value) {
+        out.opcodes.resize(start.opcode_start);
+        out.literals.resize(start.literal_start);
+        out.operands.resize(start.operand_start);
+        out.opcodes.push_back(OpCode::Load);
+        out.literals.push_back(value);
+        stack.push_back({start, true});
+    };
+    // A conditional becomes a single value once both branches were emitted,
+    // or only the branch it takes if its condition is constant
+    auto finish = [&](size_t index) {
+        while (!conditionals.empty() && conditionals.back().has_else &&
+               conditionals.back().end == index) {
+            const FoldConditional conditional = conditionals.back();
+            conditionals.pop_back();
+            const FoldValue otherwise = pop();
+            if (!conditional.condition) {
+                patch_jump(
+                    out, conditional.jump_if_zero, conditional.then_start,
+                    conditional.else_start
+                );
+                patch_jump(
+                    out, conditional.jump, conditional.else_start, out.end()
+                );
+                stack.push_back({conditional.start, false});
+                continue;
+            }
+
+            const bool then = conditional.condition.value() != 0;
+            const Segment start =
+                then ? conditional.then_start : conditional.else_start;
+            const Segment end = then ? conditional.then_end : out.end();
+            out.split_off(conditional.start, removed);
+            // Jumps only skip code within their own branch, so the branch
+            // can be moved as a whole
+            out.append(
+                removed, relative(start, conditional.start),
+                relative(end, conditional.start)
+            );
+            stack.push_back(
+                {conditional.start,
+                 then ? conditional.then_constant : otherwise.constant}
+            );
+        }
+    };
+
+    for (size_t i = 0; i < chunk.opcodes.size(); i += 1) {
+        const OpCode opcode = chunk.opcodes[i];
+        finish(i);
+        const Segment start = out.end();
+
+        switch (opcode) {
+            case OpCode::Load:
+                out.opcodes.push_back(opcode);
+                out.literals.push_back(chunk.literals[literal_index]);
+                literal_index += 1;
+                stack.push_back({start, true});
+                break;
+            case OpCode::Variable:
+            case OpCode::LoadArg:
+            case OpCode::Index:
+                out.opcodes.push_back(opcode);
+                out.operands.push_back(chunk.operands[operand_index]);
+                operand_index += 1;
+                stack.push_back({start, false});
+                break;
+            case OpCode::Ret: {
+                const FoldValue value = pop();
+                out.opcodes.push_back(opcode);
+                stack.push_back({value.start, false});
+                break;
+            }
+            case OpCode::Cos:
+            case OpCode::Sin:
+            case OpCode::Tan:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Sqrt:
+            case OpCode::Abs:
+            case OpCode::Atan: {
+                const FoldValue operand = pop();
+                if (operand.constant) {
+                    replace(
+                        operand.start, apply_unary(opcode, literal(operand))
+                    );
+                    break;
+                }
+                out.opcodes.push_back(opcode);
+                stack.push_back({operand.start, false});
+                break;
+            }
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
+            case OpCode::Div:
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Pow:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Hypot:
+            case OpCode::Atan2: {
+                const FoldValue rhs = pop();
+                const FoldValue lhs = pop();
+                if (lhs.constant && rhs.constant) {
+                    replace(
+                        lhs.start,
+                        apply_binary(opcode, literal(lhs), literal(rhs))
+                    );
+                    break;
+                }
+                out.opcodes.push_back(opcode);
+                stack.push_back({lhs.start, false});
+                break;
+            }
+            case OpCode::JumpIfZero: {
+                const FoldValue condition = pop();
+                out.opcodes.push_back(opcode);
+                const size_t operand = out.operands.size();
+                out.operands.resize(operand + JUMP_OPERANDS);
+                operand_index += JUMP_OPERANDS;
+                conditionals.push_back(FoldConditional{
+                    .start = condition.start,
+                    .condition = condition.constant
+                                     ? std::optional(literal(condition))
+                                     : std::nullopt,
+                    .jump_if_zero = operand,
+                    .then_start = out.end(),
+                });
+                break;
+            }
+            case OpCode::Jump: {
+                const FoldValue then = pop();
+                FoldConditional& conditional = conditionals.back();
+                conditional.then_end = start;
+                conditional.then_constant = then.constant;
+                out.opcodes.push_back(opcode);
+                conditional.jump = out.operands.size();
+                out.operands.resize(conditional.jump + JUMP_OPERANDS);
+                conditional.end = i + 1 + chunk.operands[operand_index];
+                operand_index += JUMP_OPERANDS;
+                conditional.else_start = out.end();
+                conditional.has_else = true;
+                break;
+            }
+            case OpCode::Sum:
+            case OpCode::Prod: {
+                std::optional<Chunk> folded;
+                fold(
+                    chunk.reductions[chunk.operands[operand_index]],
+                    environment, depth + 1, folded
+                );
+                const Chunk& body = *folded;
+                operand_index += 1;
+                const FoldValue hi = pop();
+                const FoldValue lo = pop();
+                if (lo.constant && hi.constant &&
+                    !(literal(hi) - literal(lo) >= MAX_FOLD_REDUCTION_LENGTH) &&
+                    !refers_to_bindings(body, depth)) {
+                    // The indices of enclosing reductions are never read
+                    const std::vector<Number> indices(depth, NAN);
+                    const ReductionContext context{
+                        .environment = environment,
+                        .arguments = {},
+                        .indices = indices,
+                        .pool = nullptr,
+                    };
+                    replace(
+                        lo.start,
+                        interpret_reduction(
+                            opcode, body, literal(lo), literal(hi), context
+                        )
+                    );
+                    break;
+                }
+                out.opcodes.push_back(opcode);
+                out.operands.push_back(
+                    static_cast<uint32_t>(reductions.size())
+                );
+                reductions.push_back(body);
+                stack.push_back({lo.start, false});
+                break;
+            }
+            case OpCode::Call: {
+                const uint32_t slot = chunk.operands[operand_index];
+                operand_index += 1;
+                const uint32_t arity = environment.arity(slot);
+                Segment arguments_start = start;
+                for (uint32_t argument = 0; argument < arity; argument += 1) {
+                    arguments_start = pop().start;
+                }
+                out.opcodes.push_back(opcode);
+                out.operands.push_back(slot);
+                stack.push_back({arguments_start, false});
+                break;
+            }
+            default:
+                panic(
+                    "Internal Error: Unkown OpCode <",
+                    static_cast<uint8_t>(opcode), ">"
+                );
+        }
+    }
+    finish(chunk.opcodes.size());
+
+    std::vector<Chunk> used = compact_reductions(out, reductions);
+    result.emplace(
+        std::move(out.opcodes), std::move(out.literals),
+        std::move(out.operands), std::move(used)
+    );
+}
+
+auto fold_constants(const Chunk& chunk, const Environment& environment)
+    -> std::optional<Chunk> {
+    std::optional<Chunk> result;
+    if (has_constant_operands(chunk)) {
+        fold(chunk, environment, 0, result);
+    }
+    return result;
+}
+
+auto count_opcodes(const Chunk& chunk) -> size_t {
+    size_t count = chunk.opcodes.size();
+    for (const Chunk& reduction : chunk.reductions) {
+        count += count_opcodes(reduction);
+    }
+    return count;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+
+#include "chunk.hpp"
+#include "environment.hpp"
+
+/// Constant reductions with more indices are left to the interpreter, which
+/// can split them over threads, instead of stalling the compiler
+constexpr Number MAX_FOLD_REDUCTION_LENGTH = 1 << 16;
+
+/**
+ * @brief Replaces every subtree that does not depend on a variable, argument
+ *        or index with a single `Load` of its value (partial evaluation).
+ *
+ * Folded values are computed with the same operations as the interpreter, so
+ * results stay bit identical (including NaN, infinities and signed zeros).
+ * Conditionals with a constant condition are replaced by the branch they
+ * take, and the bodies of reductions are folded as well. Calls are never
+ * folded, as the variables that a function refers to can change.
+ *
+ * @param chunk The chunk to transform, may be a function body.
+ * @param environment Functions that the chunk was compiled with.
+ * @return Chunk that only computes what depends on bindings, or nothing if
+ *         no subtree of `chunk` is constant (without allocating).
+ */
+auto fold_constants(const Chunk& chunk, const Environment& environment)
+    -> std::optional<Chunk>;
+
+/**
+ * @brief Amount of opcodes in a chunk and in the bodies of all of its
+ *        reductions, to compare the size of chunks before and after a pass.
+ */
+auto count_opcodes(const Chunk& chunk) -> size_t;
@@ -1,29 +1,93 @@
 /**
  * This project targets g++ version 12, which does not support the `format`
  * header introduced in C++ 20.
- * The functions provided in this header are thin wrappers around formatting
- * with the left-shift operator and streams.
+ * The functions provided in this header format values with `std::to_chars`
+ * into small fixed buffers and append them to caller provided strings or
+ * streams, so that formatting itself never allocates.
  */
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <iostream>
 #include <limits>
 #include <source_location>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
+
+/// Big enough for any integer and floating point numbers with up to
+/// `MAX_FORMAT_PRECISION` significant digits
+using FormatBuffer = std::array<char, 128>;
+
+/// Higher precisions are clamped, as they would not fit into a `FormatBuffer`
+constexpr std::streamsize MAX_FORMAT_PRECISION = 64;
+
+/**
+ * @brief Text of a single message part.
+ *
+ * Floating point numbers are formatted like streams do by default, integers
+ * (including `uint8_t`) in decimal and `bool`s as `1` or `0`.
+ *
+ * @param buffer Numbers and characters are formatted into this buffer.
+ * @param precision Significant digits of floating point numbers.
+ * @param value A string, character, integer or floating point number.
+ * @return The text, which might point into `buffer`.
+ */
+template <typename T>
+inline auto format_value(
+    FormatBuffer& buffer, std::streamsize precision, const T& value
+) -> std::string_view {
+    char* const begin = buffer.data();
+    char* const end = buffer.data() + buffer.size();
+
+    if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        return std::string_view(value);
+    } else if constexpr (std::is_same_v<T, char>) {
+        buffer[0] = value;
+        return std::string_view(begin, 1);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return value ? "1" : "0";
+    } else if constexpr (std::is_floating_point_v<T>) {
+        const auto [ptr, error] = std::to_chars(
+            begin, end, value, std::chars_format::general,
+            static_cast<int>(std::min(precision, MAX_FORMAT_PRECISION))
+        );
+        return std::string_view(begin, ptr);
+    } else {
+        static_assert(std::is_integral_v<T>, "Type can not be formatted");
+        const auto [ptr, error] = std::to_chars(begin, end, value);
+        return std::string_view(begin, ptr);
+    }
+}
+
+/**
+ * @brief Appends all arguments to `out`.
+ *
+ * Only allocates if `out` has to grow, so reusing the same string for many
+ * messages does not allocate at all after the first few.
+ *
+ * @param out The string to append to.
+ * @param ...args The message parts, @see `format_value`.
+ */
+template <typename... Args>
+inline void format_to(std::string& out, const Args&... args) {
+    const std::streamsize precision = std::cout.precision();
+    FormatBuffer buffer;
+    ((out += format_value(buffer, precision, args)), ...);
+}
 
 /**
  * @brief Concatenates all arguments into a new string.
- * @param ...args The arguments concatenated into one string.
- *                Each argumanet has to be convertible to `std::string`.
+ * @param ...args The message parts, @see `format_value`.
  */
 template <typename... Args>
-inline auto concat(Args... args) -> std::string {
-    std::stringstream result;
-    result.precision(std::cout.precision());
-    (result << ... << args);
-    return result.str();
+inline auto concat(const Args&... args) -> std::string {
+    std::string result;
+    format_to(result, args...);
+    return result;
 }
 
 /**
@@ -31,25 +95,31 @@ inline auto concat(Args... args) -> std::string {
  *
  * Does not flush the output stream.
  *
- * @param out Output stream to write into.
- * @param ...args The arguments concatenated into one message.
+ * @param out Output stream to write into, its precision is used for floating
+ *            point numbers.
+ * @param ...args The message parts, @see `format_value`.
  */
 template <typename... Args>
-inline void write(std::ostream& out, Args... args) {
-    (out << ... << args);
+inline void write(std::ostream& out, const Args&... args) {
+    const std::streamsize precision = out.precision();
+    FormatBuffer buffer;
+    auto write_part = [&](std::string_view part) {
+        out.write(part.data(), static_cast<std::streamsize>(part.size()));
+    };
+    (write_part(format_value(buffer, precision, args)), ...);
 }
 
 /**
- * @brief Concatenates and writes the provided message parts and a newline `\\n`
+ * @brief Concatenates and writes the provided message parts and a newline `\n`
  *
  * Does not flush the output stream.
  *
  * @param out Output stream to write into.
- * @param ...args The arguments concatenated into one message.
+ * @param ...args The message parts, @see `format_value`.
  */
 template <typename... Args>
-inline void writeln(std::ostream& out, Args... args) {
-    (out << ... << args) << "\n";
+inline void writeln(std::ostream& out, const Args&... args) {
+    write(out, args..., '\n');
 }
 
 /**
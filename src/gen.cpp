@@ -0,0 +1,231 @@
+/**
+ * Deterministic generator of synthetic workloads.
+ *
+ * Writes seeded random expressions (one per line) to stdout, with a
+ * configurable shape: size, depth, mix of operators, formats of literals and
+ * a rate of lines that are broken on purpose. The same options and seed
+ * always produce the same corpus, so that the throughput of tokenizing,
+ * compiling and interpreting can be compared on controlled inputs.
+ *
+ * Lines do not refer to variables or functions, so that every line can be
+ * evaluated on its own (e.g. with `tiny-calc --stream`).
+ */
+
+#include <charconv>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "format.hpp"
+#include "generate.hpp"
+
+static constexpr std::string_view USAGE =
+    "Usage:\n"
+    "  tiny-calc-gen [OPTIONS] > corpus.txt\n"
+    "\n"
+    "Options:\n"
+    "  -h, --help         Print this help message\n"
+    "  --seed N           Seed of the generated lines (default 1)\n"
+    "  --lines N          Amount of lines (default 1000)\n"
+    "  --bytes N[K|M|G]   Write lines until N bytes are reached, instead\n"
+    "                     of a fixed amount of lines\n"
+    "  --nodes MIN[-MAX]  Operators and operands per line (default 1-64)\n"
+    "  --depth N          Levels of nesting that no line exceeds\n"
+    "  --mix KIND=W,...   Relative weights of the kinds of operators\n"
+    "                     (default unary=1,arithmetic=6,comparison=0.3,\n"
+    "                     conditional=1,reduction=1)\n"
+    "  --pi P             Chance of an operand being pi or π (default 0.1)\n"
+    "  --unicode-pi P     Chance of writing π instead of pi (default 0.5)\n"
+    "  --large P          Chance of a number up to 999 instead of 9\n"
+    "                     (default 0.1)\n"
+    "  --separators P     Chance of a '_' inside of a number (default 0.1)\n"
+    "  --decimals P       Chance of a decimal part (default 0.5)\n"
+    "  --errors P         Chance of a line that is broken on purpose\n"
+    "                     (default 0)\n";
+
+/// Generated lines are written in blocks of this size
+constexpr size_t GEN_WRITE_SIZE = 1 << 20;
+
+/**
+ * @brief Parses a whole string as an unsigned integer.
+ */
+static auto parse_integer(std::string_view source, size_t& value) -> bool {
+    const auto [end, error] =
+        std::from_chars(source.data(), source.data() + source.size(), value);
+    return error == std::errc() && end == source.data() + source.size();
+}
+
+/**
+ * @brief Parses a size in bytes with an optional binary K, M or G suffix.
+ */
+static auto parse_bytes(std::string_view source, size_t& bytes) -> bool {
+    size_t scale = 1;
+    if (source.ends_with('K')) {
+        scale = size_t(1) << 10;
+    } else if (source.ends_with('M')) {
+        scale = size_t(1) << 20;
+    } else if (source.ends_with('G')) {
+        scale = size_t(1) << 30;
+    }
+    if (scale > 1) {
+        source.remove_suffix(1);
+    }
+    if (!parse_integer(source, bytes) || bytes == 0) {
+        return false;
+    }
+    bytes *= scale;
+    return true;
+}
+
+/**
+ * @brief Parses a whole string as a non negative weight.
+ */
+static auto parse_weight(std::string_view source, double& value) -> bool {
+    const auto [end, error] =
+        std::from_chars(source.data(), source.data() + source.size(), value);
+    return error == std::errc() && end == source.data() + source.size() &&
+           value >= 0;
+}
+
+/**
+ * @brief Parses a probability between 0 and 1.
+ */
+static auto parse_chance(std::string_view source, double& value) -> bool {
+    return parse_weight(source, value) && value <= 1;
+}
+
+/**
+ * @brief Parses the node range "MIN-MAX" or a single amount "N".
+ */
+static auto parse_nodes(std::string_view source, size_t& min, size_t& max)
+    -> bool {
+    const size_t dash = source.find('-');
+    if (dash == std::string_view::npos) {
+        return parse_integer(source, min) && min > 0 &&
+               parse_integer(source, max);
+    }
+    return parse_integer(source.substr(0, dash), min) &&
+           parse_integer(source.substr(dash + 1), max) && min > 0 &&
+           min <= max;
+}
+
+/**
+ * @brief Parses weights like "unary=1,reduction=0", kinds that are not
+ *        mentioned keep their weight.
+ */
+static auto parse_mix(std::string_view source, OperatorMix& mix) -> bool {
+    while (!source.empty()) {
+        const size_t comma = source.find(',');
+        const std::string_view part = source.substr(0, comma);
+        source.remove_prefix(
+            comma == std::string_view::npos ? source.size() : comma + 1
+        );
+
+        const size_t equals = part.find('=');
+        if (equals == std::string_view::npos) {
+            return false;
+        }
+        const std::string_view kind = part.substr(0, equals);
+        double* weight = kind == "unary"         ? &mix.unary
+                         : kind == "arithmetic"  ? &mix.arithmetic
+                         : kind == "comparison"  ? &mix.comparison
+                         : kind == "conditional" ? &mix.conditional
+                         : kind == "reduction"   ? &mix.reduction
+                                                 : nullptr;
+        if (weight == nullptr ||
+            !parse_weight(part.substr(equals + 1), *weight)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto main(int argc, char* argv[]) -> int {
+    size_t seed = 1;
+    size_t lines = 1000;
+    size_t bytes = 0;
+    size_t min_nodes = 1;
+    size_t max_nodes = 64;
+    double error_chance = 0;
+    Generator generator(0);
+    generator.reductions = true;
+
+    const std::vector<std::string> args(argv, argv + argc);
+    for (size_t i = 1; i < args.size(); i += 1) {
+        std::string_view arg = args[i];
+        if (arg == "-h" || arg == "--help") {
+            writeln(std::cout, USAGE);
+            return 0;
+        }
+
+        const std::string_view value =
+            i + 1 < args.size() ? std::string_view(args[i + 1]) : "";
+        bool valid = false;
+        if (arg == "--seed") {
+            valid = parse_integer(value, seed);
+        } else if (arg == "--lines") {
+            valid = parse_integer(value, lines);
+        } else if (arg == "--bytes") {
+            valid = parse_bytes(value, bytes);
+        } else if (arg == "--nodes") {
+            valid = parse_nodes(value, min_nodes, max_nodes);
+        } else if (arg == "--depth") {
+            valid = parse_integer(value, generator.max_depth) &&
+                    generator.max_depth > 0;
+        } else if (arg == "--mix") {
+            valid = parse_mix(value, generator.mix);
+        } else if (arg == "--pi") {
+            valid = parse_chance(value, generator.constant_chance);
+        } else if (arg == "--unicode-pi") {
+            valid = parse_chance(value, generator.unicode_pi_chance);
+        } else if (arg == "--large") {
+            valid = parse_chance(value, generator.large_number_chance);
+        } else if (arg == "--separators") {
+            valid = parse_chance(value, generator.separator_chance);
+        } else if (arg == "--decimals") {
+            valid = parse_chance(value, generator.decimal_chance);
+        } else if (arg == "--errors") {
+            valid = parse_chance(value, error_chance);
+        }
+        if (!valid) {
+            writeln(std::cerr, "Error: Invalid argument '", arg, "'\n");
+            writeln(std::cerr, USAGE);
+            return -1;
+        }
+        i += 1;
+    }
+
+    // The generator is seeded after parsing, so that the order of the
+    // options does not matter. Sizes and errors come from their own stream,
+    // so that changing them keeps the shape of the other lines.
+    generator.reseed(seed);
+    std::mt19937_64 random(seed ^ 0x9e3779b97f4a7c15);
+    std::uniform_int_distribution<size_t> nodes(min_nodes, max_nodes);
+    std::bernoulli_distribution broken(error_chance);
+
+    // Shared by all lines, a default argument would be created for each one
+    const Environment environment;
+
+    std::ios::sync_with_stdio(false);
+    std::string buffer;
+    buffer.reserve(GEN_WRITE_SIZE + 4096);
+    size_t written = 0;
+    for (size_t line = 0; bytes > 0 ? written < bytes : line < lines;
+         line += 1) {
+        const size_t size = nodes(random);
+        const size_t start = buffer.size();
+        buffer += broken(random)
+                      ? generator.invalid_expression(size, environment)
+                      : generator.expression(size, environment);
+        buffer += '\n';
+        written += buffer.size() - start;
+        if (buffer.size() >= GEN_WRITE_SIZE) {
+            std::cout.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    std::cout.write(buffer.data(), buffer.size());
+    std::cout.flush();
+    return std::cout ? 0 : -1;
+}
@@ -0,0 +1,328 @@
+#include "generate.hpp"
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+#include "builtins.hpp"
+#include "format.hpp"
+
+/// Upper bound for the amount of operations that all reductions of a single
+/// expression evaluate
+constexpr size_t MAX_REDUCTION_WORK = 20'000;
+
+/// Names of the indices of nested reductions
+constexpr std::array<std::string_view, 4> INDICES = {"i", "j", "k", "n"};
+
+constexpr std::array<std::string_view, 6> COMPARISONS = {
+    "<", "<=", ">", ">=", "==", "!="
+};
+
+/**
+ * @brief Whether a builtin is a function that takes its operands like an
+ *        operator, unlike constants and reductions.
+ */
+static constexpr auto is_function(const Builtin& builtin) -> bool {
+    return builtin.arity > 0 && builtin.opcode != OpCode::Sum &&
+           builtin.opcode != OpCode::Prod;
+}
+
+/**
+ * @brief A name of a builtin function.
+ */
+struct FunctionName {
+    std::string_view name;
+    uint32_t arity = 0;
+};
+
+constexpr size_t FUNCTION_NAME_COUNT = []() {
+    size_t count = 0;
+    for (const BuiltinEntry& entry : BUILTINS) {
+        if (is_function(entry.builtin)) {
+            count += entry.alias.empty() ? 1 : 2;
+        }
+    }
+    return count;
+}();
+
+/// Every name of every builtin function, so functions with an alias are
+/// picked more often
+constexpr auto FUNCTION_NAMES = []() {
+    std::array<FunctionName, FUNCTION_NAME_COUNT> names{};
+    size_t count = 0;
+    for (const BuiltinEntry& entry : BUILTINS) {
+        if (!is_function(entry.builtin)) {
+            continue;
+        }
+        names[count] = {entry.name, entry.builtin.arity};
+        count += 1;
+        if (!entry.alias.empty()) {
+            names[count] = {entry.alias, entry.builtin.arity};
+            count += 1;
+        }
+    }
+    return names;
+}();
+
+/**
+ * @brief Kinds of operators, in the order of the weights of `OperatorMix`.
+ */
+enum class OperatorKind : uint8_t {
+    Unary,
+    Arithmetic,
+    Comparison,
+    Conditional,
+    Call,
+    Reduction,
+};
+
+Generator::Generator(uint64_t seed) : m_random(seed) {}
+
+void Generator::reseed(uint64_t seed) { m_random.seed(seed); }
+
+auto Generator::between(size_t min, size_t max) -> size_t {
+    return std::uniform_int_distribution<size_t>(min, max)(m_random);
+}
+
+auto Generator::chance(double probability) -> bool {
+    return std::bernoulli_distribution(probability)(m_random);
+}
+
+void Generator::number(std::string& out) {
+    // Mostly small numbers, so that results don't all overflow
+    format_to(out, between(0, chance(large_number_chance) ? 999 : 9));
+    if (chance(separator_chance)) {
+        format_to(out, "_", between(0, 9));
+    }
+    if (chance(decimal_chance)) {
+        out += ".";
+        if (chance(0.9)) {
+            format_to(out, between(0, 999));
+        }
+    }
+}
+
+void Generator::operand(std::string& out) {
+    if (chance(constant_chance)) {
+        out += chance(unicode_pi_chance) ? "π" : "pi";
+        return;
+    }
+    const size_t kind = between(0, 8);
+    if (kind <= 1 && !m_variables.empty()) {
+        out += m_environment->name(
+            m_variables[between(0, m_variables.size() - 1)]
+        );
+    } else if (kind <= 4 && !m_indices.empty()) {
+        out += m_indices[between(0, m_indices.size() - 1)];
+    } else {
+        number(out);
+    }
+}
+
+void Generator::expr(std::string& out, size_t nodes) {
+    if (!out.empty()) {
+        out += " ";
+    }
+    if (nodes <= 1 || m_depth + 1 >= max_depth) {
+        operand(out);
+        return;
+    }
+    m_depth += 1;
+    operation(out, nodes);
+    m_depth -= 1;
+}
+
+void Generator::operation(std::string& out, size_t nodes) {
+    const Environment& environment = *m_environment;
+
+    // Functions that fit into the remaining nodes (with one node per argument)
+    size_t functions = 0;
+    while (functions < m_functions.size() &&
+           environment.arity(m_functions[functions]) < nodes) {
+        functions += 1;
+    }
+
+    const auto kind = static_cast<OperatorKind>(m_kinds(m_random));
+    if (kind == OperatorKind::Unary || nodes == 2) {
+        // Functions of two operands need at least three nodes
+        FunctionName function;
+        do {
+            function = FUNCTION_NAMES[between(0, FUNCTION_NAMES.size() - 1)];
+        } while (function.arity >= nodes);
+        out += function.name;
+        if (function.arity == 1) {
+            expr(out, nodes - 1);
+            return;
+        }
+        const size_t lhs = between(1, nodes - 2);
+        expr(out, lhs);
+        expr(out, nodes - 1 - lhs);
+        return;
+    }
+
+    if (kind == OperatorKind::Reduction && reductions && nodes >= 4 &&
+        m_indices.size() < INDICES.size() &&
+        m_iterations * (nodes - 3) <= m_work) {
+        reduction(out, nodes);
+        return;
+    }
+
+    if (kind == OperatorKind::Conditional && nodes >= 4) {
+        conditional(out, nodes);
+        return;
+    }
+
+    if (kind == OperatorKind::Call && functions > 0) {
+        const uint32_t slot = m_functions[between(0, functions - 1)];
+        const uint32_t arity = environment.arity(slot);
+        out += environment.name(slot);
+        // Distribute the remaining nodes over the arguments
+        size_t remaining = nodes - 1;
+        for (uint32_t i = 0; i < arity; i += 1) {
+            const size_t left = arity - 1 - i;
+            const size_t size =
+                left == 0 ? remaining : between(1, remaining - left);
+            expr(out, size);
+            remaining -= size;
+        }
+        return;
+    }
+
+    // Additions are more likely, so that fewer results overflow
+    constexpr std::array<std::string_view, 6> binary = {"+", "-", "+",
+                                                        "-", "*", "/"};
+    if (kind == OperatorKind::Comparison) {
+        out += COMPARISONS[between(0, COMPARISONS.size() - 1)];
+    } else {
+        out += binary[between(0, binary.size() - 1)];
+    }
+    // Mix balanced trees with long chains
+    const size_t lhs = chance(0.7) ? between(1, nodes - 2)
+                                   : (chance(0.5) ? 1 : nodes - 2);
+    expr(out, lhs);
+    expr(out, nodes - 1 - lhs);
+}
+
+void Generator::conditional(std::string& out, size_t nodes) {
+    out += "?";
+    const size_t condition = between(1, nodes - 3);
+    const size_t then = between(1, nodes - 2 - condition);
+
+    // Mostly comparisons, so that both branches are taken
+    if (condition >= 3 && chance(0.8)) {
+        out += " ";
+        out += COMPARISONS[between(0, COMPARISONS.size() - 1)];
+        const size_t lhs = between(1, condition - 2);
+        expr(out, lhs);
+        expr(out, condition - 1 - lhs);
+    } else {
+        expr(out, condition);
+    }
+    expr(out, then);
+    expr(out, nodes - 1 - condition - then);
+}
+
+void Generator::reduction(std::string& out, size_t nodes) {
+    const std::string_view index = INDICES[m_indices.size()];
+    out += chance(0.5) ? "sum " : "prod ";
+    out += index;
+
+    // The bounds are literals, so that the amount of indices can be limited
+    const size_t body = nodes - 3;
+    const size_t max_length =
+        std::min<size_t>(3000, m_work / (m_iterations * body) - 1);
+    const size_t length = between(0, max_length);
+    m_work -= m_iterations * (length + 1) * body;
+    const size_t lo = between(0, 9);
+    const bool empty = chance(0.05);
+    out += " ";
+    format_to(out, empty ? lo + length : lo, chance(0.2) ? ".5 " : " ");
+    format_to(out, empty ? lo : lo + length);
+
+    m_indices.push_back(index);
+    m_iterations *= length + 1;
+    expr(out, body);
+    m_iterations /= length + 1;
+    m_indices.pop_back();
+}
+
+auto Generator::expression(size_t nodes, const Environment& environment)
+    -> std::string {
+    m_environment = &environment;
+    m_variables.clear();
+    m_functions.clear();
+    for (uint32_t slot = 0; slot < environment.values.size(); slot += 1) {
+        if (environment.arity(slot) == 0) {
+            m_variables.push_back(slot);
+        } else if (environment.bodies[slot]) {
+            m_functions.push_back(slot);
+        }
+    }
+    std::ranges::sort(m_functions, {}, [&](uint32_t slot) {
+        return environment.arity(slot);
+    });
+
+    m_indices.clear();
+    m_iterations = 1;
+    m_work = MAX_REDUCTION_WORK;
+    m_depth = 0;
+    if (m_kinds_mix != mix) {
+        std::array<double, 6> weights = {
+            mix.unary,       mix.arithmetic, mix.comparison,
+            mix.conditional, mix.call,       mix.reduction,
+        };
+        // Without any weight, every operator would fall back to arithmetic
+        if (std::ranges::all_of(weights, [](double w) { return w <= 0; })) {
+            weights[static_cast<size_t>(OperatorKind::Arithmetic)] = 1;
+        }
+        m_kinds = std::discrete_distribution<size_t>(
+            weights.begin(), weights.end()
+        );
+        m_kinds_mix = mix;
+    }
+
+    std::string out;
+    expr(out, nodes == 0 ? 1 : nodes);
+    return out;
+}
+
+auto Generator::invalid_expression(
+    size_t nodes, const Environment& environment
+) -> std::string {
+    std::string out = expression(nodes, environment);
+
+    // Start of each token (the generator separates all tokens by one space)
+    std::vector<size_t> starts = {0};
+    for (size_t i = 0; i < out.size(); i += 1) {
+        if (out[i] == ' ') {
+            starts.push_back(i + 1);
+        }
+    }
+    const size_t token = starts[between(0, starts.size() - 1)];
+    const size_t token_end = out.find(' ', token);
+
+    switch (between(0, 4)) {
+        case 0:
+            // Missing operand (or a superfluous one, if an operator is removed)
+            out.erase(token, token_end == std::string::npos
+                                 ? std::string::npos
+                                 : token_end - token + 1);
+            break;
+        case 1:
+            out += " 1";
+            break;
+        case 2: {
+            constexpr std::array<std::string_view, 4> invalid = {
+                "$", "#", "@@", "1.2.3"};
+            out.insert(token, std::string(invalid[between(0, 3)]) + " ");
+            break;
+        }
+        case 3:
+            out.insert(token, "undefined ");
+            break;
+        default:
+            out.resize(token);
+            break;
+    }
+    return out;
+}
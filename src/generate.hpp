@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "environment.hpp"
+
+/**
+ * @brief Relative weights of the kinds of operators that `Generator` picks
+ *        from.
+ *
+ * Kinds that do not fit into the remaining nodes (or are not available)
+ * fall back to arithmetic operators, expressions of two nodes are always
+ * unary functions.
+ */
+struct OperatorMix {
+    /// Builtin functions like `cos` and `pow`
+    double unary = 1;
+    /// `+`, `-`, `*` and `/`
+    double arithmetic = 6;
+    /// `<`, `<=`, `>`, `>=`, `==` and `!=`
+    double comparison = 0.3;
+    double conditional = 1;
+    /// Calls of the functions of the environment
+    double call = 1;
+    /// `sum` and `prod`, only if `Generator::reductions` is set
+    double reduction = 1;
+
+    auto operator==(const OperatorMix&) const -> bool = default;
+};
+
+/**
+ * @brief Generates random expressions following the grammar documented in
+ *        `Compiler::compile`, to compare different ways of evaluating them.
+ *
+ * The same seed always generates the same expressions.
+ */
+struct Generator {
+    explicit Generator(uint64_t seed);
+
+    /**
+     * @brief Restarts the generated expressions as if the generator was
+     *        created with `seed`, keeping all settings.
+     */
+    void reseed(uint64_t seed);
+
+    /**
+     * @brief Generates a valid expression.
+     * @param nodes Amount of operators and operands in the expression.
+     * @param environment Variables and functions that may be referenced.
+     * @return Source of the expression.
+     */
+    auto expression(size_t nodes, const Environment& environment = {})
+        -> std::string;
+
+    /**
+     * @brief Generates an expression that is most likely invalid, by breaking
+     *        a valid one (removing, adding or replacing tokens).
+     * @param nodes Amount of operators and operands before breaking it.
+     * @param environment Variables and functions that may be referenced.
+     * @return Source of the expression.
+     */
+    auto invalid_expression(size_t nodes, const Environment& environment = {})
+        -> std::string;
+
+    /// Whether `sum` and `prod` may be generated, which not every way of
+    /// evaluating expressions supports
+    bool reductions = false;
+    /// Levels of nested operators and operands that no expression exceeds,
+    /// operands are generated instead of deeper operators (so expressions
+    /// may end up with fewer nodes)
+    size_t max_depth = SIZE_MAX;
+    OperatorMix mix;
+    /// Chance that an operand is `π` or `pi`
+    double constant_chance = 0.1;
+    /// Chance that `π` is spelled as "π" instead of "pi"
+    double unicode_pi_chance = 0.5;
+    /// Chance that a number goes up to 999 instead of 9
+    double large_number_chance = 0.1;
+    /// Chance that a number contains a `_` separator
+    double separator_chance = 0.1;
+    /// Chance that a number has a decimal part
+    double decimal_chance = 0.5;
+
+   private:
+    /**
+     * @brief Appends an expression with exactly `nodes` nodes to `out`
+     *        (unless `max_depth` is reached).
+     */
+    void expr(std::string& out, size_t nodes);
+    /**
+     * @brief Appends an operator with `nodes` nodes (at least 2) and its
+     *        operands to `out`.
+     */
+    void operation(std::string& out, size_t nodes);
+    /**
+     * @brief Appends a single operand to `out`.
+     */
+    void operand(std::string& out);
+    /**
+     * @brief Appends a reduction with exactly `nodes` nodes (at least 4) to
+     *        `out`.
+     */
+    void reduction(std::string& out, size_t nodes);
+    /**
+     * @brief Appends a conditional with exactly `nodes` nodes (at least 4) to
+     *        `out`.
+     */
+    void conditional(std::string& out, size_t nodes);
+    void number(std::string& out);
+    /**
+     * @brief Random integer in [min, max].
+     */
+    auto between(size_t min, size_t max) -> size_t;
+    /**
+     * @brief True with the given chance (between 0 and 1).
+     */
+    auto chance(double probability) -> bool;
+
+    std::mt19937_64 m_random;
+    /// Picks the kind of each operator, weighted by `mix`
+    std::discrete_distribution<size_t> m_kinds;
+    /// Weights that `m_kinds` was created with, nothing before the first
+    /// expression
+    std::optional<OperatorMix> m_kinds_mix;
+    /// Operators that enclose the current expression
+    size_t m_depth = 0;
+    /// Environment of the expression that is currently generated
+    const Environment* m_environment = nullptr;
+    std::vector<uint32_t> m_variables;
+    /// Slots of all functions, sorted by arity
+    std::vector<uint32_t> m_functions;
+    /// Names of the indices of the enclosing reductions
+    std::vector<std::string_view> m_indices;
+    /// How often the current expression is evaluated by the enclosing
+    /// reductions
+    size_t m_iterations = 1;
+    /// Operations that reductions may still evaluate
+    size_t m_work = 0;
+};
@@ -0,0 +1,579 @@
+#include "ingest.hpp"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "batch.hpp"
+#include "compile.hpp"
+#include "environment.hpp"
+#include "format.hpp"
+#include "pool.hpp"
+#include "progress.hpp"
+#include "tokenize.hpp"
+#include "verify.hpp"
+
+/// Files that the fallback reader evaluates before writing their outputs
+constexpr size_t INGEST_BATCH = 256;
+
+/// Threads that the fallback reader uses at least, as they mostly wait
+constexpr size_t INGEST_MIN_THREADS = 8;
+
+/**
+ * @brief Replaces directories by the regular files inside of them.
+ */
+static auto collect_files(std::span<const std::string> paths)
+    -> std::vector<std::string> {
+    std::vector<std::string> files;
+    for (const std::string& path : paths) {
+        std::error_code error;
+        if (!std::filesystem::is_directory(path, error)) {
+            // Files that don't exist fail once they are opened
+            files.push_back(path);
+            continue;
+        }
+        std::vector<std::string> directory;
+        for (const auto& entry :
+             std::filesystem::recursive_directory_iterator(path, error)) {
+            if (entry.is_regular_file(error)) {
+                directory.push_back(entry.path().string());
+            }
+        }
+        std::ranges::sort(directory);
+        std::ranges::move(directory, std::back_inserter(files));
+    }
+    return files;
+}
+
+/**
+ * @brief Compiles and verifies a single line.
+ * @param error Receives the formatted error of the line, if it has one.
+ * @return The chunk or nothing for errors and empty lines.
+ */
+static auto compile_line(
+    std::string_view line, const Environment& environment, std::string& error
+) -> std::optional<Chunk> {
+    const bool empty = std::ranges::all_of(line, [](char c) {
+        return std::isspace(static_cast<unsigned char>(c)) != 0;
+    });
+    if (empty) {
+        return {};
+    }
+
+    auto maybe_chunk = Compiler::compile(TokenCursor(line), line, environment);
+    if (!maybe_chunk.has_value()) {
+        // Compilation always fails on invalid tokens
+        if (const auto report = invalid_tokens_report(line)) {
+            report->format_to(error, "");
+        } else {
+            maybe_chunk.error().format_to(error, line);
+        }
+        return {};
+    }
+
+    if (const auto report = verify(maybe_chunk.value(), environment)) {
+        report->format_to(error, "");
+        return {};
+    }
+    return std::move(maybe_chunk.value());
+}
+
+/**
+ * @brief Evaluates all lines of a file that has been read completely.
+ *
+ * Lines are compiled `BATCH_WINDOW` at a time before they are evaluated, so
+ * that lines of the same shape are evaluated together (@see
+ * `interpret_batch`).
+ *
+ * @param path Path of the file, for the header.
+ * @param contents Contents of the file.
+ * @param progress Counts the lines, bytes and errors of the file and how
+ *                 many of its lines were grouped, if set.
+ * @return Output of the file, including its header.
+ */
+static auto evaluate_file(
+    std::string_view path, std::string_view contents, Progress* progress
+) -> std::string {
+    const Environment environment;
+    constexpr auto max_precision = std::numeric_limits<Number>::digits10 + 1;
+    FormatBuffer buffer;
+    std::string output = concat("==> ", path, " <==\n");
+    const size_t bytes = contents.size();
+    uint64_t lines = 0;
+    uint64_t failed = 0;
+    BatchStats batches;
+
+    // Each line of the window either has a chunk or an error (which is empty
+    // for empty lines)
+    std::vector<Chunk> chunks;
+    std::vector<const Chunk*> pointers;
+    std::vector<std::string> errors;
+    std::vector<bool> compiled;
+    while (!contents.empty()) {
+        chunks.clear();
+        errors.clear();
+        compiled.clear();
+        while (!contents.empty() && chunks.size() < BATCH_WINDOW) {
+            const size_t newline = contents.find('\n');
+            std::string& error = errors.emplace_back();
+            auto chunk =
+                compile_line(contents.substr(0, newline), environment, error);
+            compiled.push_back(chunk.has_value());
+            if (chunk) {
+                chunks.push_back(std::move(chunk.value()));
+            }
+            contents.remove_prefix(
+                newline == std::string_view::npos ? contents.size()
+                                                  : newline + 1
+            );
+        }
+
+        pointers.clear();
+        for (const Chunk& chunk : chunks) {
+            pointers.push_back(&chunk);
+        }
+        BatchStats stats;
+        const std::vector<Number> results =
+            interpret_batch(pointers, environment, &stats);
+        batches.chunks += stats.chunks;
+        batches.grouped += stats.grouped;
+
+        size_t result = 0;
+        for (size_t line = 0; line < errors.size(); line += 1) {
+            if (compiled[line]) {
+                output += format_value(buffer, max_precision, results[result]);
+                output += '\n';
+                result += 1;
+            } else {
+                output += errors[line];
+                failed += errors[line].empty() ? 0 : 1;
+            }
+        }
+        lines += errors.size();
+    }
+    if (progress) {
+        progress->add(lines, bytes, failed);
+        progress->add_batch(batches.chunks, batches.grouped);
+    }
+    return output;
+}
+
+/**
+ * @brief Output of a file that could not be read.
+ */
+static auto read_error(std::string_view path, int error) -> std::string {
+    return concat(
+        "==> ", path, " <==\nError: Could not read '", path, "' (",
+        std::strerror(error), ")\n"
+    );
+}
+
+/**
+ * @brief Writes the outputs of files in order, while they are completed in
+ *        any order.
+ */
+struct OrderedOutput {
+    std::ostream& out;
+    std::vector<std::optional<std::string>> outputs;
+    /// Index of the next file to write
+    size_t next = 0;
+
+    /**
+     * @brief Stores the output of a file and writes all outputs that are
+     *        complete and no longer wait for an earlier file.
+     */
+    void complete(size_t index, std::string output) {
+        outputs[index] = std::move(output);
+        while (next < outputs.size() && outputs[next]) {
+            write(out, *outputs[next]);
+            outputs[next].reset();
+            next += 1;
+        }
+    }
+};
+
+/**
+ * @brief Minimal io_uring, set up with raw system calls.
+ *
+ * Only used from a single thread, so the ring indices only need
+ * acquire/release ordering against the kernel.
+ */
+class IoUring {
+   public:
+    /**
+     * @brief Creates a ring with `entries` submission entries.
+     * @return Nothing if io_uring or one of the opcodes that `ingest` needs
+     *         is not available (old kernels, seccomp filters, ...).
+     */
+    static auto create(unsigned entries) -> std::optional<IoUring> {
+        io_uring_params params{};
+        const auto fd = static_cast<int>(
+            syscall(__NR_io_uring_setup, entries, &params)
+        );
+        if (fd < 0) {
+            return {};
+        }
+        IoUring ring(fd, params);
+        if (ring.m_sq_ring == MAP_FAILED || ring.m_cq_ring == MAP_FAILED ||
+            ring.m_sqes == MAP_FAILED || !ring.supports_opcodes()) {
+            return {};
+        }
+        return ring;
+    }
+
+    IoUring(IoUring&& other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1)),
+          m_params(other.m_params),
+          m_sq_ring(other.m_sq_ring),
+          m_cq_ring(other.m_cq_ring),
+          m_sqes(other.m_sqes),
+          m_tail(other.m_tail),
+          m_pending(other.m_pending) {}
+    IoUring(const IoUring&) = delete;
+    auto operator=(const IoUring&) -> IoUring& = delete;
+
+    ~IoUring() {
+        if (m_fd < 0) return;
+        if (m_sqes != MAP_FAILED) munmap(m_sqes, sqes_size());
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+            munmap(m_cq_ring, cq_ring_size());
+        }
+        if (m_sq_ring != MAP_FAILED) munmap(m_sq_ring, sq_ring_size());
+        close(m_fd);
+    }
+
+    /**
+     * @brief Queues a submission, which is cleared and returned to be filled
+     *        in. The ring must have room for it.
+     */
+    auto push() -> io_uring_sqe& {
+        const unsigned index = m_tail & *sq(m_params.sq_off.ring_mask);
+        io_uring_sqe& sqe = static_cast<io_uring_sqe*>(m_sqes)[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sq(m_params.sq_off.array)[index] = index;
+        m_tail += 1;
+        m_pending += 1;
+        return sqe;
+    }
+
+    /**
+     * @brief Submits all queued submissions and waits for at least one
+     *        completion.
+     * @return Whether the kernel accepted the submissions.
+     */
+    auto submit_and_wait() -> bool {
+        // Publishes the filled in submissions to the kernel
+        std::atomic_ref(*sq(m_params.sq_off.tail))
+            .store(m_tail, std::memory_order_release);
+        const long result = syscall(
+            __NR_io_uring_enter, m_fd, m_pending, 1, IORING_ENTER_GETEVENTS,
+            nullptr, 0
+        );
+        if (result < 0 && errno != EINTR) {
+            return false;
+        }
+        m_pending -= result < 0 ? 0 : static_cast<unsigned>(result);
+        return true;
+    }
+
+    /**
+     * @brief Calls `handle(user_data, result)` for every completion that
+     *        is ready.
+     */
+    template <typename Handle>
+    void for_each_completion(const Handle& handle) {
+        unsigned* head = cq(m_params.cq_off.head);
+        const unsigned tail = std::atomic_ref(*cq(m_params.cq_off.tail))
+                                  .load(std::memory_order_acquire);
+        const unsigned mask = *cq(m_params.cq_off.ring_mask);
+        const auto* cqes = reinterpret_cast<const io_uring_cqe*>(
+            static_cast<char*>(m_cq_ring) + m_params.cq_off.cqes
+        );
+        for (unsigned current = *head; current != tail; current += 1) {
+            const io_uring_cqe& cqe = cqes[current & mask];
+            // The entry may be reused once the head moved past it
+            const uint64_t user_data = cqe.user_data;
+            const int result = cqe.res;
+            std::atomic_ref(*head).store(
+                current + 1, std::memory_order_release
+            );
+            handle(user_data, result);
+        }
+    }
+
+   private:
+    IoUring(int fd, const io_uring_params& params)
+        : m_fd(fd), m_params(params) {
+        m_sq_ring = map(sq_ring_size(), IORING_OFF_SQ_RING);
+        m_cq_ring = (m_params.features & IORING_FEAT_SINGLE_MMAP) != 0
+                        ? m_sq_ring
+                        : map(cq_ring_size(), IORING_OFF_CQ_RING);
+        m_sqes = map(sqes_size(), IORING_OFF_SQES);
+        if (m_sq_ring != MAP_FAILED) {
+            m_tail = *sq(m_params.sq_off.tail);
+        }
+    }
+
+    auto map(size_t size, off_t offset) const -> void* {
+        return mmap(
+            nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_fd, offset
+        );
+    }
+
+    auto sq_ring_size() const -> size_t {
+        const size_t size =
+            m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+        // Both rings share one mapping, which has to fit the larger one
+        if ((m_params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+            return std::max(size, cq_ring_size());
+        }
+        return size;
+    }
+    auto cq_ring_size() const -> size_t {
+        return m_params.cq_off.cqes +
+               m_params.cq_entries * sizeof(io_uring_cqe);
+    }
+    auto sqes_size() const -> size_t {
+        return m_params.sq_entries * sizeof(io_uring_sqe);
+    }
+
+    auto sq(uint32_t offset) const -> unsigned* {
+        return reinterpret_cast<unsigned*>(
+            static_cast<char*>(m_sq_ring) + offset
+        );
+    }
+    auto cq(uint32_t offset) const -> unsigned* {
+        return reinterpret_cast<unsigned*>(
+            static_cast<char*>(m_cq_ring) + offset
+        );
+    }
+
+    auto supports_opcodes() const -> bool {
+        constexpr size_t OPS = 256;
+        std::vector<char> memory(
+            sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op)
+        );
+        auto* probe = reinterpret_cast<io_uring_probe*>(memory.data());
+        if (syscall(
+                __NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe,
+                OPS
+            ) < 0) {
+            return false;
+        }
+        for (const unsigned opcode :
+             {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE}) {
+            if (opcode > probe->last_op ||
+                (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int m_fd;
+    io_uring_params m_params;
+    void* m_sq_ring = MAP_FAILED;
+    void* m_cq_ring = MAP_FAILED;
+    void* m_sqes = MAP_FAILED;
+    /// Tail of the submission queue, including unpublished submissions
+    unsigned m_tail = 0;
+    /// Queued submissions that were not submitted yet
+    unsigned m_pending = 0;
+};
+
+/**
+ * @brief A file that is being opened, read or closed by the ring.
+ */
+struct InflightFile {
+    enum class Stage : uint8_t { Open, Read, Close };
+
+    size_t index;
+    Stage stage = Stage::Open;
+    int fd = -1;
+    std::string contents;
+    /// Bytes of `contents` that have been read
+    size_t length = 0;
+};
+
+/**
+ * @brief Reads all files with an io_uring and evaluates each as soon as it
+ *        is complete.
+ * @return Whether all files were read, otherwise the caller falls back to
+ *         blocking reads for the files without output.
+ */
+static auto ingest_io_uring(
+    IoUring& ring, const std::vector<std::string>& files,
+    OrderedOutput& output, Progress* progress
+) -> bool {
+    // One slot per file in flight, the slot is the user data of its requests
+    std::vector<InflightFile> slots(INGEST_QUEUE_DEPTH);
+    std::vector<size_t> free_slots;
+    for (size_t slot = slots.size(); slot > 0; slot -= 1) {
+        free_slots.push_back(slot - 1);
+    }
+    size_t next_file = 0;
+    size_t inflight = 0;
+
+    auto submit_open = [&](size_t slot) {
+        InflightFile& file = slots[slot];
+        file = InflightFile{.index = next_file};
+        next_file += 1;
+        inflight += 1;
+        io_uring_sqe& sqe = ring.push();
+        sqe.opcode = IORING_OP_OPENAT;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = reinterpret_cast<uint64_t>(files[file.index].c_str());
+        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+        sqe.user_data = slot;
+    };
+    auto submit_read = [&](size_t slot) {
+        InflightFile& file = slots[slot];
+        file.stage = InflightFile::Stage::Read;
+        file.contents.resize(file.length + INGEST_READ_SIZE);
+        io_uring_sqe& sqe = ring.push();
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = file.fd;
+        sqe.addr = reinterpret_cast<uint64_t>(file.contents.data() + file.length);
+        sqe.len = INGEST_READ_SIZE;
+        sqe.off = file.length;
+        sqe.user_data = slot;
+    };
+    auto submit_close = [&](size_t slot) {
+        InflightFile& file = slots[slot];
+        file.stage = InflightFile::Stage::Close;
+        io_uring_sqe& sqe = ring.push();
+        sqe.opcode = IORING_OP_CLOSE;
+        sqe.fd = file.fd;
+        sqe.user_data = slot;
+    };
+    // Frees the slot and starts the next file in it
+    auto finish = [&](size_t slot) {
+        inflight -= 1;
+        if (next_file < files.size()) {
+            submit_open(slot);
+        }
+    };
+
+    auto complete = [&](uint64_t user_data, int result) {
+        const auto slot = static_cast<size_t>(user_data);
+        InflightFile& file = slots[slot];
+        const std::string& path = files[file.index];
+
+        switch (file.stage) {
+            case InflightFile::Stage::Open:
+                if (result < 0) {
+                    if (progress) progress->add(0, 0, 1);
+                    output.complete(file.index, read_error(path, -result));
+                    return finish(slot);
+                }
+                file.fd = result;
+                return submit_read(slot);
+            case InflightFile::Stage::Read:
+                if (result > 0) {
+                    file.length += static_cast<size_t>(result);
+                }
+                // A short read of a regular file already means its end,
+                // which saves a request for almost every small file
+                if (result == static_cast<int>(INGEST_READ_SIZE)) {
+                    return submit_read(slot);
+                }
+                // The file is evaluated while it is being closed
+                submit_close(slot);
+                if (result < 0) {
+                    if (progress) progress->add(0, 0, 1);
+                    output.complete(file.index, read_error(path, -result));
+                } else {
+                    file.contents.resize(file.length);
+                    output.complete(
+                        file.index, evaluate_file(path, file.contents, progress)
+                    );
+                }
+                file.contents = {};
+                return;
+            case InflightFile::Stage::Close:
+                return finish(slot);
+        }
+    };
+
+    while (next_file < files.size() && !free_slots.empty()) {
+        submit_open(free_slots.back());
+        free_slots.pop_back();
+    }
+    while (inflight > 0) {
+        if (!ring.submit_and_wait()) {
+            return false;
+        }
+        ring.for_each_completion(complete);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads all files with blocking calls on a thread pool, evaluating
+ *        each on the thread that read it.
+ */
+static void ingest_threads(
+    const std::vector<std::string>& files, size_t first, size_t threads,
+    OrderedOutput& output, Progress* progress
+) {
+    ThreadPool pool(std::max(threads, INGEST_MIN_THREADS));
+    std::vector<std::string> outputs;
+    for (size_t batch = first; batch < files.size(); batch += INGEST_BATCH) {
+        const size_t end = std::min(batch + INGEST_BATCH, files.size());
+        outputs.assign(end - batch, {});
+        pool.for_each(batch, end, [&](size_t index) {
+            const std::string& path = files[index];
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                if (progress) progress->add(0, 0, 1);
+                outputs[index - batch] = read_error(path, errno);
+                return;
+            }
+            const std::string contents(
+                std::istreambuf_iterator<char>(file), {}
+            );
+            outputs[index - batch] = evaluate_file(path, contents, progress);
+        });
+        for (size_t index = batch; index < end; index += 1) {
+            output.complete(index, std::move(outputs[index - batch]));
+        }
+    }
+}
+
+void ingest(
+    std::span<const std::string> paths, std::ostream& out, size_t threads,
+    bool use_io_uring, Progress* progress
+) {
+    const std::vector<std::string> files = collect_files(paths);
+    OrderedOutput output{.out = out, .outputs = {}};
+    output.outputs.resize(files.size());
+
+    if (use_io_uring) {
+        if (auto ring = IoUring::create(INGEST_QUEUE_DEPTH)) {
+            if (ingest_io_uring(*ring, files, output, progress)) {
+                out.flush();
+                return;
+            }
+        }
+    }
+
+    // Files that the ring already completed keep their output
+    ingest_threads(files, output.next, threads, output, progress);
+    out.flush();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <span>
+#include <string>
+
+class Progress;
+
+/// Files that are opened and read at the same time
+constexpr size_t INGEST_QUEUE_DEPTH = 64;
+
+/// Bytes requested by a single read of a file
+constexpr size_t INGEST_READ_SIZE = 1 << 16;
+
+/**
+ * @brief Evaluates every line of many (usually small) files.
+ *
+ * Directories are replaced by all regular files inside of them (recursively,
+ * sorted by path). Files are opened and read through a Linux io_uring, with
+ * up to `INGEST_QUEUE_DEPTH` files in flight, and evaluated on the calling
+ * thread as soon as they are read completely. If io_uring is not available,
+ * a thread pool reads and evaluates the files with blocking calls instead.
+ *
+ * The output of each file starts with a `==> path <==` header, followed by
+ * one result or error per non empty line like `--plain`. Files are written in
+ * the order of `paths`, no matter in which order they were read. Lines are
+ * evaluated independently of each other, so definitions are not supported.
+ *
+ * @param paths Files and directories to evaluate.
+ * @param out Stream to write the results into.
+ * @param threads Threads of the fallback reader (at least 8 are used).
+ * @param use_io_uring Whether to try io_uring at all.
+ * @param progress Counts the lines, bytes and errors of every file, if set.
+ */
+void ingest(
+    std::span<const std::string> paths, std::ostream& out, size_t threads,
+    bool use_io_uring = true, Progress* progress = nullptr
+);
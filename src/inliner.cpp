@@ -0,0 +1,342 @@
+#include "inliner.hpp"
+
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "format.hpp"
+
+/**
+ * @brief Jumps that were copied into a `ChunkBuilder`, whose targets have not
+ *        been reached yet.
+ *
+ * Inlining changes the size of the code that a jump skips, so its operands
+ * are only filled in once its target has been emitted as well.
+ */
+struct PendingJumps {
+    struct Jump {
+        OpCode opcode;
+        /// Index of the opcode the jump lands on, in the copied code
+        size_t target;
+        /// Index of its first operand in the builder
+        size_t operand;
+        /// End of the builder right after the jump
+        Segment after;
+    };
+
+    /**
+     * @brief Copies a jump into `out`, with placeholder operands.
+     * @param out Builder to append the jump to.
+     * @param opcode `OpCode::Jump` or `OpCode::JumpIfZero`.
+     * @param index Index of the jump in the copied code.
+     * @param skip Opcodes that the jump skips in the copied code.
+     */
+    void add(ChunkBuilder& out, OpCode opcode, size_t index, uint32_t skip) {
+        out.opcodes.push_back(opcode);
+        const size_t operand = out.operands.size();
+        out.operands.resize(operand + JUMP_OPERANDS);
+        jumps.push_back(Jump{
+            .opcode = opcode,
+            .target = index + 1 + skip,
+            .operand = operand,
+            .after = out.end(),
+        });
+    }
+
+    /**
+     * @brief Makes all jumps that land on `index` skip to the end of `out`.
+     * @return Amount of `OpCode::Jump`s (ends of conditionals) that landed.
+     */
+    auto land(ChunkBuilder& out, size_t index) -> size_t {
+        size_t ends = 0;
+        // Only as many jumps as conditionals are nested can be pending
+        for (size_t i = jumps.size(); i > 0; i -= 1) {
+            const Jump jump = jumps[i - 1];
+            if (jump.target != index) {
+                continue;
+            }
+            const Segment end = out.end();
+            out.operands[jump.operand] =
+                static_cast<uint32_t>(end.opcode_start - jump.after.opcode_start);
+            out.operands[jump.operand + 1] = static_cast<uint32_t>(
+                end.literal_start - jump.after.literal_start
+            );
+            out.operands[jump.operand + 2] = static_cast<uint32_t>(
+                end.operand_start - jump.after.operand_start
+            );
+            ends += jump.opcode == OpCode::Jump ? 1 : 0;
+            jumps.erase(jumps.begin() + static_cast<ptrdiff_t>(i - 1));
+        }
+        return ends;
+    }
+
+    std::vector<Jump> jumps;
+};
+
+/**
+ * @brief Emits the body of a function, with each use of a parameter replaced
+ *        by the code of its argument.
+ * @param out Builder to append the code into.
+ * @param body Body of the function (ending with `Ret`).
+ * @param arguments Code of all arguments, in the order they were pushed.
+ * @param starts Start of each argument within `arguments`.
+ */
+static void emit_body(
+    ChunkBuilder& out, const Chunk& body, const ChunkBuilder& arguments,
+    std::span<const Segment> starts
+) {
+    const size_t arity = starts.size();
+    size_t literal_index = 0;
+    size_t operand_index = 0;
+    PendingJumps jumps;
+
+    for (size_t i = 0; i < body.opcodes.size(); i += 1) {
+        const OpCode opcode = body.opcodes[i];
+        jumps.land(out, i);
+
+        switch (opcode) {
+            case OpCode::Ret:
+                return;
+            case OpCode::JumpIfZero:
+            case OpCode::Jump:
+                jumps.add(out, opcode, i, body.operands[operand_index]);
+                operand_index += JUMP_OPERANDS;
+                break;
+            case OpCode::LoadArg: {
+                const size_t position = body.operands[operand_index];
+                operand_index += 1;
+                const Segment end = position + 1 < arity
+                                        ? starts[position + 1]
+                                        : arguments.end();
+                out.append(arguments, starts[position], end);
+                break;
+            }
+            case OpCode::Load:
+                out.opcodes.push_back(opcode);
+                out.literals.push_back(body.literals[literal_index]);
+                literal_index += 1;
+                break;
+            default:
+                out.opcodes.push_back(opcode);
+                if (opcode_operands(opcode) > 0) {
+                    out.operands.push_back(body.operands[operand_index]);
+                    operand_index += 1;
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Index of the next `OpCode::LoadArg` of a parameter in a body.
+ * @param body Body of the function (ending with `Ret`).
+ * @param position Index of the parameter.
+ * @param index Index of the first opcode to search from.
+ * @param operand_index Index of the first operand of that opcode.
+ * @return The index or the size of the body if there is none.
+ */
+static auto find_use(
+    const Chunk& body, size_t position, size_t index, size_t operand_index
+) -> size_t {
+    for (; index < body.opcodes.size(); index += 1) {
+        const OpCode opcode = body.opcodes[index];
+        if (opcode == OpCode::LoadArg &&
+            body.operands[operand_index] == position) {
+            return index;
+        }
+        operand_index += opcode_operands(opcode);
+    }
+    return index;
+}
+
+/**
+ * @brief Opcodes that inlining a call would emit in place of the call and the
+ *        code of its arguments.
+ * @param body Body of the function (ending with `Ret`).
+ * @param starts Start of each argument.
+ * @param end End of the last argument.
+ * @return The size or nothing if an argument of more than one opcode is used
+ *         more than once, as copying it could double the code for every
+ *         nested call.
+ */
+static auto inlined_size(
+    const Chunk& body, std::span<const Segment> starts, Segment end
+) -> std::optional<size_t> {
+    size_t size = 0;
+    size_t operand_index = 0;
+    for (size_t i = 0; i < body.opcodes.size(); i += 1) {
+        const OpCode opcode = body.opcodes[i];
+        operand_index += opcode_operands(opcode);
+        if (opcode != OpCode::LoadArg) {
+            size += opcode == OpCode::Ret ? 0 : 1;
+            continue;
+        }
+        const size_t position = body.operands[operand_index - 1];
+        const size_t argument_end = position + 1 < starts.size()
+                                        ? starts[position + 1].opcode_start
+                                        : end.opcode_start;
+        const size_t argument_size =
+            argument_end - starts[position].opcode_start;
+        if (argument_size > 1 &&
+            find_use(body, position, i + 1, operand_index) <
+                body.opcodes.size()) {
+            return {};
+        }
+        size += argument_size;
+    }
+    return size;
+}
+
+auto inline_calls(
+    const Chunk& chunk, const Environment& environment, size_t max_opcodes
+) -> Chunk {
+    ChunkBuilder out;
+    // Start of the code of each value on the stack
+    std::vector<Segment> stack;
+    // Reused for every inlined call to avoid allocating
+    ChunkBuilder arguments;
+    std::vector<Segment> starts;
+    size_t literal_index = 0;
+    size_t operand_index = 0;
+    PendingJumps jumps;
+    // Start of the conditionals whose end has not been reached yet
+    std::vector<Segment> conditionals;
+
+    // Removes `count` values from the stack and returns where the first of
+    // them started
+    auto pop = [&stack](size_t count) -> Segment {
+        const Segment start = stack[stack.size() - count];
+        stack.resize(stack.size() - count);
+        return start;
+    };
+
+    // A conditional becomes a single value once both branches were emitted
+    auto land = [&](size_t index) {
+        for (size_t ends = jumps.land(out, index); ends > 0; ends -= 1) {
+            pop(1);
+            stack.push_back(conditionals.back());
+            conditionals.pop_back();
+        }
+    };
+
+    for (size_t i = 0; i < chunk.opcodes.size(); i += 1) {
+        const OpCode opcode = chunk.opcodes[i];
+        land(i);
+        const Segment start = out.end();
+
+        switch (opcode) {
+            case OpCode::Load:
+                out.opcodes.push_back(opcode);
+                out.literals.push_back(chunk.literals[literal_index]);
+                literal_index += 1;
+                stack.push_back(start);
+                break;
+            case OpCode::Variable:
+            case OpCode::LoadArg:
+            case OpCode::Index:
+                out.opcodes.push_back(opcode);
+                out.operands.push_back(chunk.operands[operand_index]);
+                operand_index += 1;
+                stack.push_back(start);
+                break;
+            case OpCode::Cos:
+            case OpCode::Sin:
+            case OpCode::Tan:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Sqrt:
+            case OpCode::Abs:
+            case OpCode::Atan:
+            case OpCode::Ret:
+                out.opcodes.push_back(opcode);
+                stack.push_back(pop(1));
+                break;
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
+            case OpCode::Div:
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Pow:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Hypot:
+            case OpCode::Atan2:
+                out.opcodes.push_back(opcode);
+                stack.push_back(pop(2));
+                break;
+            case OpCode::JumpIfZero:
+                // The condition starts the conditional
+                conditionals.push_back(pop(1));
+                jumps.add(out, opcode, i, chunk.operands[operand_index]);
+                operand_index += JUMP_OPERANDS;
+                break;
+            case OpCode::Jump:
+                // The then branch, the else branch takes its place
+                pop(1);
+                jumps.add(out, opcode, i, chunk.operands[operand_index]);
+                operand_index += JUMP_OPERANDS;
+                break;
+            case OpCode::Sum:
+            case OpCode::Prod:
+                out.opcodes.push_back(opcode);
+                out.operands.push_back(chunk.operands[operand_index]);
+                operand_index += 1;
+                stack.push_back(pop(2));
+                break;
+            case OpCode::Call: {
+                const uint32_t slot = chunk.operands[operand_index];
+                operand_index += 1;
+                const uint32_t arity = environment.arity(slot);
+                const auto& body = environment.bodies.at(slot);
+
+                starts.assign(stack.end() - arity, stack.end());
+                const Segment arguments_start = pop(arity);
+
+                std::optional<size_t> size;
+                // The bodies of reductions would have to be merged as well
+                if (body && body->opcodes.size() - 1 <= MAX_INLINE_SIZE &&
+                    body->reductions.empty()) {
+                    size = inlined_size(body.value(), starts, out.end());
+                }
+                if (size &&
+                    arguments_start.opcode_start + *size <= max_opcodes) {
+                    // Make argument starts relative to the split off code
+                    for (Segment& segment : starts) {
+                        segment.opcode_start -= arguments_start.opcode_start;
+                        segment.literal_start -= arguments_start.literal_start;
+                        segment.operand_start -= arguments_start.operand_start;
+                    }
+                    out.split_off(arguments_start, arguments);
+                    emit_body(out, body.value(), arguments, starts);
+                } else {
+                    out.opcodes.push_back(opcode);
+                    out.operands.push_back(slot);
+                }
+                stack.push_back(arguments_start);
+                break;
+            }
+            default:
+                panic(
+                    "Internal Error: Unkown OpCode <",
+                    static_cast<uint8_t>(opcode), ">"
+                );
+        }
+    }
+    land(chunk.opcodes.size());
+
+    // Reductions keep their slots, only calls in their bodies are inlined
+    std::vector<Chunk> reductions;
+    for (const Chunk& reduction : chunk.reductions) {
+        reductions.push_back(inline_calls(reduction, environment, max_opcodes));
+    }
+
+    return Chunk(
+        std::move(out.opcodes), std::move(out.literals),
+        std::move(out.operands), std::move(reductions)
+    );
+}
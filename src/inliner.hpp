@@ -0,0 +1,32 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "environment.hpp"
+
+/// Functions with at most this many opcodes (without `Ret`) get inlined
+constexpr size_t MAX_INLINE_SIZE = 16;
+
+/// Calls stay calls once inlining them would grow a chunk beyond this, unless
+/// a lower limit is passed to `inline_calls`
+constexpr size_t MAX_INLINED_OPCODES = 65536;
+
+/**
+ * @brief Replaces calls of small functions with their bodies, so that no call
+ *        frame has to be set up for them at runtime.
+ *
+ * Every use of a parameter is replaced with the code of its argument.
+ * Expressions have no side effects, so evaluating an argument more or less
+ * often than once does not change the result. Arguments of more than one
+ * opcode are only copied for parameters that are used at most once, so that
+ * nested calls grow the code linearly instead of exponentially.
+ *
+ * @param chunk The chunk to transform, may be a function body.
+ * @param environment Functions that the chunk was compiled with.
+ * @param max_opcodes Opcodes that the chunk (and each of its reductions) may
+ *        grow to, calls that would exceed them are kept.
+ * @return Chunk without calls to small functions.
+ */
+auto inline_calls(
+    const Chunk& chunk, const Environment& environment,
+    size_t max_opcodes = MAX_INLINED_OPCODES
+) -> Chunk;
@@ -1,8 +1,12 @@
 #include "interpret.hpp"
 
-#include <cmath>
+#include <algorithm>
+#include <array>
+#include <utility>
 
+#include "budget.hpp"
 #include "format.hpp"
+#include "reduction.hpp"
 
 struct Stack {
     auto push(Number value) -> void { m_data.push_back(value); }
@@ -11,39 +15,158 @@ struct Stack {
         m_data.pop_back();
         return result;
     }
+    auto at(size_t index) const -> Number { return m_data.at(index); }
+    auto size() const -> size_t { return m_data.size(); }
+    auto view(size_t start, size_t count) const -> std::span<const Number> {
+        return std::span(m_data).subspan(start, count);
+    }
+    auto truncate(size_t size) -> void { m_data.resize(size); }
 
    private:
     std::vector<Number> m_data;
 };
 
-auto interpret(const Chunk& chunk) -> Number {
-    Stack stack;
+/**
+ * @brief Execution state of a `Chunk`, saved while a function it called runs.
+ */
+struct Frame {
+    const Chunk* chunk;
+    size_t opcode_index = 0;
     size_t literal_index = 0;
+    size_t operand_index = 0;
+    /// Index of the first argument on the stack
+    size_t base = 0;
+    uint32_t arity = 0;
+};
+
+/**
+ * @brief Executes opcodes until the outermost frame reaches `end` or returns.
+ * @param stack Stack to execute on, contains the arguments of `frame`.
+ * @param frame Outermost frame to start with.
+ * @param end Index of the opcode to stop at in the outermost frame.
+ * @param environment Variables and functions.
+ * @param pool Threads to evaluate reductions on.
+ * @return Value on top of the stack.
+ */
+static auto run(
+    Stack& stack, Frame frame, size_t end, const Environment& environment,
+    ThreadPool* pool
+) -> Number {
+    std::vector<Frame> frames;
+
+    while (!frames.empty() || frame.opcode_index < end) {
+        const OpCode opcode = frame.chunk->opcodes.at(frame.opcode_index);
+        frame.opcode_index += 1;
 
-    for (OpCode opcode : chunk.opcodes) {
         switch (opcode) {
             case OpCode::Load:
-                stack.push(chunk.literals.at(literal_index));
-                literal_index += 1;
+                stack.push(frame.chunk->literals.at(frame.literal_index));
+                frame.literal_index += 1;
                 break;
-            case OpCode::Add:
-                stack.push(stack.pop() + stack.pop());
+            case OpCode::Variable: {
+                const uint32_t slot =
+                    frame.chunk->operands.at(frame.operand_index);
+                frame.operand_index += 1;
+                stack.push(environment.values.at(slot));
                 break;
-            case OpCode::Sub:
-                stack.push(stack.pop() - stack.pop());
+            }
+            case OpCode::LoadArg: {
+                const uint32_t index =
+                    frame.chunk->operands.at(frame.operand_index);
+                frame.operand_index += 1;
+                stack.push(stack.at(frame.base + index));
                 break;
-            case OpCode::Mul:
-                stack.push(stack.pop() * stack.pop());
+            }
+            case OpCode::Call: {
+                // Nested calls are the only way to do more work than there
+                // are opcodes (besides reductions, which check on their own)
+                if (evaluation_stopped()) {
+                    return NAN;
+                }
+                const uint32_t slot =
+                    frame.chunk->operands.at(frame.operand_index);
+                frame.operand_index += 1;
+                const uint32_t arity = environment.arity(slot);
+
+                frames.push_back(frame);
+                frame = Frame{
+                    .chunk = &environment.bodies.at(slot).value(),
+                    .base = stack.size() - arity,
+                    .arity = arity,
+                };
+                break;
+            }
+            case OpCode::Ret: {
+                const Number result = stack.pop();
+                if (frames.empty()) {
+                    return result;
+                }
+                stack.truncate(frame.base);
+                stack.push(result);
+                frame = frames.back();
+                frames.pop_back();
                 break;
+            }
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
             case OpCode::Div:
-                stack.push(stack.pop() / stack.pop());
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Pow:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Hypot:
+            case OpCode::Atan2: {
+                const Number rhs = stack.pop();
+                const Number lhs = stack.pop();
+                stack.push(apply_binary(opcode, lhs, rhs));
                 break;
+            }
             case OpCode::Cos:
-                stack.push(std::cos(stack.pop()));
-                break;
             case OpCode::Sin:
-                stack.push(std::sin(stack.pop()));
+            case OpCode::Tan:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Sqrt:
+            case OpCode::Abs:
+            case OpCode::Atan:
+                stack.push(apply_unary(opcode, stack.pop()));
+                break;
+            case OpCode::Sum:
+            case OpCode::Prod: {
+                const Chunk& body = frame.chunk->reductions.at(
+                    frame.chunk->operands.at(frame.operand_index)
+                );
+                frame.operand_index += 1;
+                const Number hi = stack.pop();
+                const Number lo = stack.pop();
+                const ReductionContext context{
+                    .environment = environment,
+                    .arguments = stack.view(frame.base, frame.arity),
+                    .indices = {},
+                    .pool = pool,
+                };
+                stack.push(interpret_reduction(opcode, body, lo, hi, context));
                 break;
+            }
+            case OpCode::JumpIfZero:
+            case OpCode::Jump: {
+                const std::vector<uint32_t>& operands = frame.chunk->operands;
+                const size_t operand = frame.operand_index;
+                frame.operand_index += JUMP_OPERANDS;
+                if (opcode == OpCode::JumpIfZero && stack.pop() != 0) {
+                    break;
+                }
+                frame.opcode_index += operands.at(operand);
+                frame.literal_index += operands.at(operand + 1);
+                frame.operand_index += operands.at(operand + 2);
+                break;
+            }
             default:
                 panic(
                     "Internal Error: Unkown OpCode <",
@@ -55,3 +178,330 @@ auto interpret(const Chunk& chunk) -> Number {
 
     return stack.pop();
 }
+
+/**
+ * @brief Execution state of a verified `Chunk`, pointing directly at the next
+ *        opcode, literal and operand.
+ */
+struct UncheckedFrame {
+    /// Chunk that contains the opcodes, for the bodies of its reductions
+    const Chunk* chunk;
+    const OpCode* opcode;
+    const Number* literal;
+    const uint32_t* operand;
+    /// First argument on the stack
+    Number* base;
+    uint32_t arity;
+};
+
+/**
+ * @brief Preallocated stack and frames for executing a verified `Chunk`.
+ *
+ * Small chunks (which are by far the most common) fit into inline arrays, so
+ * no memory has to be allocated at all.
+ */
+struct UncheckedMemory {
+    UncheckedMemory(size_t values, size_t frames) {
+        if (values > m_inline_values.size()) {
+            m_values.resize(values);
+            stack = m_values.data();
+        }
+        if (frames > m_inline_frames.size()) {
+            m_frames.resize(frames);
+            saved_frames = m_frames.data();
+        }
+    }
+
+    UncheckedMemory(const UncheckedMemory&) = delete;
+    auto operator=(const UncheckedMemory&) -> UncheckedMemory& = delete;
+
+   private:
+    std::array<Number, 64> m_inline_values;
+    std::array<UncheckedFrame, 8> m_inline_frames;
+    std::vector<Number> m_values;
+    std::vector<UncheckedFrame> m_frames;
+
+   public:
+    Number* stack = m_inline_values.data();
+    UncheckedFrame* saved_frames = m_inline_frames.data();
+};
+
+/**
+ * @brief Executes a verified chunk until the outermost frame reaches `end` or
+ *        returns, without any bounds or stack checks.
+ * @pre The chunks of all frames passed `verify` against `environment` and
+ *      `memory` was sized with their limits.
+ * @param memory Stack and frames to execute on.
+ * @param top One past the last value on the stack (the arguments of
+ *            `frame`).
+ * @param frame Outermost frame to start with.
+ * @param end Opcode to stop at in the outermost frame.
+ * @param environment Variables and functions.
+ * @param pool Threads to evaluate reductions on.
+ * @return Value on top of the stack.
+ */
+static auto run_unchecked(
+    UncheckedMemory& memory, Number* top, UncheckedFrame frame,
+    const OpCode* end, const Environment& environment, ThreadPool* pool
+) -> Number {
+    UncheckedFrame* const outermost = memory.saved_frames;
+    UncheckedFrame* saved = outermost;
+
+    // The right hand side is on top of the stack
+    auto binary = [&top](OpCode opcode) {
+        top[-2] = apply_binary(opcode, top[-2], top[-1]);
+        top -= 1;
+    };
+    auto jump = [&frame]() {
+        frame.opcode += frame.operand[0];
+        frame.literal += frame.operand[1];
+        frame.operand += JUMP_OPERANDS + frame.operand[2];
+    };
+
+    while (frame.opcode != end || saved != outermost) {
+        const OpCode opcode = *frame.opcode;
+        frame.opcode += 1;
+
+        switch (opcode) {
+            case OpCode::Load:
+                *top = *frame.literal;
+                top += 1;
+                frame.literal += 1;
+                break;
+            case OpCode::Variable:
+                *top = environment.values[*frame.operand];
+                top += 1;
+                frame.operand += 1;
+                break;
+            case OpCode::LoadArg:
+                *top = frame.base[*frame.operand];
+                top += 1;
+                frame.operand += 1;
+                break;
+            case OpCode::Call: {
+                if (evaluation_stopped()) {
+                    return NAN;
+                }
+                const uint32_t slot = *frame.operand;
+                frame.operand += 1;
+                const uint32_t arity = environment.arity(slot);
+                const Chunk& body = *environment.bodies[slot];
+
+                *saved = frame;
+                saved += 1;
+                frame = UncheckedFrame{
+                    .chunk = &body,
+                    .opcode = body.opcodes.data(),
+                    .literal = body.literals.data(),
+                    .operand = body.operands.data(),
+                    .base = top - arity,
+                    .arity = arity,
+                };
+                break;
+            }
+            case OpCode::Ret: {
+                const Number result = top[-1];
+                if (saved == outermost) {
+                    return result;
+                }
+                top = frame.base;
+                *top = result;
+                top += 1;
+                saved -= 1;
+                frame = *saved;
+                break;
+            }
+            case OpCode::Add:
+                binary(OpCode::Add);
+                break;
+            case OpCode::Sub:
+                binary(OpCode::Sub);
+                break;
+            case OpCode::Mul:
+                binary(OpCode::Mul);
+                break;
+            case OpCode::Div:
+                binary(OpCode::Div);
+                break;
+            case OpCode::Less:
+                binary(OpCode::Less);
+                break;
+            case OpCode::LessEqual:
+                binary(OpCode::LessEqual);
+                break;
+            case OpCode::Greater:
+                binary(OpCode::Greater);
+                break;
+            case OpCode::GreaterEqual:
+                binary(OpCode::GreaterEqual);
+                break;
+            case OpCode::Equal:
+                binary(OpCode::Equal);
+                break;
+            case OpCode::NotEqual:
+                binary(OpCode::NotEqual);
+                break;
+            case OpCode::Cos:
+                top[-1] = apply_unary(OpCode::Cos, top[-1]);
+                break;
+            case OpCode::Sin:
+                top[-1] = apply_unary(OpCode::Sin, top[-1]);
+                break;
+            case OpCode::Tan:
+                top[-1] = apply_unary(OpCode::Tan, top[-1]);
+                break;
+            case OpCode::Exp:
+                top[-1] = apply_unary(OpCode::Exp, top[-1]);
+                break;
+            case OpCode::Log:
+                top[-1] = apply_unary(OpCode::Log, top[-1]);
+                break;
+            case OpCode::Sqrt:
+                top[-1] = apply_unary(OpCode::Sqrt, top[-1]);
+                break;
+            case OpCode::Abs:
+                top[-1] = apply_unary(OpCode::Abs, top[-1]);
+                break;
+            case OpCode::Atan:
+                top[-1] = apply_unary(OpCode::Atan, top[-1]);
+                break;
+            case OpCode::Pow:
+                binary(OpCode::Pow);
+                break;
+            case OpCode::Min:
+                binary(OpCode::Min);
+                break;
+            case OpCode::Max:
+                binary(OpCode::Max);
+                break;
+            case OpCode::Hypot:
+                binary(OpCode::Hypot);
+                break;
+            case OpCode::Atan2:
+                binary(OpCode::Atan2);
+                break;
+            case OpCode::Sum:
+            case OpCode::Prod: {
+                const ReductionContext context{
+                    .environment = environment,
+                    .arguments = std::span(frame.base, frame.arity),
+                    .indices = {},
+                    .pool = pool,
+                };
+                top[-2] = interpret_reduction(
+                    opcode, frame.chunk->reductions[*frame.operand], top[-2],
+                    top[-1], context
+                );
+                top -= 1;
+                frame.operand += 1;
+                break;
+            }
+            case OpCode::JumpIfZero:
+                top -= 1;
+                if (*top == 0) {
+                    jump();
+                } else {
+                    frame.operand += JUMP_OPERANDS;
+                }
+                break;
+            case OpCode::Jump:
+                jump();
+                break;
+            default:
+                std::unreachable();
+        }
+    }
+
+    return top[-1];
+}
+
+/**
+ * @brief Frame that starts executing a verified chunk at `position`.
+ */
+static auto unchecked_frame(
+    const Chunk& chunk, ChunkPosition position, Number* base, uint32_t arity
+) -> UncheckedFrame {
+    return UncheckedFrame{
+        .chunk = &chunk,
+        .opcode = chunk.opcodes.data() + position.opcode,
+        .literal = chunk.literals.data() + position.literal,
+        .operand = chunk.operands.data() + position.operand,
+        .base = base,
+        .arity = arity,
+    };
+}
+
+auto interpret(
+    const Chunk& chunk, const Environment& environment, ThreadPool* pool
+) -> Number {
+    if (const auto& limits = chunk.limits) {
+        UncheckedMemory memory(limits->max_stack_depth, limits->max_call_depth);
+        const UncheckedFrame frame =
+            unchecked_frame(chunk, {}, memory.stack, 0);
+        return run_unchecked(
+            memory, memory.stack, frame,
+            chunk.opcodes.data() + chunk.opcodes.size(), environment, pool
+        );
+    }
+
+    Stack stack;
+    return run(
+        stack, Frame{.chunk = &chunk}, chunk.opcodes.size(), environment, pool
+    );
+}
+
+auto interpret_subtree(
+    const Chunk& chunk, ChunkPosition start, size_t end,
+    const Environment& environment, ThreadPool* pool
+) -> Number {
+    // A subtree never needs more space than the whole chunk
+    if (const auto& limits = chunk.limits) {
+        UncheckedMemory memory(limits->max_stack_depth, limits->max_call_depth);
+        const UncheckedFrame frame =
+            unchecked_frame(chunk, start, memory.stack, 0);
+        return run_unchecked(
+            memory, memory.stack, frame, chunk.opcodes.data() + end,
+            environment, pool
+        );
+    }
+
+    Stack stack;
+    const Frame frame{
+        .chunk = &chunk,
+        .opcode_index = start.opcode,
+        .literal_index = start.literal,
+        .operand_index = start.operand,
+    };
+    return run(stack, frame, end, environment, pool);
+}
+
+auto interpret_call(
+    uint32_t slot, std::span<const Number> arguments,
+    const Environment& environment, ThreadPool* pool
+) -> Number {
+    const Chunk& body = environment.bodies.at(slot).value();
+    const auto arity = static_cast<uint32_t>(arguments.size());
+
+    if (const auto& limits = body.limits) {
+        UncheckedMemory memory(
+            arity + limits->max_stack_depth, limits->max_call_depth
+        );
+        std::ranges::copy(arguments, memory.stack);
+        const UncheckedFrame frame =
+            unchecked_frame(body, {}, memory.stack, arity);
+        return run_unchecked(
+            memory, memory.stack + arity, frame,
+            body.opcodes.data() + body.opcodes.size(), environment, pool
+        );
+    }
+
+    Stack stack;
+    for (Number argument : arguments) {
+        stack.push(argument);
+    }
+    const Frame frame{
+        .chunk = &body,
+        .arity = arity,
+    };
+    return run(stack, frame, body.opcodes.size(), environment, pool);
+}
@@ -1,10 +1,145 @@
 #pragma once
 
+#include <cmath>
+#include <span>
+
 #include "chunk.hpp"
+#include "environment.hpp"
+#include "format.hpp"
+
+class ThreadPool;
+
+/**
+ * @brief Applies a unary operation like `Cos` to its operand.
+ * @param opcode The operation.
+ * @param operand The operand.
+ * @return Result of the operation.
+ */
+inline auto apply_unary(OpCode opcode, Number operand) -> Number {
+    switch (opcode) {
+        case OpCode::Cos:
+            return std::cos(operand);
+        case OpCode::Sin:
+            return std::sin(operand);
+        case OpCode::Tan:
+            return std::tan(operand);
+        case OpCode::Exp:
+            return std::exp(operand);
+        case OpCode::Log:
+            return std::log(operand);
+        case OpCode::Sqrt:
+            return std::sqrt(operand);
+        case OpCode::Abs:
+            return std::fabs(operand);
+        case OpCode::Atan:
+            return std::atan(operand);
+        default:
+            panic(
+                "Internal Error: OpCode <", static_cast<uint8_t>(opcode),
+                "> is not unary"
+            );
+    }
+}
+
+/**
+ * @brief Applies a binary operation like `Add` to its operands.
+ * @param opcode The operation.
+ * @param lhs The first operand (left hand side).
+ * @param rhs The second operand (right hand side).
+ * @return Result of the operation.
+ */
+inline auto apply_binary(OpCode opcode, Number lhs, Number rhs) -> Number {
+    switch (opcode) {
+        case OpCode::Add:
+            return lhs + rhs;
+        case OpCode::Sub:
+            return lhs - rhs;
+        case OpCode::Mul:
+            return lhs * rhs;
+        case OpCode::Div:
+            return lhs / rhs;
+        case OpCode::Less:
+            return lhs < rhs ? 1 : 0;
+        case OpCode::LessEqual:
+            return lhs <= rhs ? 1 : 0;
+        case OpCode::Greater:
+            return lhs > rhs ? 1 : 0;
+        case OpCode::GreaterEqual:
+            return lhs >= rhs ? 1 : 0;
+        case OpCode::Equal:
+            return lhs == rhs ? 1 : 0;
+        case OpCode::NotEqual:
+            return lhs != rhs ? 1 : 0;
+        case OpCode::Pow:
+            return std::pow(lhs, rhs);
+        case OpCode::Min:
+            return std::fmin(lhs, rhs);
+        case OpCode::Max:
+            return std::fmax(lhs, rhs);
+        case OpCode::Hypot:
+            return std::hypot(lhs, rhs);
+        case OpCode::Atan2:
+            return std::atan2(lhs, rhs);
+        default:
+            panic(
+                "Internal Error: OpCode <", static_cast<uint8_t>(opcode),
+                "> is not binary"
+            );
+    }
+}
 
 /**
  * @brief Evaluates a Chunk, by executing the opcodes.
+ *
+ * Chunks that passed `verify` run on a preallocated stack without any checks,
+ * all others on a growing stack with bounds checks. Calls and reductions
+ * return NaN right away once `evaluation_stopped`, callers have to check it
+ * before using the result.
+ *
  * @param chunk The Chunk to evaluate.
+ * @param environment Variables that the chunk was compiled with.
+ * @param pool Threads to evaluate reductions on, reductions run on the
+ *             calling thread without one.
  * @return Result of the calculation.
  */
-auto interpret(const Chunk& chunk) -> Number;
+auto interpret(
+    const Chunk& chunk, const Environment& environment = {},
+    ThreadPool* pool = nullptr
+) -> Number;
+
+/**
+ * @brief Position of an opcode and of the literal and operand it would consume
+ *        next, within a `Chunk`.
+ */
+struct ChunkPosition {
+    size_t opcode = 0;
+    size_t literal = 0;
+    size_t operand = 0;
+};
+
+/**
+ * @brief Evaluates a single subtree of a Chunk.
+ * @param chunk The Chunk that contains the subtree.
+ * @param start Position of the first opcode of the subtree.
+ * @param end Index after the last opcode (the root) of the subtree.
+ * @param environment Variables that the chunk was compiled with.
+ * @param pool Threads to evaluate reductions on.
+ * @return Result of the subtree.
+ */
+auto interpret_subtree(
+    const Chunk& chunk, ChunkPosition start, size_t end,
+    const Environment& environment, ThreadPool* pool = nullptr
+) -> Number;
+
+/**
+ * @brief Calls a function with arguments that have already been evaluated.
+ * @param slot Slot of the function.
+ * @param arguments Arguments in the order they are pushed (last one first).
+ * @param environment Variables and functions.
+ * @param pool Threads to evaluate reductions on.
+ * @return Result of the call.
+ */
+auto interpret_call(
+    uint32_t slot, std::span<const Number> arguments,
+    const Environment& environment, ThreadPool* pool = nullptr
+) -> Number;
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chunk.hpp"
+#include "environment.hpp"
+#include "interpret.hpp"
+
+class ThreadPool;
+
+/**
+ * @brief How lanes continue at a `JumpIfZero`.
+ */
+enum class LaneBranch {
+    /// No active lane takes the then branch, so it is skipped
+    Else,
+    /// Every active lane takes the then branch, so the else branch is skipped
+    Then,
+    /// Both branches are evaluated and blended, the then branch first
+    Both,
+};
+
+/**
+ * @brief Stack of values for evaluating the same opcodes in `LANES` lanes at
+ *        once, shared by `interpret_batch` and `interpret_reduction`.
+ *
+ * Conditionals whose condition differs between lanes evaluate both of their
+ * branches for all lanes, which are blended afterwards. Only active lanes
+ * that take the branch being evaluated call functions, so that lanes without
+ * a value and untaken branches never run them.
+ */
+template <size_t LANES>
+class LaneStack {
+   public:
+    /// Values of a single expression for all lanes
+    using Lanes = std::array<Number, LANES>;
+    /// A flag for each lane
+    using Mask = std::array<bool, LANES>;
+
+    /**
+     * @brief Empties the stack before evaluating a chunk.
+     * @param depth Values that the chunk pushes at most, they are pushed
+     *              without checking the size.
+     * @param active Lanes from the first one that hold a value, the values
+     *               of the others are meaningless.
+     */
+    void reset(size_t depth, size_t active) {
+        m_stack.resize(depth);
+        m_top = m_stack.data();
+        m_blends.clear();
+        for (size_t lane = 0; lane < LANES; lane += 1) {
+            m_active[lane] = lane < active;
+        }
+    }
+
+    void push(const Lanes& values) {
+        *m_top = values;
+        m_top += 1;
+    }
+
+    /**
+     * @brief Pushes the same value for all lanes.
+     */
+    void broadcast(Number value) {
+        m_top->fill(value);
+        m_top += 1;
+    }
+
+    auto pop() -> const Lanes& {
+        m_top -= 1;
+        return *m_top;
+    }
+
+    auto top() -> Lanes& { return m_top[-1]; }
+
+    /**
+     * @brief Lanes that hold a value and take every branch that is evaluated.
+     */
+    auto active() const -> const Mask& { return m_active; }
+
+    /**
+     * @brief Applies a binary operator to the two values on top of the
+     *        stack, with the right hand side on top.
+     *
+     * The opcode is a template parameter, so that the loop over the lanes
+     * has no branches and can be vectorized.
+     */
+    template <OpCode opcode>
+    void binary() {
+        m_top -= 1;
+        Lanes& lhs = m_top[-1];
+        const Lanes& rhs = m_top[0];
+        for (size_t lane = 0; lane < LANES; lane += 1) {
+            lhs[lane] = apply_binary(opcode, lhs[lane], rhs[lane]);
+        }
+    }
+
+    /**
+     * @brief Applies a binary operator that is only known at runtime, with
+     *        the same loop as `binary<opcode>`.
+     */
+    void binary(OpCode opcode) {
+        switch (opcode) {
+            case OpCode::Add:
+                return binary<OpCode::Add>();
+            case OpCode::Sub:
+                return binary<OpCode::Sub>();
+            case OpCode::Mul:
+                return binary<OpCode::Mul>();
+            case OpCode::Div:
+                return binary<OpCode::Div>();
+            case OpCode::Less:
+                return binary<OpCode::Less>();
+            case OpCode::LessEqual:
+                return binary<OpCode::LessEqual>();
+            case OpCode::Greater:
+                return binary<OpCode::Greater>();
+            case OpCode::GreaterEqual:
+                return binary<OpCode::GreaterEqual>();
+            case OpCode::Equal:
+                return binary<OpCode::Equal>();
+            case OpCode::NotEqual:
+                return binary<OpCode::NotEqual>();
+            case OpCode::Pow:
+                return binary<OpCode::Pow>();
+            case OpCode::Min:
+                return binary<OpCode::Min>();
+            case OpCode::Max:
+                return binary<OpCode::Max>();
+            case OpCode::Hypot:
+                return binary<OpCode::Hypot>();
+            case OpCode::Atan2:
+                return binary<OpCode::Atan2>();
+            default:
+                panic(
+                    "Internal Error: OpCode <", static_cast<uint8_t>(opcode),
+                    "> is not binary"
+                );
+        }
+    }
+
+    /**
+     * @brief Applies a unary operation to the value on top of the stack.
+     */
+    void unary(OpCode opcode) {
+        for (Number& value : m_top[-1]) {
+            value = apply_unary(opcode, value);
+        }
+    }
+
+    /**
+     * @brief Pops the condition of a `JumpIfZero` and decides which of its
+     *        branches are evaluated, only active lanes decide whether they
+     *        diverge.
+     * @param else_start Opcode that the else branch starts at.
+     */
+    auto branch(size_t else_start) -> LaneBranch {
+        const Lanes& condition = pop();
+        Blend blend{.mask = {}, .outer = m_active, .else_start = else_start};
+        size_t live = 0;
+        size_t taken = 0;
+        for (size_t lane = 0; lane < LANES; lane += 1) {
+            blend.mask[lane] = condition[lane] != 0;
+            live += m_active[lane] ? 1 : 0;
+            taken += m_active[lane] && blend.mask[lane] ? 1 : 0;
+        }
+        if (taken == 0) {
+            return LaneBranch::Else;
+        }
+        if (taken == live) {
+            return LaneBranch::Then;
+        }
+        for (size_t lane = 0; lane < LANES; lane += 1) {
+            m_active[lane] = blend.mask[lane] && m_active[lane];
+        }
+        m_blends.push_back(blend);
+        return LaneBranch::Both;
+    }
+
+    /**
+     * @brief Continues with the else branch of a blended conditional if a
+     *        `Jump` ends its then branch.
+     * @param position Opcode after the `Jump`.
+     * @param end Opcode that the `Jump` jumps to.
+     * @return Whether the `Jump` must not be taken.
+     */
+    auto enter_else(size_t position, size_t end) -> bool {
+        if (m_blends.empty() || m_blends.back().in_else ||
+            m_blends.back().else_start != position) {
+            return false;
+        }
+        Blend& blend = m_blends.back();
+        blend.end = end;
+        blend.then_values = pop();
+        blend.in_else = true;
+        for (size_t lane = 0; lane < LANES; lane += 1) {
+            m_active[lane] = !blend.mask[lane] && blend.outer[lane];
+        }
+        return true;
+    }
+
+    /**
+     * @brief Blends the branches of all conditionals that end at `position`,
+     *        with the value of their else branch on top of the stack.
+     */
+    void finish_blends(size_t position) {
+        while (!m_blends.empty() && m_blends.back().in_else &&
+               m_blends.back().end == position) {
+            const Blend& blend = m_blends.back();
+            Lanes& values = m_top[-1];
+            for (size_t lane = 0; lane < LANES; lane += 1) {
+                if (blend.mask[lane]) {
+                    values[lane] = blend.then_values[lane];
+                }
+            }
+            m_active = blend.outer;
+            m_blends.pop_back();
+        }
+    }
+
+    /**
+     * @brief Calls a function once per active lane, with the arguments on
+     *        top of the stack.
+     */
+    void call(
+        uint32_t slot, const Environment& environment, ThreadPool* pool
+    ) {
+        const uint32_t arity = environment.arity(slot);
+        Lanes* first = m_top - arity;
+        m_arguments.resize(arity);
+
+        Lanes result{};
+        for (size_t lane = 0; lane < LANES; lane += 1) {
+            if (!m_active[lane]) {
+                continue;
+            }
+            for (uint32_t i = 0; i < arity; i += 1) {
+                m_arguments[i] = first[i][lane];
+            }
+            result[lane] = interpret_call(slot, m_arguments, environment, pool);
+        }
+        *first = result;
+        m_top = first + 1;
+    }
+
+   private:
+    /**
+     * @brief A conditional whose condition differs between lanes, so both of
+     *        its branches are evaluated for all lanes and blended afterwards.
+     */
+    struct Blend {
+        /// Whether each lane takes the then branch
+        Mask mask;
+        /// Lanes that were active before the conditional
+        Mask outer;
+        /// Opcode that the else branch starts at
+        size_t else_start;
+        /// Opcode after the else branch, only known once it started
+        size_t end = 0;
+        Lanes then_values{};
+        bool in_else = false;
+    };
+
+    std::vector<Lanes> m_stack;
+    /// After the value on top of `m_stack`
+    Lanes* m_top = nullptr;
+    Mask m_active{};
+    /// Conditionals whose lanes are evaluated on both branches, innermost last
+    std::vector<Blend> m_blends;
+    /// Arguments of a single lane, reused for every call
+    std::vector<Number> m_arguments;
+};
@@ -1,8 +1,84 @@
-#include <ranges>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <optional>
 #include <vector>
 
 #include "format.hpp"
+#include "ingest.hpp"
+#include "output.hpp"
+#include "progress.hpp"
 #include "repl.hpp"
+#include "stream.hpp"
+#include "trace.hpp"
+#include "watch.hpp"
+
+/**
+ * @brief Parses a positive decimal integer.
+ * @param source String to parse.
+ * @param count Set to the parsed value on success.
+ * @return Whether the whole string was a positive integer.
+ */
+static auto parse_count(std::string_view source, size_t& count) -> bool {
+    size_t value = 0;
+    const auto [end, error] =
+        std::from_chars(source.data(), source.data() + source.size(), value);
+    if (error != std::errc() || end != source.data() + source.size() ||
+        value == 0) {
+        return false;
+    }
+    count = value;
+    return true;
+}
+
+/**
+ * @brief Parses a shard like `2/8` (the third of eight).
+ * @param source String to parse.
+ * @param shard Set to the parsed shard on success.
+ * @return Whether the whole string was a valid shard.
+ */
+static auto parse_shard(std::string_view source, Shard& shard) -> bool {
+    const size_t slash = source.find('/');
+    if (slash == std::string_view::npos) {
+        return false;
+    }
+    size_t index = 0;
+    const auto [end, error] =
+        std::from_chars(source.data(), source.data() + slash, index);
+    size_t count = 0;
+    if (error != std::errc() || end != source.data() + slash ||
+        !parse_count(source.substr(slash + 1), count) || index >= count) {
+        return false;
+    }
+    shard = Shard{.index = index, .count = count};
+    return true;
+}
+
+/**
+ * @brief Size of the input that a run will read, for the ETA of `--progress`.
+ * @param stream_path File of `--stream`, stdin is used for '-' or no path.
+ * @return Bytes left to read, or nothing if the input is not a regular file.
+ */
+static auto input_size(const std::optional<std::string>& stream_path)
+    -> std::optional<uint64_t> {
+    if (stream_path && stream_path != "-") {
+        std::error_code error;
+        const uint64_t size = std::filesystem::file_size(*stream_path, error);
+        return error ? std::nullopt : std::optional(size);
+    }
+    struct stat status {};
+    if (fstat(STDIN_FILENO, &status) != 0 || !S_ISREG(status.st_mode)) {
+        return std::nullopt;
+    }
+    const off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (offset < 0 || offset > status.st_size) {
+        return std::nullopt;
+    }
+    return static_cast<uint64_t>(status.st_size - offset);
+}
 
 auto main(int argc, char* argv[]) -> int {
     constexpr std::string_view USAGE =
@@ -14,16 +90,78 @@ auto main(int argc, char* argv[]) -> int {
         "  --plain            Only print the results of the calculation,\n"
         "                     or error messages (useful for piping)\n"
         "  --print-tokens     Print token streams\n"
-        "  --print-chunks     Print compiled chunks\n";
+        "  --print-chunks     Print compiled chunks\n"
+        "  --no-inline        Call functions instead of inlining them\n"
+        "  --no-fold          Evaluate constant subtrees every time\n"
+        "  --fold-stats       Write the opcodes of every line before and\n"
+        "                     after constant folding to stderr\n"
+        "  --derivative VAR   Also print the derivative of every result by\n"
+        "                     the variable VAR\n"
+        "  --threads N        Evaluate huge expressions on N threads\n"
+        "  --max-bytes N      Reject lines longer than N bytes\n"
+        "  --max-tokens N     Reject lines with more than N tokens\n"
+        "  --max-depth N      Reject expressions nested deeper than N\n"
+        "                     (default 4096)\n"
+        "  --max-opcodes N    Reject lines that compile to more than N\n"
+        "                     opcodes\n"
+        "  --max-time MS      Stop evaluating a line after MS milliseconds\n"
+        "  --alloc-stats      Write the heap allocations of every phase\n"
+        "                     to stderr after each line\n"
+        "  --trace FILE       Write a timeline of every phase as Chrome\n"
+        "                     trace event JSON into FILE\n"
+        "  --trace-sample N   Only trace every Nth line\n"
+        "  --stream FILE      Evaluate each line of FILE ('-' for stdin),\n"
+        "                     without buffering whole lines in memory\n"
+        "  --output-format F  Write --stream results as 'text' (default),\n"
+        "                     'ndjson' or 'f64le' (raw little endian\n"
+        "                     doubles, NaN for errors)\n"
+        "  --status FILE      Write one status byte per f64le result into\n"
+        "                     FILE (0 = ok, 1 = error)\n"
+        "  --shard K/N        Only evaluate the Kth of N parts of the\n"
+        "                     --stream FILE (K from 0), prefixing results\n"
+        "                     with their line numbers\n"
+        "  --merge FILE...    Merge the outputs of all shards in order\n"
+        "  --files PATH...    Evaluate each line of many files and all\n"
+        "                     files in directories, reading them with\n"
+        "                     io_uring\n"
+        "  --no-io-uring      Read --files on a thread pool instead\n"
+        "  --watch FILE       Evaluate a sheet of definitions and update it\n"
+        "                     whenever FILE changes\n"
+        "  --progress         Write a status line to stderr every second\n"
+        "                     while evaluating the repl, --stream or\n"
+        "                     --files (SIGUSR1 writes all counters)\n";
 
     Config config{
         .plain = false,
         .print_tokens = false,
         .print_chunks = false,
+        .inline_calls = true,
+        .fold_constants = true,
+        .fold_stats = false,
+        .threads = 1,
+        .alloc_stats = false,
+        .tracer = nullptr,
+        .progress = nullptr,
+        .derivative = {},
+        .budget = {},
     };
 
+    std::optional<std::string> stream_path;
+    std::optional<std::string> watch_path;
+    std::optional<std::string> trace_path;
+    size_t trace_sample = 1;
+    std::optional<Shard> shard;
+    std::vector<std::string> merge_paths;
+    std::vector<std::string> ingest_paths;
+    bool use_io_uring = true;
+    bool show_progress = false;
+    size_t max_time = 0;
+    OutputFormat output_format = OutputFormat::Text;
+    std::optional<std::string> status_path;
+
     const std::vector<std::string> args(argv, argv + argc);
-    for (std::string_view arg : args | std::views::drop(1)) {
+    for (size_t i = 1; i < args.size(); i += 1) {
+        std::string_view arg = args[i];
         if (arg == "-h" || arg == "--help" || arg == "-?") {
             writeln(
                 std::cout,
@@ -38,6 +176,71 @@ auto main(int argc, char* argv[]) -> int {
             config.print_tokens = true;
         } else if (arg == "--print-chunks") {
             config.print_chunks = true;
+        } else if (arg == "--no-inline") {
+            config.inline_calls = false;
+        } else if (arg == "--no-fold") {
+            config.fold_constants = false;
+        } else if (arg == "--fold-stats") {
+            config.fold_stats = true;
+        } else if (arg == "--derivative" && i + 1 < args.size()) {
+            i += 1;
+            config.derivative = args[i];
+        } else if (arg == "--alloc-stats") {
+            config.alloc_stats = true;
+        } else if (arg == "--threads" && i + 1 < args.size() &&
+                   parse_count(args[i + 1], config.threads)) {
+            i += 1;
+        } else if (arg == "--max-bytes" && i + 1 < args.size() &&
+                   parse_count(args[i + 1], config.budget.max_bytes)) {
+            i += 1;
+        } else if (arg == "--max-tokens" && i + 1 < args.size() &&
+                   parse_count(args[i + 1], config.budget.max_tokens)) {
+            i += 1;
+        } else if (arg == "--max-depth" && i + 1 < args.size() &&
+                   parse_count(args[i + 1], config.budget.max_depth)) {
+            i += 1;
+        } else if (arg == "--max-opcodes" && i + 1 < args.size() &&
+                   parse_count(args[i + 1], config.budget.max_opcodes)) {
+            i += 1;
+        } else if (arg == "--max-time" && i + 1 < args.size() &&
+                   parse_count(args[i + 1], max_time)) {
+            i += 1;
+            config.budget.max_time = std::chrono::milliseconds(max_time);
+        } else if (arg == "--stream" && i + 1 < args.size()) {
+            i += 1;
+            stream_path = args[i];
+        } else if (arg == "--watch" && i + 1 < args.size()) {
+            i += 1;
+            watch_path = args[i];
+        } else if (arg == "--trace" && i + 1 < args.size()) {
+            i += 1;
+            trace_path = args[i];
+        } else if (arg == "--trace-sample" && i + 1 < args.size() &&
+                   parse_count(args[i + 1], trace_sample)) {
+            i += 1;
+        } else if (arg == "--shard" && i + 1 < args.size() &&
+                   parse_shard(args[i + 1], shard.emplace())) {
+            i += 1;
+        } else if (arg == "--merge" && i + 1 < args.size()) {
+            merge_paths.assign(args.begin() + i + 1, args.end());
+            break;
+        } else if (arg == "--files" && i + 1 < args.size()) {
+            ingest_paths.assign(args.begin() + i + 1, args.end());
+            break;
+        } else if (arg == "--progress") {
+            show_progress = true;
+        } else if (arg == "--no-io-uring") {
+            use_io_uring = false;
+        } else if (arg.starts_with("--output-format=") &&
+                   parse_output_format(arg.substr(arg.find('=') + 1))) {
+            output_format = *parse_output_format(arg.substr(arg.find('=') + 1));
+        } else if (arg == "--output-format" && i + 1 < args.size() &&
+                   parse_output_format(args[i + 1])) {
+            i += 1;
+            output_format = *parse_output_format(args[i]);
+        } else if (arg == "--status" && i + 1 < args.size()) {
+            i += 1;
+            status_path = args[i];
         } else {
             writeln(std::cout, "Error: Invalid argument '", arg, "'\n");
             writeln(std::cout, USAGE);
@@ -45,5 +248,114 @@ auto main(int argc, char* argv[]) -> int {
         }
     }
 
+    // Only streams write results through a `ResultWriter`, everything else
+    // writes text next to other output (like definitions or file headers)
+    if ((output_format != OutputFormat::Text || status_path) && !stream_path) {
+        writeln(
+            std::cout, "Error: --output-format and --status need --stream FILE"
+        );
+        exit(-1);
+    }
+    if (status_path && output_format != OutputFormat::F64le) {
+        writeln(std::cout, "Error: --status needs --output-format f64le");
+        exit(-1);
+    }
+
+    // Created before any other thread, as it blocks SIGUSR1 for all of them.
+    // Static (like the tracer), so that the last line is written on `exit`.
+    static std::optional<Progress> progress;
+    if (show_progress && !watch_path && merge_paths.empty() && !shard) {
+        // The sizes of --files are only known once they have been opened
+        const std::optional<uint64_t> total =
+            ingest_paths.empty() ? input_size(stream_path) : std::nullopt;
+        config.progress = &progress.emplace(std::cerr, total);
+    }
+
+    // Static, so that the trace is completed when `exit` is called
+    static std::optional<Tracer> tracer;
+    if (trace_path) {
+        std::ofstream file(trace_path.value(), std::ios::binary);
+        if (!file) {
+            writeln(std::cout, "Error: Could not open '", *trace_path, "'");
+            exit(-1);
+        }
+        config.tracer = &tracer.emplace(std::move(file), trace_sample);
+    }
+
+    if (watch_path) {
+        watch(watch_path.value(), std::cout);
+    }
+
+    if (!merge_paths.empty()) {
+        std::vector<std::ifstream> files;
+        std::vector<std::istream*> shards;
+        for (const std::string& path : merge_paths) {
+            files.emplace_back(path, std::ios::binary);
+            if (!files.back()) {
+                writeln(std::cout, "Error: Could not open '", path, "'");
+                exit(-1);
+            }
+        }
+        for (std::ifstream& file : files) {
+            shards.push_back(&file);
+        }
+        if (const auto report = merge_shards(shards, std::cout)) {
+            write(std::cerr, report->format(""));
+            exit(-1);
+        }
+        return 0;
+    }
+
+    if (!ingest_paths.empty()) {
+        ingest(
+            ingest_paths, std::cout, config.threads, use_io_uring,
+            config.progress
+        );
+        return 0;
+    }
+
+    if (shard && (!stream_path || stream_path == "-")) {
+        writeln(std::cout, "Error: --shard needs a --stream FILE to seek in");
+        exit(-1);
+    }
+    if (shard && output_format != OutputFormat::Text) {
+        writeln(std::cout, "Error: --shard only supports text output");
+        exit(-1);
+    }
+
+    if (stream_path) {
+        std::ifstream file;
+        if (stream_path != "-") {
+            file.open(stream_path.value(), std::ios::binary);
+            if (!file) {
+                writeln(
+                    std::cout, "Error: Could not open '", *stream_path, "'"
+                );
+                exit(-1);
+            }
+        }
+        std::istream& in = stream_path == "-" ? std::cin : file;
+        if (shard) {
+            stream_shard(in, std::cout, shard.value(), config.tracer);
+            return 0;
+        }
+
+        std::ofstream status;
+        if (status_path) {
+            status.open(status_path.value(), std::ios::binary);
+            if (!status) {
+                writeln(
+                    std::cout, "Error: Could not open '", *status_path, "'"
+                );
+                exit(-1);
+            }
+        }
+        ResultWriter results(
+            std::cout, output_format, status_path ? &status : nullptr
+        );
+        stream(in, results, config.tracer, config.progress);
+        return 0;
+    }
+
     repl(config);
 }
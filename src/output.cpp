@@ -0,0 +1,151 @@
+#include "output.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "format.hpp"
+
+/// Significant digits of results in text, enough to parse the same double
+constexpr auto RESULT_PRECISION = std::numeric_limits<Number>::digits10 + 1;
+
+auto parse_output_format(std::string_view name)
+    -> std::optional<OutputFormat> {
+    if (name == "text") return OutputFormat::Text;
+    if (name == "f64le") return OutputFormat::F64le;
+    if (name == "ndjson") return OutputFormat::Ndjson;
+    return {};
+}
+
+ResultWriter::ResultWriter(
+    std::ostream& out, OutputFormat format, std::ostream* status, bool tagged
+)
+    : m_out(out), m_status(status), m_format(format), m_tagged(tagged) {
+    m_buffer.reserve(OUTPUT_BUFFER_SIZE);
+    if (m_status != nullptr) {
+        m_status_buffer.reserve(OUTPUT_BUFFER_SIZE);
+    }
+}
+
+ResultWriter::~ResultWriter() { flush(); }
+
+/**
+ * @brief Appends the bytes of a double in little endian order.
+ */
+static void append_f64le(std::string& out, Number value) {
+    auto bits = std::bit_cast<uint64_t>(value);
+    if constexpr (std::endian::native == std::endian::big) {
+        bits = std::byteswap(bits);
+    }
+    char bytes[sizeof(bits)];
+    std::memcpy(bytes, &bits, sizeof(bits));
+    out.append(bytes, sizeof(bytes));
+}
+
+/**
+ * @brief Appends `text` as the contents of a JSON string.
+ */
+static void append_json_string(std::string& out, std::string_view text) {
+    constexpr std::string_view HEX = "0123456789abcdef";
+    for (const char c : text) {
+        const auto byte = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (byte < 0x20) {
+            out += "\\u00";
+            out += HEX[byte >> 4];
+            out += HEX[byte & 0xf];
+        } else {
+            out += c;
+        }
+    }
+}
+
+void ResultWriter::value(size_t line, Number value) {
+    FormatBuffer buffer;
+    switch (m_format) {
+        case OutputFormat::Text:
+            if (m_tagged) format_to(m_buffer, line, "\t");
+            m_buffer += format_value(buffer, RESULT_PRECISION, value);
+            m_buffer += '\n';
+            break;
+        case OutputFormat::F64le:
+            append_f64le(m_buffer, value);
+            if (m_status != nullptr) {
+                m_status_buffer += static_cast<char>(ResultStatus::Ok);
+            }
+            break;
+        case OutputFormat::Ndjson:
+            format_to(m_buffer, "{\"line\":", line, ",\"value\":");
+            // JSON has no numbers for them
+            if (std::isnan(value)) {
+                m_buffer += "\"NaN\"";
+            } else if (std::isinf(value)) {
+                m_buffer += value > 0 ? "\"Infinity\"" : "\"-Infinity\"";
+            } else {
+                m_buffer += format_value(buffer, RESULT_PRECISION, value);
+            }
+            m_buffer += "}\n";
+            break;
+    }
+    flush_full();
+}
+
+void ResultWriter::error(size_t line, std::string_view message, size_t index) {
+    switch (m_format) {
+        case OutputFormat::Text:
+            if (m_tagged) {
+                while (!message.empty()) {
+                    const size_t end = message.find('\n') + 1;
+                    format_to(m_buffer, line, "\t");
+                    m_buffer += message.substr(0, end);
+                    message.remove_prefix(end == 0 ? message.size() : end);
+                }
+                format_to(m_buffer, line, "\t");
+            } else {
+                m_buffer += message;
+            }
+            format_to(m_buffer, "Note: At byte ", index, " of line ", line);
+            m_buffer += '\n';
+            break;
+        case OutputFormat::F64le:
+            append_f64le(m_buffer, std::numeric_limits<Number>::quiet_NaN());
+            if (m_status != nullptr) {
+                m_status_buffer += static_cast<char>(ResultStatus::Error);
+            }
+            break;
+        case OutputFormat::Ndjson:
+            if (message.ends_with('\n')) message.remove_suffix(1);
+            format_to(m_buffer, "{\"line\":", line, ",\"byte\":", index);
+            m_buffer += ",\"error\":\"";
+            append_json_string(m_buffer, message);
+            m_buffer += "\"}\n";
+            break;
+    }
+    flush_full();
+}
+
+void ResultWriter::flush_full() {
+    if (m_buffer.size() >= OUTPUT_BUFFER_SIZE ||
+        m_status_buffer.size() >= OUTPUT_BUFFER_SIZE) {
+        flush();
+    }
+}
+
+void ResultWriter::flush() {
+    m_out.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+    m_buffer.clear();
+    if (m_status != nullptr) {
+        m_status->write(
+            m_status_buffer.data(),
+            static_cast<std::streamsize>(m_status_buffer.size())
+        );
+        m_status_buffer.clear();
+        m_status->flush();
+    }
+    m_out.flush();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "chunk.hpp"
+
+/**
+ * @brief How results of batch evaluation are written.
+ */
+enum class OutputFormat : uint8_t {
+    /// One decimal result or error message per line
+    Text,
+    /// One raw little endian double per result, NaN for errors, with an
+    /// optional stream of `ResultStatus` bytes next to it
+    F64le,
+    /// One JSON object per result, with its line and value or error
+    Ndjson,
+};
+
+/**
+ * @brief Parses the name of an output format, like "f64le".
+ */
+auto parse_output_format(std::string_view name) -> std::optional<OutputFormat>;
+
+/**
+ * @brief Status byte of each result in the `OutputFormat::F64le` status
+ *        stream.
+ */
+enum class ResultStatus : uint8_t {
+    Ok = 0,
+    /// The line could not be tokenized, compiled or evaluated, its value is
+    /// NaN
+    Error = 1,
+};
+
+/// Bytes that a `ResultWriter` collects before writing them at once
+constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+/**
+ * @brief Writes one result per evaluated line in an `OutputFormat`, through
+ *        large buffers.
+ *
+ * Results are written in the order they are passed in. In binary output, the
+ * nth double and the nth status byte belong to the nth non empty line, so
+ * readers can map both files as columns.
+ */
+class ResultWriter {
+   public:
+    /**
+     * @param out Stream to write results into.
+     * @param format How results are written.
+     * @param status Stream for the status bytes of `OutputFormat::F64le`,
+     *               they are not written without one.
+     * @param tagged Prefix each text line with its line number and a tab.
+     */
+    ResultWriter(
+        std::ostream& out, OutputFormat format, std::ostream* status = nullptr,
+        bool tagged = false
+    );
+    /**
+     * @brief Writes everything that is still buffered.
+     */
+    ~ResultWriter();
+
+    ResultWriter(const ResultWriter&) = delete;
+    auto operator=(const ResultWriter&) -> ResultWriter& = delete;
+
+    /**
+     * @brief Writes the result of a line.
+     * @param line Number of the line, starting at 1.
+     * @param value The result.
+     */
+    void value(size_t line, Number value);
+
+    /**
+     * @brief Writes the error of a line.
+     * @param line Number of the line, starting at 1.
+     * @param message Formatted report, ending with a newline.
+     * @param index Byte index of the error relative to the start of the
+     *              line.
+     */
+    void error(size_t line, std::string_view message, size_t index);
+
+    /**
+     * @brief Writes everything that is buffered into the streams.
+     */
+    void flush();
+
+   private:
+    /**
+     * @brief Writes the buffers once they are full.
+     */
+    void flush_full();
+
+    std::ostream& m_out;
+    std::ostream* m_status;
+    const OutputFormat m_format;
+    const bool m_tagged;
+    std::string m_buffer;
+    std::string m_status_buffer;
+};
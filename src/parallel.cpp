@@ -0,0 +1,307 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <ranges>
+
+#include "format.hpp"
+#include "interpret.hpp"
+#include "reduction.hpp"
+
+/**
+ * @brief Amount of values an opcode pops from the stack, the arity of a
+ *        `Call` depends on the called function.
+ */
+static constexpr auto fixed_arity(OpCode opcode) -> uint32_t {
+    switch (opcode) {
+        case OpCode::Cos:
+        case OpCode::Sin:
+        case OpCode::Tan:
+        case OpCode::Exp:
+        case OpCode::Log:
+        case OpCode::Sqrt:
+        case OpCode::Abs:
+        case OpCode::Atan:
+        case OpCode::Ret:
+            return 1;
+        case OpCode::Add:
+        case OpCode::Sub:
+        case OpCode::Mul:
+        case OpCode::Div:
+        case OpCode::Less:
+        case OpCode::LessEqual:
+        case OpCode::Greater:
+        case OpCode::GreaterEqual:
+        case OpCode::Equal:
+        case OpCode::NotEqual:
+        case OpCode::Pow:
+        case OpCode::Min:
+        case OpCode::Max:
+        case OpCode::Hypot:
+        case OpCode::Atan2:
+        case OpCode::Sum:
+        case OpCode::Prod:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+/// `fixed_arity` of every opcode, looked up without branching
+static constexpr auto FIXED_ARITIES = []() {
+    std::array<uint32_t, OPCODE_COUNT> arities{};
+    for (size_t i = 0; i < arities.size(); i += 1) {
+        arities[i] = fixed_arity(static_cast<OpCode>(i));
+    }
+    return arities;
+}();
+
+auto analyze_subtrees(const Chunk& chunk, const Environment& environment)
+    -> Subtrees {
+    const size_t length = chunk.opcodes.size();
+    Subtrees subtrees;
+    subtrees.sizes.resize(length);
+    subtrees.conditionals.resize(length);
+
+    uint32_t literal_index = 0;
+    uint32_t operand_index = 0;
+
+    // `Jump`s at the end of then branches whose conditional has not ended
+    struct PendingEnd {
+        uint32_t target;
+        uint32_t jump;
+    };
+    std::vector<PendingEnd> ends;
+    // A conditional ends with the last opcode of its else branch, its subtree
+    // also contains the condition and the then branch in front of it
+    auto end_conditionals = [&](uint32_t index) {
+        while (!ends.empty() && ends.back().target == index) {
+            subtrees.sizes[index - 1] += subtrees.sizes[ends.back().jump];
+            subtrees.conditionals[index - 1] = true;
+            ends.pop_back();
+        }
+    };
+
+    for (uint32_t i = 0; i < length; i += 1) {
+        const OpCode opcode = chunk.opcodes[i];
+        end_conditionals(i);
+        if (i % SUBTREE_CHECKPOINT_INTERVAL == 0) {
+            subtrees.literal_checkpoints.push_back(literal_index);
+            subtrees.operand_checkpoints.push_back(operand_index);
+        }
+
+        uint32_t arity = opcode == OpCode::Call
+                             ? environment.arity(chunk.operands[operand_index])
+                             : FIXED_ARITIES[static_cast<uint8_t>(opcode)];
+        if (opcode == OpCode::JumpIfZero) {
+            // Covers the condition
+            arity = 1;
+        } else if (opcode == OpCode::Jump) {
+            // Covers the then branch and the `JumpIfZero` in front of it
+            arity = 2;
+            ends.push_back({i + 1 + chunk.operands[operand_index], i});
+        }
+        literal_index += opcode == OpCode::Load ? 1 : 0;
+        operand_index += opcode_operands(opcode);
+
+        // The operands are the subtrees directly in front of the opcode
+        uint32_t size = 1;
+        while (arity > 0) {
+            size += subtrees.sizes[i - size];
+            arity -= 1;
+        }
+        subtrees.sizes[i] = size;
+    }
+    end_conditionals(static_cast<uint32_t>(length));
+
+    return subtrees;
+}
+
+/**
+ * @brief Fork-join evaluation of the subtrees of a single Chunk.
+ */
+struct ParallelEvaluator {
+    const Chunk& chunk;
+    const Subtrees& subtrees;
+    const Environment& environment;
+    ThreadPool& pool;
+    size_t grain;
+
+    auto size(size_t root) const -> size_t { return subtrees.sizes[root]; }
+
+    /**
+     * @brief Position of an opcode, found by counting from the checkpoint
+     *        in front of it.
+     */
+    auto position(size_t index) const -> ChunkPosition {
+        const size_t checkpoint = index / SUBTREE_CHECKPOINT_INTERVAL;
+        ChunkPosition result{
+            .opcode = checkpoint * SUBTREE_CHECKPOINT_INTERVAL,
+            .literal = subtrees.literal_checkpoints[checkpoint],
+            .operand = subtrees.operand_checkpoints[checkpoint],
+        };
+        for (; result.opcode < index; result.opcode += 1) {
+            const OpCode opcode = chunk.opcodes[result.opcode];
+            result.literal += opcode == OpCode::Load ? 1 : 0;
+            result.operand += opcode_operands(opcode);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Operand of an opcode that has one.
+     */
+    auto operand(size_t index) const -> uint32_t {
+        return chunk.operands[position(index).operand];
+    }
+
+    /**
+     * @brief Roots of the operands of an opcode, in the order they are pushed.
+     */
+    auto children(size_t root) const -> std::vector<size_t> {
+        const OpCode opcode = chunk.opcodes[root];
+        const uint32_t arity = opcode == OpCode::Call
+                                   ? environment.arity(operand(root))
+                                   : fixed_arity(opcode);
+
+        std::vector<size_t> result(arity);
+        size_t child = root - 1;
+        for (uint32_t i = arity; i > 0; i -= 1) {
+            result[i - 1] = child;
+            child -= size(child);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Applies the opcode at `root` to the values of its operands.
+     */
+    auto combine(size_t root, std::span<const Number> values) const
+        -> Number {
+        const OpCode opcode = chunk.opcodes[root];
+        switch (opcode) {
+            case OpCode::Cos:
+            case OpCode::Sin:
+            case OpCode::Tan:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Sqrt:
+            case OpCode::Abs:
+            case OpCode::Atan:
+                return apply_unary(opcode, values[0]);
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
+            case OpCode::Div:
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Pow:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Hypot:
+            case OpCode::Atan2:
+                return apply_binary(opcode, values[0], values[1]);
+            case OpCode::Call:
+                return interpret_call(
+                    operand(root), values, environment, &pool
+                );
+            case OpCode::Sum:
+            case OpCode::Prod: {
+                const ReductionContext context{
+                    .environment = environment,
+                    .arguments = {},
+                    .indices = {},
+                    .pool = &pool,
+                };
+                return interpret_reduction(
+                    opcode, chunk.reductions[operand(root)], values[0],
+                    values[1], context
+                );
+            }
+            default:
+                panic(
+                    "Internal Error: OpCode <", static_cast<uint8_t>(opcode),
+                    "> has no operands"
+                );
+        }
+    }
+
+    auto sequential(size_t root) const -> Number {
+        const size_t start = root + 1 - size(root);
+        return interpret_subtree(
+            chunk, position(start), root + 1, environment, &pool
+        );
+    }
+
+    auto evaluate(size_t root) const -> Number {
+        // Opcodes with a single big operand are collected instead of
+        // recursing into it, long chains like `+ 1 + 1 + ...` would
+        // otherwise overflow the stack
+        struct Step {
+            size_t root;
+            size_t big;
+        };
+        std::vector<Step> spine;
+
+        size_t node = root;
+        Number value = 0;
+        while (true) {
+            // Only one branch of a conditional is evaluated, which is not
+            // worth splitting
+            if (size(node) < grain || subtrees.conditionals[node]) {
+                value = sequential(node);
+                break;
+            }
+
+            const std::vector<size_t> operands = children(node);
+            const auto big = std::ranges::count_if(operands, [&](size_t child) {
+                return size(child) >= grain;
+            });
+
+            if (big == 0) {
+                value = sequential(node);
+                break;
+            }
+            if (big == 1) {
+                const auto it = std::ranges::find_if(operands, [&](size_t c) {
+                    return size(c) >= grain;
+                });
+                spine.push_back({node, static_cast<size_t>(it - operands.begin())});
+                node = *it;
+                continue;
+            }
+
+            std::vector<Number> values(operands.size());
+            pool.for_each(0, operands.size(), [&](size_t i) {
+                values[i] = evaluate(operands[i]);
+            });
+            value = combine(node, values);
+            break;
+        }
+
+        for (const Step& step : std::views::reverse(spine)) {
+            const std::vector<size_t> operands = children(step.root);
+            std::vector<Number> values(operands.size());
+            for (size_t i = 0; i < operands.size(); i += 1) {
+                values[i] = i == step.big ? value : sequential(operands[i]);
+            }
+            value = combine(step.root, values);
+        }
+        return value;
+    }
+};
+
+auto interpret_parallel(
+    const Chunk& chunk, const Subtrees& subtrees,
+    const Environment& environment, ThreadPool& pool, size_t grain
+) -> Number {
+    if (chunk.opcodes.empty()) {
+        return interpret(chunk, environment, &pool);
+    }
+    const ParallelEvaluator evaluator{chunk, subtrees, environment, pool, grain};
+    return evaluator.evaluate(chunk.opcodes.size() - 1);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "chunk.hpp"
+#include "environment.hpp"
+#include "pool.hpp"
+
+/// Subtrees with fewer opcodes are evaluated on a single thread
+constexpr size_t PARALLEL_GRAIN = 1 << 14;
+
+/// Opcodes between two checkpoints of the literal and operand indices
+constexpr size_t SUBTREE_CHECKPOINT_INTERVAL = 256;
+
+/**
+ * @brief Shape of the expression tree of a `Chunk`, computed once after it
+ *        has been compiled.
+ */
+struct Subtrees {
+    /// Amount of opcodes in the subtree that ends with each opcode
+    std::vector<uint32_t> sizes;
+    /// Whether the subtree that ends with each opcode is a whole conditional
+    /// (which ends with the last opcode of its else branch)
+    std::vector<bool> conditionals;
+    /// Amount of literals before every `SUBTREE_CHECKPOINT_INTERVAL`th opcode
+    std::vector<uint32_t> literal_checkpoints;
+    /// Amount of operands before every `SUBTREE_CHECKPOINT_INTERVAL`th opcode
+    std::vector<uint32_t> operand_checkpoints;
+};
+
+/**
+ * @brief Computes the size of every subtree of a Chunk.
+ * @param chunk The Chunk.
+ * @param environment Functions that the chunk was compiled with.
+ * @return Sizes and starts of all subtrees.
+ */
+auto analyze_subtrees(const Chunk& chunk, const Environment& environment)
+    -> Subtrees;
+
+/**
+ * @brief Evaluates a Chunk, by evaluating independent subtrees with at least
+ *        `grain` opcodes as separate tasks.
+ *
+ * Every operation is applied to the same operands as in `interpret`, so the
+ * result is bit identical.
+ *
+ * @param chunk The Chunk to evaluate.
+ * @param subtrees Result of `analyze_subtrees` for the chunk.
+ * @param environment Variables that the chunk was compiled with.
+ * @param pool Threads to evaluate the subtrees on.
+ * @param grain Size of the smallest subtree that becomes a task.
+ * @return Result of the calculation.
+ */
+auto interpret_parallel(
+    const Chunk& chunk, const Subtrees& subtrees,
+    const Environment& environment, ThreadPool& pool,
+    size_t grain = PARALLEL_GRAIN
+) -> Number;
@@ -0,0 +1,107 @@
+#include "pool.hpp"
+
+/// Pool and queue index of the current thread, if it is a worker
+static thread_local const ThreadPool* t_pool = nullptr;
+static thread_local size_t t_index = 0;
+
+ThreadPool::ThreadPool(size_t threads) {
+    const size_t count = threads == 0 ? 1 : threads;
+    for (size_t i = 0; i < count; i += 1) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+    // The thread that waits for tasks uses queue 0
+    for (size_t i = 1; i < count; i += 1) {
+        m_threads.emplace_back([this, i]() { work(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+auto ThreadPool::queue_index() const -> size_t {
+    return t_pool == this ? t_index : 0;
+}
+
+void ThreadPool::push(Task& task) {
+    Queue& queue = *m_queues[queue_index()];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(&task);
+    }
+    m_queued.fetch_add(1, std::memory_order_release);
+    if (m_threads.empty()) {
+        return;
+    }
+    // Sleeping threads check `m_queued` while holding the lock,
+    // so taking it here makes sure the notification is not lost
+    { std::lock_guard lock(m_sleep_mutex); }
+    m_wake.notify_one();
+}
+
+auto ThreadPool::find_task() -> Task* {
+    if (m_queued.load(std::memory_order_acquire) == 0) {
+        return nullptr;
+    }
+
+    const size_t own = queue_index();
+    {
+        Queue& queue = *m_queues[own];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            Task* task = queue.tasks.back();
+            queue.tasks.pop_back();
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+
+    for (size_t offset = 1; offset < m_queues.size(); offset += 1) {
+        Queue& queue = *m_queues[(own + offset) % m_queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            Task* task = queue.tasks.front();
+            queue.tasks.pop_front();
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::wait(Task& task) {
+    while (!task.done()) {
+        if (Task* other = find_task()) {
+            other->execute();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::work(size_t index) {
+    t_pool = this;
+    t_index = index;
+
+    while (true) {
+        if (Task* task = find_task()) {
+            task->execute();
+            continue;
+        }
+
+        std::unique_lock lock(m_sleep_mutex);
+        m_wake.wait(lock, [this]() {
+            return m_stop || m_queued.load(std::memory_order_acquire) > 0;
+        });
+        if (m_stop) {
+            return;
+        }
+    }
+}
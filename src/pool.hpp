@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work stealing thread pool for fork-join parallelism.
+ *
+ * Every thread owns a queue of tasks. New tasks are pushed onto the queue of
+ * the thread that forked them and popped from the same end (newest first),
+ * idle threads steal from the other end (oldest first), which are usually
+ * the biggest pieces of work. A thread waiting for a task keeps executing
+ * other tasks instead of blocking.
+ */
+class ThreadPool {
+   public:
+    /**
+     * @param threads Amount of threads that execute tasks, including the
+     *                thread that waits for them (at least 1).
+     */
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    /**
+     * @brief Amount of threads that execute tasks.
+     */
+    auto size() const -> size_t { return m_queues.size(); }
+
+    /**
+     * @brief Runs two functions, possibly in parallel.
+     * @param first Executed on the calling thread.
+     * @param second May be stolen by another thread.
+     */
+    template <typename First, typename Second>
+    void join(First&& first, Second&& second) {
+        Task task(second);
+        push(task);
+        first();
+        wait(task);
+    }
+
+    /**
+     * @brief Calls `function(index)` for every index in [begin, end),
+     *        possibly in parallel.
+     */
+    template <typename Function>
+    void for_each(size_t begin, size_t end, const Function& function) {
+        if (end - begin > 1) {
+            const size_t middle = begin + (end - begin) / 2;
+            join(
+                [&]() { for_each(begin, middle, function); },
+                [&]() { for_each(middle, end, function); }
+            );
+        } else if (begin < end) {
+            function(begin);
+        }
+    }
+
+   private:
+    /**
+     * @brief Type erased reference to a function that lives on the stack of
+     *        the thread that forked it.
+     */
+    struct Task {
+        template <typename Function>
+        explicit Task(Function& function)
+            : m_function(const_cast<void*>(static_cast<const void*>(&function))),
+              m_call([](void* function) {
+                  (*static_cast<Function*>(function))();
+              }) {}
+
+        void execute() {
+            m_call(m_function);
+            m_done.store(true, std::memory_order_release);
+        }
+        auto done() const -> bool {
+            return m_done.load(std::memory_order_acquire);
+        }
+
+       private:
+        void* m_function;
+        void (*m_call)(void*);
+        std::atomic<bool> m_done = false;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    void push(Task& task);
+    /**
+     * @brief Executes other tasks until `task` is done.
+     */
+    void wait(Task& task);
+    /**
+     * @brief Pops the newest task of the own queue, or steals the oldest
+     *        task of another queue.
+     */
+    auto find_task() -> Task*;
+    void work(size_t index);
+    /**
+     * @brief Index of the queue owned by the calling thread, threads outside
+     *        of the pool share the queue at index 0.
+     */
+    auto queue_index() const -> size_t;
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    /// Amount of tasks in all queues
+    std::atomic<size_t> m_queued = 0;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+};
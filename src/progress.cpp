@@ -0,0 +1,210 @@
+#include "progress.hpp"
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <string>
+
+#include "format.hpp"
+
+/**
+ * @brief Set of signals that only contains SIGUSR1.
+ */
+static auto usr1_signals() -> sigset_t {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    return signals;
+}
+
+Progress::Progress(std::ostream& out, std::optional<uint64_t> total)
+    : m_out(out), m_total(total), m_start(std::chrono::steady_clock::now()) {
+    // Inherited by the reporter and every thread that is started later
+    const sigset_t signals = usr1_signals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    m_reporter = std::thread([this]() { report_loop(); });
+}
+
+Progress::~Progress() {
+    m_stop.store(true, std::memory_order_release);
+    // Wakes the reporter, which is the only thread waiting for the signal
+    pthread_kill(m_reporter.native_handle(), SIGUSR1);
+    m_reporter.join();
+    write_status("Done", sample(), Sample{.time = m_start});
+}
+
+auto Progress::sample() const -> Sample {
+    return Sample{
+        .time = std::chrono::steady_clock::now(),
+        .lines = m_lines.load(std::memory_order_relaxed),
+        .bytes = m_bytes.load(std::memory_order_relaxed),
+        .errors = m_errors.load(std::memory_order_relaxed),
+        .batched = m_batched.load(std::memory_order_relaxed),
+        .grouped = m_grouped.load(std::memory_order_relaxed),
+    };
+}
+
+/**
+ * @brief Seconds between two points in time.
+ */
+static auto seconds(
+    std::chrono::steady_clock::time_point from,
+    std::chrono::steady_clock::time_point to
+) -> double {
+    return std::chrono::duration<double>(to - from).count();
+}
+
+/**
+ * @brief Appends an amount per second, rounded to an integer.
+ */
+static void format_rate(std::string& out, uint64_t amount, double seconds) {
+    const double rate = seconds > 0 ? static_cast<double>(amount) / seconds : 0;
+    format_to(out, static_cast<uint64_t>(rate + 0.5));
+}
+
+/**
+ * @brief Appends a ratio as a percentage with one decimal.
+ */
+static void format_percent(std::string& out, uint64_t part, uint64_t whole) {
+    const uint64_t permille = whole > 0 ? part * 1000 / whole : 1000;
+    format_to(out, permille / 10, ".", permille % 10, "%");
+}
+
+/**
+ * @brief Appends bytes as MiB with one decimal.
+ */
+static void format_mebibytes(std::string& out, uint64_t bytes) {
+    constexpr uint64_t MEBIBYTE = 1 << 20;
+    format_to(
+        out, bytes / MEBIBYTE, ".", bytes % MEBIBYTE * 10 / MEBIBYTE, " MiB"
+    );
+}
+
+/**
+ * @brief Appends a duration like "1h02m03s".
+ */
+static void format_duration(std::string& out, uint64_t seconds) {
+    const uint64_t hours = seconds / 3600;
+    const uint64_t minutes = seconds / 60 % 60;
+    seconds %= 60;
+    if (hours > 0) {
+        format_to(out, hours, "h", minutes < 10 ? "0" : "");
+    }
+    if (hours > 0 || minutes > 0) {
+        format_to(out, minutes, "m", seconds < 10 ? "0" : "");
+    }
+    format_to(out, seconds, "s");
+}
+
+/**
+ * @brief Appends the expected remaining time, assuming the average
+ *        throughput so far stays the same.
+ */
+static void format_eta(
+    std::string& out, uint64_t bytes, uint64_t total, double elapsed
+) {
+    if (bytes == 0) {
+        out += "unknown";
+        return;
+    }
+    const double remaining = static_cast<double>(total - bytes) * elapsed /
+                             static_cast<double>(bytes);
+    format_duration(out, static_cast<uint64_t>(remaining + 0.5));
+}
+
+void Progress::write_status(
+    std::string_view label, const Sample& now, const Sample& previous
+) {
+    const double elapsed = seconds(m_start, now.time);
+    std::string line;
+    format_to(
+        line, label, ": ", now.lines, " lines, ", now.errors, " errors, "
+    );
+    format_mebibytes(line, now.bytes);
+    line += ", ";
+    format_rate(
+        line, now.lines - previous.lines, seconds(previous.time, now.time)
+    );
+    line += " lines/s (average ";
+    format_rate(line, now.lines, elapsed);
+    line += " lines/s)";
+    if (now.batched > 0) {
+        line += ", ";
+        format_percent(line, now.grouped, now.batched);
+        line += " grouped";
+    }
+    if (m_total && now.bytes < *m_total) {
+        line += ", ";
+        format_percent(line, now.bytes, *m_total);
+        line += ", ETA ";
+        format_eta(line, now.bytes, *m_total, elapsed);
+    }
+    writeln(m_out, line);
+}
+
+void Progress::write_snapshot(const Sample& now, const Sample& previous) {
+    const double elapsed = seconds(m_start, now.time);
+    const double interval = seconds(previous.time, now.time);
+    const auto milliseconds = static_cast<uint64_t>(elapsed * 1000);
+    std::string text;
+    format_to(
+        text, "Progress after ", milliseconds / 1000, ".",
+        milliseconds % 1000 / 100, " s:\n  lines    ", now.lines,
+        "\n  errors   ", now.errors, "\n  bytes    ", now.bytes
+    );
+    if (m_total) {
+        format_to(text, " of ", *m_total, " (");
+        format_percent(text, now.bytes, *m_total);
+        text += ")";
+    }
+    text += "\n  lines/s  ";
+    format_rate(text, now.lines - previous.lines, interval);
+    text += " now, ";
+    format_rate(text, now.lines, elapsed);
+    text += " average\n  bytes/s  ";
+    format_rate(text, now.bytes - previous.bytes, interval);
+    text += " now, ";
+    format_rate(text, now.bytes, elapsed);
+    text += " average\n";
+    if (now.batched > 0) {
+        format_to(text, "  grouped  ", now.grouped, " of ", now.batched, " (");
+        format_percent(text, now.grouped, now.batched);
+        text += ")\n";
+    }
+    if (m_total && now.bytes < *m_total) {
+        text += "  ETA      ";
+        format_eta(text, now.bytes, *m_total, elapsed);
+        text += '\n';
+    }
+    write(m_out, text);
+    m_out.flush();
+}
+
+void Progress::report_loop() {
+    const sigset_t signals = usr1_signals();
+    Sample previous{.time = m_start};
+    auto next = m_start + PROGRESS_INTERVAL;
+
+    while (!m_stop.load(std::memory_order_acquire)) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= next) {
+            const Sample current = sample();
+            write_status("Progress", current, previous);
+            previous = current;
+            next = now + PROGRESS_INTERVAL;
+            continue;
+        }
+
+        const auto wait =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(next - now);
+        const timespec timeout{
+            .tv_sec = static_cast<time_t>(wait.count() / 1'000'000'000),
+            .tv_nsec = static_cast<long>(wait.count() % 1'000'000'000),
+        };
+        // Times out (or is interrupted) without a signal most of the time
+        if (sigtimedwait(&signals, nullptr, &timeout) == SIGUSR1 &&
+            !m_stop.load(std::memory_order_acquire)) {
+            write_snapshot(sample(), previous);
+        }
+    }
+}
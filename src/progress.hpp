@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <thread>
+
+/// How often `Progress` writes a status line
+constexpr auto PROGRESS_INTERVAL = std::chrono::seconds(1);
+
+/**
+ * @brief Counts the lines, bytes and errors of a long batch run and reports
+ *        them on stderr while it is running.
+ *
+ * Counters are relaxed atomics that evaluating threads add to without any
+ * locks, usually once per block or file instead of once per line. A reporter
+ * thread reads them every `PROGRESS_INTERVAL` and writes a status line with
+ * the current and average throughput (and an ETA if the size of the input is
+ * known), as well as the share of lines that were evaluated in lanes if
+ * there were batches. Sending SIGUSR1 to the process writes a full snapshot
+ * of all counters right away.
+ *
+ * SIGUSR1 is blocked in the thread that creates the `Progress` and in all
+ * threads started after it, only the reporter waits for it.
+ */
+class Progress {
+   public:
+    /**
+     * @pre No other thread has been started yet, otherwise SIGUSR1 might be
+     *      delivered to a thread that does not block it (and terminate the
+     *      process).
+     * @param out Stream to write status lines into.
+     * @param total Size of the whole input in bytes, if it is known.
+     */
+    Progress(std::ostream& out, std::optional<uint64_t> total);
+    /**
+     * @brief Stops the reporter and writes a final status line.
+     */
+    ~Progress();
+
+    Progress(const Progress&) = delete;
+    auto operator=(const Progress&) -> Progress& = delete;
+
+    /**
+     * @brief Counts processed input, may be called from any thread.
+     * @param lines Lines that were evaluated (including empty ones).
+     * @param bytes Bytes of input that were consumed.
+     * @param errors Lines that resulted in an error.
+     */
+    void add(uint64_t lines, uint64_t bytes, uint64_t errors) {
+        m_lines.fetch_add(lines, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        m_errors.fetch_add(errors, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Counts lines that were evaluated in batches of the same shape,
+     *        may be called from any thread.
+     * @param lines Lines that were passed to `interpret_batch`.
+     * @param grouped Those of them that were evaluated in lanes.
+     */
+    void add_batch(uint64_t lines, uint64_t grouped) {
+        m_batched.fetch_add(lines, std::memory_order_relaxed);
+        m_grouped.fetch_add(grouped, std::memory_order_relaxed);
+    }
+
+   private:
+    /**
+     * @brief Values of all counters at one point in time.
+     */
+    struct Sample {
+        std::chrono::steady_clock::time_point time;
+        uint64_t lines = 0;
+        uint64_t bytes = 0;
+        uint64_t errors = 0;
+        uint64_t batched = 0;
+        uint64_t grouped = 0;
+    };
+
+    auto sample() const -> Sample;
+    /**
+     * @brief Writes a single status line.
+     * @param label Start of the line.
+     * @param now Current counters.
+     * @param previous Counters of the last status line, for the current
+     *                 throughput.
+     */
+    void write_status(
+        std::string_view label, const Sample& now, const Sample& previous
+    );
+    /**
+     * @brief Writes every counter and rate on its own line.
+     */
+    void write_snapshot(const Sample& now, const Sample& previous);
+    void report_loop();
+
+    std::ostream& m_out;
+    const std::optional<uint64_t> m_total;
+    const std::chrono::steady_clock::time_point m_start;
+    std::atomic<uint64_t> m_lines{0};
+    std::atomic<uint64_t> m_bytes{0};
+    std::atomic<uint64_t> m_errors{0};
+    std::atomic<uint64_t> m_batched{0};
+    std::atomic<uint64_t> m_grouped{0};
+    std::atomic<bool> m_stop{false};
+    std::thread m_reporter;
+};
@@ -0,0 +1,330 @@
+#include "reduction.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "budget.hpp"
+#include "format.hpp"
+#include "interpret.hpp"
+#include "lanes.hpp"
+#include "pool.hpp"
+
+using Lanes = LaneStack<REDUCTION_LANES>::Lanes;
+
+/**
+ * @brief Evaluates the body of a reduction for `REDUCTION_LANES` indices at
+ *        once.
+ */
+struct LaneEvaluator {
+    LaneEvaluator(const Chunk& body, const ReductionContext& context)
+        : m_body(body), m_context(context) {}
+
+    /**
+     * @brief Evaluates the body for the index of every lane.
+     *
+     * Nested reductions and calls are only evaluated for active lanes that
+     * take the branch they are in, so that indices past the end of a block
+     * and untaken branches never run them.
+     *
+     * @param index Value of the index in each lane.
+     * @param active Lanes from the first one that hold an index of the
+     *               reduction, the values of the others are meaningless.
+     * @return Value of the body in each lane.
+     */
+    auto evaluate(const Lanes& index, size_t active) -> Lanes {
+        const Environment& environment = m_context.environment;
+        const size_t level = m_context.indices.size();
+        size_t opcode_index = 0;
+        size_t literal_index = 0;
+        size_t operand_index = 0;
+        // Bodies are verified without limits, but no opcode pushes more
+        // than one value
+        m_lanes.reset(m_body.opcodes.size(), active);
+
+        auto next_operand = [&]() -> uint32_t {
+            const uint32_t operand = m_body.operands.at(operand_index);
+            operand_index += 1;
+            return operand;
+        };
+        auto jump = [&]() {
+            opcode_index += m_body.operands.at(operand_index);
+            literal_index += m_body.operands.at(operand_index + 1);
+            operand_index += JUMP_OPERANDS +
+                             m_body.operands.at(operand_index + 2);
+        };
+
+        while (true) {
+            m_lanes.finish_blends(opcode_index);
+            if (opcode_index == m_body.opcodes.size()) {
+                break;
+            }
+            const OpCode opcode = m_body.opcodes[opcode_index];
+            opcode_index += 1;
+
+            switch (opcode) {
+                case OpCode::Load:
+                    m_lanes.broadcast(m_body.literals.at(literal_index));
+                    literal_index += 1;
+                    break;
+                case OpCode::Variable:
+                    m_lanes.broadcast(environment.values.at(next_operand()));
+                    break;
+                case OpCode::LoadArg: {
+                    const uint32_t argument = next_operand();
+                    const size_t arity = m_context.arguments.size();
+                    if (argument >= arity) {
+                        panic(
+                            "Internal Error: Unknown argument <", argument, ">"
+                        );
+                    }
+                    m_lanes.broadcast(m_context.arguments[argument]);
+                    break;
+                }
+                case OpCode::Index: {
+                    const uint32_t index_level = next_operand();
+                    if (index_level == level) {
+                        m_lanes.push(index);
+                    } else if (index_level < level) {
+                        m_lanes.broadcast(m_context.indices[index_level]);
+                    } else {
+                        panic(
+                            "Internal Error: Unknown index <", index_level, ">"
+                        );
+                    }
+                    break;
+                }
+                case OpCode::Add:
+                case OpCode::Sub:
+                case OpCode::Mul:
+                case OpCode::Div:
+                case OpCode::Less:
+                case OpCode::LessEqual:
+                case OpCode::Greater:
+                case OpCode::GreaterEqual:
+                case OpCode::Equal:
+                case OpCode::NotEqual:
+                case OpCode::Pow:
+                case OpCode::Min:
+                case OpCode::Max:
+                case OpCode::Hypot:
+                case OpCode::Atan2:
+                    m_lanes.binary(opcode);
+                    break;
+                case OpCode::Cos:
+                case OpCode::Sin:
+                case OpCode::Tan:
+                case OpCode::Exp:
+                case OpCode::Log:
+                case OpCode::Sqrt:
+                case OpCode::Abs:
+                case OpCode::Atan:
+                    m_lanes.unary(opcode);
+                    break;
+                case OpCode::Call:
+                    m_lanes.call(next_operand(), environment, m_context.pool);
+                    break;
+                case OpCode::Sum:
+                case OpCode::Prod:
+                    reduce(opcode, m_body.reductions.at(next_operand()), index);
+                    break;
+                case OpCode::JumpIfZero: {
+                    const size_t else_start =
+                        opcode_index + m_body.operands.at(operand_index);
+                    if (m_lanes.branch(else_start) == LaneBranch::Else) {
+                        jump();
+                    } else {
+                        operand_index += JUMP_OPERANDS;
+                    }
+                    break;
+                }
+                case OpCode::Jump: {
+                    // The end of the then branch of a blended conditional
+                    // continues with its else branch instead of skipping it
+                    const size_t end =
+                        opcode_index + m_body.operands.at(operand_index);
+                    if (m_lanes.enter_else(opcode_index, end)) {
+                        operand_index += JUMP_OPERANDS;
+                    } else {
+                        jump();
+                    }
+                    break;
+                }
+                default:
+                    panic(
+                        "Internal Error: OpCode <",
+                        static_cast<uint8_t>(opcode),
+                        "> is not allowed in a reduction"
+                    );
+            }
+        }
+
+        return m_lanes.top();
+    }
+
+   private:
+    /**
+     * @brief Evaluates a nested reduction once per active lane, with its
+     *        bounds on top of the stack.
+     */
+    void reduce(OpCode opcode, const Chunk& body, const Lanes& index) {
+        const Lanes hi = m_lanes.pop();
+        Lanes& result = m_lanes.top();
+
+        // The nested body may refer to the index of this one
+        m_indices.assign(m_context.indices.begin(), m_context.indices.end());
+        m_indices.push_back(0);
+        for (size_t lane = 0; lane < REDUCTION_LANES; lane += 1) {
+            if (!m_lanes.active()[lane]) {
+                result[lane] = 0;
+                continue;
+            }
+            m_indices.back() = index[lane];
+            const ReductionContext context{
+                .environment = m_context.environment,
+                .arguments = m_context.arguments,
+                .indices = m_indices,
+                .pool = m_context.pool,
+            };
+            result[lane] = interpret_reduction(
+                opcode, body, result[lane], hi[lane], context
+            );
+        }
+    }
+
+    const Chunk& m_body;
+    const ReductionContext& m_context;
+    LaneStack<REDUCTION_LANES> m_lanes;
+    /// Indices of nested reductions, reused for every lane
+    std::vector<Number> m_indices;
+};
+
+/**
+ * @brief Adds or multiplies two partial results.
+ */
+static auto combine(OpCode opcode, Number lhs, Number rhs) -> Number {
+    return opcode == OpCode::Sum ? lhs + rhs : lhs * rhs;
+}
+
+/**
+ * @brief Combines the lanes of a block pairwise.
+ */
+static auto combine_lanes(OpCode opcode, const Lanes& lanes) -> Number {
+    Lanes values = lanes;
+    for (size_t width = REDUCTION_LANES / 2; width > 0; width /= 2) {
+        for (size_t lane = 0; lane < width; lane += 1) {
+            values[lane] =
+                combine(opcode, values[2 * lane], values[2 * lane + 1]);
+        }
+    }
+    return values[0];
+}
+
+/**
+ * @brief Splits the indices of a reduction into blocks.
+ */
+struct BlockReduction {
+    OpCode opcode;
+    const Chunk& body;
+    Number lo;
+    size_t length;
+    const ReductionContext& context;
+
+    /**
+     * @brief Reduces all indices of a single block.
+     */
+    auto block(size_t index) const -> Number {
+        const bool is_sum = opcode == OpCode::Sum;
+        const Number identity = is_sum ? 0 : 1;
+        const size_t begin = index * REDUCTION_BLOCK;
+        const size_t end = std::min(begin + REDUCTION_BLOCK, length);
+
+        LaneEvaluator evaluator(body, context);
+        Lanes result;
+        result.fill(identity);
+        // Low order bits lost by the sum of each lane
+        Lanes compensation{};
+
+        for (size_t first = begin; first < end; first += REDUCTION_LANES) {
+            if (evaluation_stopped()) {
+                return NAN;
+            }
+            Lanes indices;
+            for (size_t lane = 0; lane < REDUCTION_LANES; lane += 1) {
+                indices[lane] = lo + static_cast<Number>(first + lane);
+            }
+            const size_t active = std::min(REDUCTION_LANES, end - first);
+            Lanes values = evaluator.evaluate(indices, active);
+
+            // Lanes after the end of the block must not change the result
+            std::fill(values.begin() + active, values.end(), identity);
+
+            if (is_sum) {
+                for (size_t lane = 0; lane < REDUCTION_LANES; lane += 1) {
+                    kahan_add(result[lane], compensation[lane], values[lane]);
+                }
+            } else {
+                for (size_t lane = 0; lane < REDUCTION_LANES; lane += 1) {
+                    result[lane] *= values[lane];
+                }
+            }
+        }
+
+        if (is_sum) {
+            for (size_t lane = 0; lane < REDUCTION_LANES; lane += 1) {
+                result[lane] -= compensation[lane];
+            }
+        }
+        return combine_lanes(opcode, result);
+    }
+
+    /**
+     * @brief Reduces the blocks in [first, last), by splitting them in half
+     *        until only single blocks are left.
+     */
+    auto blocks(size_t first, size_t last) const -> Number {
+        // Skips the remaining blocks all at once
+        if (evaluation_stopped()) {
+            return NAN;
+        }
+        if (last - first == 1) {
+            return block(first);
+        }
+
+        const size_t middle = first + (last - first) / 2;
+        Number lhs = 0;
+        Number rhs = 0;
+        auto left = [&]() { lhs = blocks(first, middle); };
+        auto right = [&]() { rhs = blocks(middle, last); };
+        if (context.pool != nullptr) {
+            context.pool->join(left, right);
+        } else {
+            left();
+            right();
+        }
+        return combine(opcode, lhs, rhs);
+    }
+};
+
+auto interpret_reduction(
+    OpCode opcode, const Chunk& body, Number lo, Number hi,
+    const ReductionContext& context
+) -> Number {
+    if (!std::isfinite(lo) || !std::isfinite(hi)) {
+        return NAN;
+    }
+    if (hi < lo) {
+        return opcode == OpCode::Sum ? 0 : 1;
+    }
+    const Number span = std::floor(hi - lo);
+    if (!(span < MAX_REDUCTION_LENGTH)) {
+        return NAN;
+    }
+
+    const size_t length = static_cast<size_t>(span) + 1;
+    const BlockReduction reduction{opcode, body, lo, length, context};
+    return reduction.blocks(
+        0, (length + REDUCTION_BLOCK - 1) / REDUCTION_BLOCK
+    );
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cmath>
+#include <span>
+
+#include "chunk.hpp"
+#include "environment.hpp"
+
+class ThreadPool;
+
+/// Indices that the body of a reduction is evaluated for at once, every
+/// operation is applied to all of them in a loop that can be vectorized
+constexpr size_t REDUCTION_LANES = 8;
+
+/// Indices that are reduced by a single task
+constexpr size_t REDUCTION_BLOCK = 1024;
+
+/// Ranges with more indices contain integers that can not be represented
+constexpr Number MAX_REDUCTION_LENGTH = 9007199254740992.0;
+
+/**
+ * @brief Everything the body of a reduction may refer to, besides its own
+ *        index.
+ */
+struct ReductionContext {
+    const Environment& environment;
+    /// Arguments of the function that contains the reduction, in the order
+    /// they were pushed
+    std::span<const Number> arguments;
+    /// Indices of all enclosing reductions, outermost first
+    std::span<const Number> indices;
+    /// Threads to evaluate the blocks on, nothing to evaluate them on the
+    /// calling thread
+    ThreadPool* pool;
+};
+
+/**
+ * @brief Adds a term to a sum with Kahan summation.
+ *
+ * Sums that are not finite are not compensated, as their compensation would
+ * be NaN (`inf - inf`) and turn every later sum into NaN.
+ *
+ * @param sum The sum to add the term to.
+ * @param compensation Low order bits that the sum lost so far.
+ * @param term The term to add.
+ */
+inline void kahan_add(Number& sum, Number& compensation, Number term) {
+    const Number value = term - compensation;
+    const Number next = sum + value;
+    compensation = std::isfinite(next) ? (next - sum) - value : 0;
+    sum = next;
+}
+
+/**
+ * @brief Evaluates a `Sum` or `Prod`, by evaluating its body for every index
+ *        from `lo` up to `hi` (in steps of 1).
+ *
+ * The indices are split into blocks of `REDUCTION_BLOCK`, which are reduced
+ * one lane at a time (sums with Kahan summation) and then combined pairwise.
+ * Neither depends on how the blocks are distributed over threads, so the
+ * result is always bit identical.
+ *
+ * Empty ranges result in 0 for sums and 1 for products, non finite bounds and
+ * ranges with more than 2^53 indices (which can not all be represented) in
+ * NaN.
+ *
+ * @param opcode `OpCode::Sum` or `OpCode::Prod`.
+ * @param body Body of the reduction, from `Chunk::reductions`.
+ * @param lo First index.
+ * @param hi Upper bound of the indices.
+ * @param context Arguments, enclosing indices and threads.
+ * @return Sum or product of all values of the body.
+ */
+auto interpret_reduction(
+    OpCode opcode, const Chunk& body, Number lo, Number hi,
+    const ReductionContext& context
+) -> Number;
@@ -1,25 +1,41 @@
 #include "repl.hpp"
 
+#include <unistd.h>
+
 #include <algorithm>
 #include <iomanip>
 #include <istream>
 #include <iterator>
 #include <ostream>
 
+#include "alloc_stats.hpp"
+#include "budget.hpp"
 #include "compile.hpp"
+#include "compile_parallel.hpp"
+#include "dual.hpp"
+#include "environment.hpp"
+#include "fold.hpp"
 #include "format.hpp"
+#include "inliner.hpp"
 #include "interpret.hpp"
+#include "parallel.hpp"
+#include "progress.hpp"
 #include "report.hpp"
 #include "tokenize.hpp"
+#include "trace.hpp"
+#include "verify.hpp"
 
 constexpr std::string_view INDENT = "    ";
 
 constexpr std::string_view HELP =
     ":help, :?      Print command help\n"
     ":examples      Print expression examples\n"
-    ":quit, :exit   Exit calculator (or press CTRL+C)\n"
+    ":quit, :exit   Exit calculator (or press CTRL+C while idle,\n"
+    "               which cancels the current line otherwise)\n"
     ":tokens        Toggle printing token streams\n"
-    ":chunks        Toggle printing compiled chunks\n";
+    ":chunks        Toggle printing compiled chunks\n"
+    ":derivative X  Also print the derivative of results by variable X\n"
+    "               (without X to stop)\n";
 
 constexpr std::string_view EXAMPLES =
     " ╭── Addition\n"
@@ -45,6 +61,18 @@ constexpr std::string_view EXAMPLES =
     " │  0\n"
     " │  >> cos 0\n"
     " │  1\n"
+    " │  >> sqrt 2\n"
+    " │  1.414213562373095\n"
+    " │  >> atan2 1 0\n"
+    " │  1.570796326794897\n"
+    "─╯\n"
+    " ╭── Variables\n"
+    " │  >> let r = 2\n"
+    " │  r = 2\n"
+    " │  >> * * r r pi\n"
+    " │  12.56637061435917\n"
+    " │  >> let r2 = * r r\n"
+    " │  r2 = 4\n"
     "─╯\n"
     " ╭── Constants\n"
     " │  >> pi\n"
@@ -55,6 +83,18 @@ constexpr std::string_view EXAMPLES =
     " │  6.283185307179586\n"
     " │  >> cos * 2 π\n"
     " │  1\n"
+    "─╯\n"
+    " ╭── Sums and products\n"
+    " │  >> sum i 1 100 i\n"
+    " │  5050\n"
+    " │  >> prod i 1 5 i\n"
+    " │  120\n"
+    "─╯\n"
+    " ╭── Conditionals\n"
+    " │  >> < 1 2\n"
+    " │  1\n"
+    " │  >> ? < 1 2 10 20\n"
+    " │  10\n"
     "─╯\n";
 
 /**
@@ -82,6 +122,14 @@ static void run_command(
         config.print_chunks = !config.print_chunks;
         return;
     }
+    if (name == "derivative" || name.starts_with("derivative ")) {
+        name.remove_prefix(std::string_view("derivative").size());
+        const size_t start = name.find_first_not_of(' ');
+        config.derivative = start == std::string_view::npos
+                                ? std::string_view()
+                                : name.substr(start);
+        return;
+    }
     if (name == "quit" || name == "exit") {
         exit(0);
     }
@@ -124,10 +172,11 @@ static auto get_input(std::istream& in, std::string& line) -> InputEnd {
  * @param source The input string used to generate the tokens.
  */
 static void print_tokens(
-    std::ostream& out, const std::vector<Token>& tokens, std::string_view source
+    std::ostream& out, const TokenBuffer& tokens, std::string_view source
 ) {
     writeln(out, "Tokens:");
-    for (const auto& token : tokens) {
+    for (size_t i = 0; i < tokens.size(); i += 1) {
+        const Token token = tokens[i];
         writeln(
             out, INDENT, token.name(), "[", token.source(source), "] ",
             token.span.debug()
@@ -139,19 +188,80 @@ static void print_tokens(
  * @brief Formats and prints a `Chunk` for debugging in the repl.
  * @param out Stream to write to.
  * @param chunk The `Chunk` to be printed.
+ * @param indent Prefix of every line, grows for the bodies of reductions.
  */
-static void print_chunk(std::ostream& out, const Chunk& chunk) {
-    writeln(out, "OpCodes:");
+static void print_chunk(
+    std::ostream& out, const Chunk& chunk, const std::string& indent = ""
+) {
+    writeln(out, indent, "OpCodes:");
     for (size_t i = 0; i < chunk.opcodes.size(); i += 1) {
-        writeln(out, INDENT, "[", i, "] ", opcode_to_string(chunk.opcodes[i]));
+        writeln(
+            out, indent, INDENT, "[", i, "] ",
+            opcode_to_string(chunk.opcodes[i])
+        );
     }
 
-    writeln(out, "Literals:");
+    writeln(out, indent, "Literals:");
     for (size_t i = 0; i < chunk.literals.size(); i += 1) {
-        writeln(out, INDENT, "[", i, "] ", chunk.literals[i]);
+        writeln(out, indent, INDENT, "[", i, "] ", chunk.literals[i]);
+    }
+
+    if (!chunk.operands.empty()) {
+        writeln(out, indent, "Operands:");
+        for (size_t i = 0; i < chunk.operands.size(); i += 1) {
+            writeln(out, indent, INDENT, "[", i, "] ", chunk.operands[i]);
+        }
+    }
+
+    if (!chunk.reductions.empty()) {
+        writeln(out, indent, "Reductions:");
+        const std::string nested = concat(indent, INDENT, INDENT);
+        for (size_t i = 0; i < chunk.reductions.size(); i += 1) {
+            writeln(out, indent, INDENT, "[", i, "]");
+            print_chunk(out, chunk.reductions[i], nested);
+        }
     }
 }
 
+/**
+ * @brief Checks whether a variable or function may be (re)defined.
+ *
+ * Variables may be redefined, but functions can not, as other functions
+ * might have already inlined them. Variables can also not be turned into
+ * functions, as existing code expects them to be variables.
+ *
+ * @param environment The current environment.
+ * @param name Name of the new definition.
+ * @param arity Amount of parameters of the new definition.
+ * @param span Span of the name in the input.
+ * @return A `Report` if the definition is not allowed.
+ */
+static auto validate_redefinition(
+    const Environment& environment, std::string_view name, uint32_t arity,
+    Span span
+) -> std::optional<Report> {
+    const auto slot = environment.find(name);
+    if (!slot) {
+        return {};
+    }
+    if (environment.arity(slot.value()) > 0) {
+        return Report{
+            .kind = ReportKind::Error,
+            .message = concat("Function <", name, "> is already defined"),
+            .spans = {span},
+            .comments = {{ReportKind::Note, "Functions can not be redefined"}}
+        };
+    }
+    if (arity > 0) {
+        return Report{
+            .kind = ReportKind::Error,
+            .message = concat("<", name, "> is already defined as variable"),
+            .spans = {span}
+        };
+    }
+    return {};
+}
+
 [[noreturn]]
 void repl(Config config) {
     std::ostream& out = std::cout;
@@ -159,25 +269,89 @@ void repl(Config config) {
     out.precision(max_precision);
 
     bool pretty = !config.plain;
+    const Budget& budget = config.budget;
+    Environment environment;
+    std::optional<ThreadPool> pool;
+    if (config.threads > 1) {
+        pool.emplace(config.threads);
+    }
+    // Only expressions that can be split into several tasks are worth the
+    // analysis of their subtrees, reductions use the threads either way
+    auto evaluate = [&](const Chunk& chunk) -> Number {
+        if (pool && chunk.opcodes.size() >= 2 * PARALLEL_GRAIN) {
+            const Subtrees subtrees = analyze_subtrees(chunk, environment);
+            return interpret_parallel(chunk, subtrees, environment, *pool);
+        }
+        return interpret(chunk, environment, pool ? &*pool : nullptr);
+    };
     std::string line;
     std::string without_whitespace;
+    // Reports are formatted into the same buffer, to not allocate for each
+    std::string message;
+
+    // Allocations are attributed to the phase of the pipeline they happen in
+    // and written to stderr after every line, so that results stay unchanged.
+    // The phases of sampled lines are traced as well.
+    size_t line_number = 0;
+    bool traced = false;
+    // Whether the current line resulted in an error, for `--progress`
+    bool failed = false;
+    auto phase = [&](AllocPhase phase) {
+        if (config.alloc_stats) set_alloc_phase(phase);
+        if (traced) config.tracer->begin(alloc_phase_name(phase), line_number);
+    };
+    auto finish_line = [&]() {
+        end_evaluation();
+        if (traced) config.tracer->end();
+        if (config.progress && line_number > 0) {
+            config.progress->add(1, line.size() + 1, failed ? 1 : 0);
+            failed = false;
+        }
+        if (!config.alloc_stats || line_number == 0) return;
+        set_alloc_phase(AllocPhase::None);
+        write_alloc_stats(
+            std::cerr, concat("line ", line_number), take_alloc_stats()
+        );
+    };
+    if (config.alloc_stats) {
+        std::atexit([]() {
+            write_alloc_stats(std::cerr, "all lines", alloc_stats_total());
+        });
+    }
+
+    // Writes a report about the current line, which failed
+    auto write_report = [&](const Report& report, std::string_view source) {
+        phase(AllocPhase::Report);
+        message.clear();
+        report.format_to(message, source);
+        phase(AllocPhase::Output);
+        write(out, message);
+        failed = true;
+    };
 
     if (pretty) {
         writeln(out, "Welcome to tiny-calc!\nType ':help' if you are lost =)");
     }
+    if (isatty(STDIN_FILENO)) {
+        cancel_on_interrupt();
+    }
 
     while (true) {
+        finish_line();
         if (pretty) {
             write(out, ">> ");
             out.flush();
         }
 
+        traced = config.tracer && config.tracer->sampled(line_number + 1);
+        if (traced) config.tracer->begin("get_input", line_number + 1);
         if (get_input(std::cin, line) == InputEnd::Eof) {
             if (pretty) {
                 write(out, "CTRL+D");
             }
             exit(0);
         }
+        line_number += 1;
 
         // Skip empty lines
         without_whitespace.clear();
@@ -192,46 +366,183 @@ void repl(Config config) {
 
         // Execute repl command (like :help or :tokens)
         if (line.at(0) == ':') {
-            run_command(out, config, line.substr(1));
+            phase(AllocPhase::Output);
+            run_command(out, config, std::string_view(line).substr(1));
             continue;
         }
 
-        std::vector<Token> tokens = tokenize(line);
-        {
-            if (config.print_tokens) {
-                print_tokens(out, tokens, line);
-            }
+        // Everything up to the result counts towards the time limit (and may
+        // be cancelled), overlong lines are not even tokenized
+        begin_evaluation(budget.max_time);
+        if (line.size() > budget.max_bytes) {
+            write_report(
+                budget_report(budget.max_bytes, "bytes", "--max-bytes", {}), ""
+            );
+            continue;
+        }
 
-            std::vector<Span> error_spans;
-            for (const Token& token : tokens) {
-                if (token.kind == TokenKind::Error) {
-                    error_spans.push_back(token.span);
-                }
+        // Tokens are only materialized when they have to be printed or
+        // the line is large enough to be tokenized and compiled on several
+        // threads, otherwise the compiler pulls them lazily from a
+        // `TokenCursor` (and tokenizing is counted as part of compiling)
+        std::optional<TokenBuffer> tokens;
+        const bool parallel_tokens =
+            pool && line.size() >= 2 * PARALLEL_TOKENIZE_GRAIN;
+        if (config.print_tokens || parallel_tokens) {
+            phase(AllocPhase::Tokenize);
+            auto maybe_tokens = parallel_tokens
+                                    ? tokenize_parallel(line, budget, *pool)
+                                    : tokenize(line, budget);
+            if (!maybe_tokens.has_value()) {
+                write_report(maybe_tokens.error(), line);
+                continue;
             }
-            if (!error_spans.empty()) {
-                Report report{
-                    .kind = ReportKind::Error,
-                    .message = error_spans.size() > 1 ? "Invalid Tokens"
-                                                      : "Invalid Token",
-                    .spans = error_spans
-                };
-                write(out, report.format(""));
+            tokens.emplace(std::move(maybe_tokens.value()));
+        }
+        if (config.print_tokens) {
+            phase(AllocPhase::Output);
+            print_tokens(out, *tokens, line);
+        }
+        phase(AllocPhase::Compile);
+        auto maybe_statement =
+            parallel_tokens
+                ? compile_statement_parallel(
+                      *tokens, line, environment, *pool, budget
+                  )
+            : tokens ? Compiler::compile_statement(
+                           *tokens, line, environment, budget
+                       )
+                     : Compiler::compile_statement(
+                           TokenCursor(line), line, environment, budget
+                       );
+        {
+            // Compilation always fails on invalid tokens, so they only have
+            // to be searched for once it did (in the materialized tokens, if
+            // there are any)
+            if (!maybe_statement.has_value()) {
+                phase(AllocPhase::Report);
+                const auto report = tokens ? invalid_tokens_report(*tokens)
+                                           : invalid_tokens_report(line);
+                message.clear();
+                if (report) {
+                    report->format_to(message, "");
+                } else {
+                    maybe_statement.error().format_to(message, line);
+                }
+                phase(AllocPhase::Output);
+                write(out, message);
+                failed = true;
                 continue;
             }
         }
 
-        auto maybe_chunk = Compiler::compile(tokens, line);
-        {
-            if (!maybe_chunk.has_value()) {
-                write(out, maybe_chunk.error().format(line));
+        Statement& statement = maybe_statement.value();
+        std::optional<Chunk> inlined;
+        Chunk& unfolded =
+            config.inline_calls
+                ? inlined.emplace(inline_calls(
+                      statement.chunk, environment,
+                      std::min(budget.max_opcodes, MAX_INLINED_OPCODES)
+                  ))
+                : statement.chunk;
+        std::optional<Chunk> folded =
+            config.fold_constants ? fold_constants(unfolded, environment)
+                                  : std::nullopt;
+        Chunk& chunk = folded ? *folded : unfolded;
+        if (config.fold_stats) {
+            phase(AllocPhase::Output);
+            writeln(
+                std::cerr, "Opcodes of line ", line_number, ": ",
+                count_opcodes(unfolded), " -> ", count_opcodes(chunk),
+                " after folding"
+            );
+            phase(AllocPhase::Compile);
+        }
+        if (config.print_chunks) {
+            phase(AllocPhase::Output);
+            print_chunk(out, chunk);
+            phase(AllocPhase::Compile);
+        }
+
+        // The compiler only counts the opcodes it emits, inlining adds more
+        if (count_opcodes(chunk) > budget.max_opcodes) {
+            write_report(
+                budget_report(
+                    budget.max_opcodes, "opcodes", "--max-opcodes", {}
+                ),
+                ""
+            );
+            continue;
+        }
+
+        // Verified chunks are executed without any runtime checks
+        const auto arity = static_cast<uint32_t>(statement.parameters.size());
+        if (const auto report = verify(chunk, environment, arity)) {
+            write_report(*report, "");
+            continue;
+        }
+        // Folding evaluates constant reductions, which stop early as well
+        if (const auto report = stopped_report(budget)) {
+            write_report(*report, "");
+            continue;
+        }
+
+        if (const auto definition = statement.definition) {
+            std::string_view name = definition->source(line);
+            if (const auto report = validate_redefinition(
+                    environment, name, arity, definition.value()
+                )) {
+                write_report(*report, line);
                 continue;
             }
-            if (config.print_chunks) {
-                print_chunk(out, maybe_chunk.value());
+
+            if (arity > 0) {
+                const uint32_t slot = environment.define(name, arity);
+                environment.bodies[slot].emplace(chunk);
+                phase(AllocPhase::Output);
+                writeln(
+                    out, name, " = <function with ", arity, " parameters>"
+                );
+                continue;
             }
+
+            // Variables are only (re)defined once their value is known, so
+            // that a cancelled definition leaves them unchanged
+            phase(AllocPhase::Interpret);
+            const Number value = evaluate(chunk);
+            if (const auto report = stopped_report(budget)) {
+                write_report(*report, "");
+                continue;
+            }
+            const uint32_t slot = environment.define(name, arity);
+            environment.values[slot] = value;
+            phase(AllocPhase::Output);
+            writeln(out, name, " = ", value);
+            continue;
         }
 
-        Number result = interpret(maybe_chunk.value());
+        phase(AllocPhase::Interpret);
+        Number result = evaluate(chunk);
+        if (const auto report = stopped_report(budget)) {
+            write_report(*report, "");
+            continue;
+        }
+        phase(AllocPhase::Output);
         writeln(out, result);
+
+        // Variables that do not exist can not change the result
+        if (!config.derivative.empty()) {
+            const auto slot = environment.find(config.derivative);
+            phase(AllocPhase::Interpret);
+            const Number derivative =
+                slot ? interpret_dual(chunk, environment, *slot).derivative
+                     : 0;
+            if (const auto report = stopped_report(budget)) {
+                write_report(*report, "");
+                continue;
+            }
+            phase(AllocPhase::Output);
+            writeln(out, "d/d", config.derivative, " = ", derivative);
+        }
     }
 }
@@ -1,5 +1,13 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
+
+#include "budget.hpp"
+
+class Progress;
+class Tracer;
+
 /**
  * @brief Global settings for formatting and debug information.
  */
@@ -7,6 +15,25 @@ struct Config {
     bool plain;
     bool print_tokens;
     bool print_chunks;
+    /// Replace calls of small functions with their bodies
+    bool inline_calls;
+    /// Replace subtrees that do not depend on variables with their values
+    bool fold_constants;
+    /// Write the opcodes of each line before and after folding to stderr
+    bool fold_stats;
+    /// Threads used to evaluate huge expressions (1 = sequential)
+    size_t threads;
+    /// Write the allocations of each phase to stderr after every line
+    bool alloc_stats;
+    /// Records the phases of sampled lines, if set
+    Tracer* tracer;
+    /// Counts evaluated lines, bytes and errors, if set
+    Progress* progress;
+    /// Variable to also print the derivative of every result by, if not
+    /// empty
+    std::string derivative;
+    /// Limits of every line
+    Budget budget;
 };
 
 /**
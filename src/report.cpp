@@ -16,22 +16,6 @@ auto Span::source(std::string_view source) const -> std::string_view {
     return std::string_view(source.substr(start, length));
 }
 
-/**
- * @brief Repeats `value`.
- * @param value The string to repeat.
- * @param times How often it should be repeated.
- * @return A new string.
- */
-static auto repeat_string(std::string_view value, uint32_t times)
-    -> std::string {
-    std::string result;
-    result.reserve(value.size() * times);
-    for (uint32_t i = 0; i < times; i += 1) {
-        result.append(value);
-    }
-    return result;
-}
-
 /**
  * @brief The row and column of an index in a string.
  *
@@ -61,29 +45,17 @@ static auto row_colum(std::string_view source, size_t index)
 }
 
 /**
- * @brief Write and format a string and its spans.
+ * @brief Format a string and its spans.
  *
  * Underlines spans in the string and wraps it in a block.
  *
- * @param out The stream to write into.
+ * @param out The string to append to.
  * @param source The string to be underlined.
  * @param spans Spans that point to substrings in `source`.
  */
-static void write_source_block(
-    std::ostream& out, std::string_view source, std::span<const Span> spans
+static void format_source_block(
+    std::string& out, std::string_view source, std::span<const Span> spans
 ) {
-    std::string underlines(utf8::width(source), ' ');
-
-    for (Span span : spans) {
-        size_t width_start = utf8::width(Span(0, span.start).source(source));
-        size_t width_span = utf8::width(span.source(source));
-
-        underlines.replace(
-            width_start, span.length,
-            repeat_string("^", std::max(width_span, (size_t)1))
-        );
-    }
-
     // smallest start index of all spans
     size_t min_start = source.size();
     for (Span span : spans) {
@@ -91,17 +63,26 @@ static void write_source_block(
     }
     const auto [row, column] = row_colum(source, min_start);
 
-    writeln(out, " ╭──[repl:", row, ":", column, "]");
-    writeln(out, " │  ", source);
-    writeln(out, "─╯  ", underlines);
+    ::format_to(out, " ╭──[repl:", row, ":", column, "]\n");
+    ::format_to(out, " │  ", source, "\n");
+    ::format_to(out, "─╯  ");
+
+    // The underlines are written in place, after the last line
+    const size_t underlines = out.size();
+    out.append(utf8::width(source), ' ');
+    for (Span span : spans) {
+        size_t width_start = utf8::width(Span(0, span.start).source(source));
+        size_t width_span = utf8::width(span.source(source));
+
+        out.replace(
+            underlines + width_start, span.length,
+            std::max(width_span, (size_t)1), '^'
+        );
+    }
+    out.push_back('\n');
 }
 
-/**
- * @brief Display name of a `ReportKind`.
- * @param kind The `ReportKind`
- * @return The name.
- */
-static auto report_kind_to_string(ReportKind kind) -> std::string_view {
+auto report_kind_to_string(ReportKind kind) -> std::string_view {
     switch (kind) {
         case ReportKind::Error:
             return "Error";
@@ -118,14 +99,20 @@ static auto report_kind_to_string(ReportKind kind) -> std::string_view {
 }
 
 std::string Report::format(std::string_view source) const {
-    std::stringstream out;
+    std::string out;
+    format_to(out, source);
+    return out;
+}
 
-    writeln(out, report_kind_to_string(kind), ": ", message);
-    if (!source.empty()) write_source_block(out, source, spans);
+void Report::format_to(std::string& out, std::string_view source) const {
+    format_report_to(out, kind, message);
+    // Reports about the whole line (like its length) have nothing to
+    // underline
+    if (!source.empty() && !spans.empty()) {
+        format_source_block(out, source, spans);
+    }
 
     for (auto& [kind, message] : comments) {
-        writeln(out, report_kind_to_string(kind), ": ", message);
+        format_report_to(out, kind, message);
     }
-
-    return out.str();
 }
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 
+#include "format.hpp"
 #include "utf8.hpp"
 
 /**
@@ -41,6 +42,30 @@ enum class ReportKind {
     Note,
 };
 
+/**
+ * @brief Display name of a `ReportKind`.
+ * @param kind The `ReportKind`
+ * @return The name.
+ */
+auto report_kind_to_string(ReportKind kind) -> std::string_view;
+
+/**
+ * @brief Appends a message formatted like a `Report` without spans and
+ *        comments, without having to create one.
+ *
+ * Used for frequent errors, to avoid allocating their message.
+ *
+ * @param out The string to append to.
+ * @param kind The category of the message.
+ * @param ...message The message parts, @see `format_value`.
+ */
+template <typename... Args>
+inline void format_report_to(
+    std::string& out, ReportKind kind, const Args&... message
+) {
+    format_to(out, report_kind_to_string(kind), ": ", message..., '\n');
+}
+
 /**
  * @brief A message, often associated with location in the input string.
  */
@@ -53,8 +78,22 @@ struct Report {
     /**
      * @brief Formats the report message and underlines the part of input that
      *        its span it points to.
+     *
+     * The input is only shown if there is at least one span.
+     *
      * @param source The input that used to generate this `Span`.
      * @pre @see `Span::source`
      */
     std::string format(std::string_view source) const;
+
+    /**
+     * @brief Appends the formatted report to `out`, @see `format`.
+     *
+     * Does not allocate if `out` has enough capacity left, so a string that is
+     * reused for every report stops allocating after the first few.
+     *
+     * @param out The string to append to.
+     * @param source The input that used to generate this `Span`.
+     */
+    void format_to(std::string& out, std::string_view source) const;
 };
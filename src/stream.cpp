@@ -0,0 +1,509 @@
+#include "stream.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <expected>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "compile.hpp"
+#include "format.hpp"
+#include "interpret.hpp"
+#include "output.hpp"
+#include "progress.hpp"
+#include "report.hpp"
+#include "tokenize.hpp"
+#include "trace.hpp"
+
+/// Amount of bytes read from the input at once
+constexpr size_t BLOCK_SIZE = 1 << 20;
+
+/**
+ * @brief Evaluates a single prefix expression, one token at a time.
+ *
+ * Produces the same results and error messages as compiling and interpreting
+ * the whole line would.
+ */
+struct Reducer {
+    /**
+     * @brief Consumes the next token of the current line.
+     * @param token The token to consume, its span points into `source`.
+     * @param source String the token was tokenized from.
+     * @param offset Index of `source` relative to the start of the line.
+     */
+    void feed(const Token& token, std::string_view source, size_t offset);
+
+    /**
+     * @brief Writes the result or error of the current line and resets the
+     *        reducer for the next one.
+     *
+     * Nothing gets written for lines without any tokens.
+     *
+     * @param results Where the result or error is written.
+     * @param line Number of the current line, used in error messages.
+     * @return Whether the line resulted in an error.
+     */
+    auto finish(ResultWriter& results, size_t line) -> bool;
+
+   private:
+    /**
+     * @brief An operator that is still waiting for its operands.
+     *
+     * Conditionals are `OpCode::JumpIfZero` with three operands. Both of their
+     * branches are evaluated (there are no side effects), only one is kept.
+     */
+    struct Pending {
+        OpCode opcode;
+        /// How many operands are still missing
+        uint8_t missing;
+        /// Whether the operator only takes a single operand
+        bool unary = false;
+        /// First operand of binary operators, condition of conditionals
+        Number lhs = 0;
+        /// Then branch of conditionals
+        Number then = 0;
+    };
+
+    /**
+     * @brief Hands a value to the innermost pending operator and applies all
+     *        operators that are complete afterwards.
+     * @param value The evaluated operand.
+     */
+    void push_value(Number value);
+
+    /**
+     * @brief Remembers the first error of the line.
+     * @param report Explains what went wrong.
+     * @param index Byte index relative to the start of the line.
+     */
+    void fail(const Report& report, size_t index);
+
+    /**
+     * @brief Remembers the first error of the line, without creating a
+     *        `Report` for it.
+     * @param index Byte index relative to the start of the line.
+     * @param ...message The message parts, @see `format_value`.
+     */
+    template <typename... Args>
+    void fail(size_t index, const Args&... message) {
+        format_report_to(m_error, ReportKind::Error, message...);
+        m_error_index = index;
+    }
+
+    std::vector<Pending> m_pending;
+    std::optional<Number> m_result;
+    /// Formatted error of the current line, empty if there is none. Reused
+    /// for every line, so that malformed lines do not allocate
+    std::string m_error;
+    size_t m_error_index = 0;
+    size_t m_invalid_tokens = 0;
+    size_t m_first_invalid_index = 0;
+    bool m_empty = true;
+    /// Index after the last character of the last token
+    size_t m_end = 0;
+};
+
+void Reducer::feed(const Token& token, std::string_view source, size_t offset) {
+    const size_t index = offset + token.span.start;
+    m_empty = false;
+    m_end = index + token.span.length;
+
+    // Invalid tokens take precedence over all other errors,
+    // so they have to be counted even after the first error
+    if (token.kind == TokenKind::Error) {
+        if (m_invalid_tokens == 0) m_first_invalid_index = index;
+        m_invalid_tokens += 1;
+        return;
+    }
+    if (!m_error.empty() || m_invalid_tokens > 0) {
+        return;
+    }
+
+    if (m_result) {
+        return fail(
+            index, "Excpected <EndOfInput> found <", token.name(), ">"
+        );
+    }
+
+    if (token.kind == TokenKind::Number) {
+        const auto maybe_number = parse_number(token.span, source);
+        if (!maybe_number.has_value()) {
+            return fail(maybe_number.error(), index);
+        }
+        return push_value(maybe_number.value());
+    }
+
+    if (token.kind == TokenKind::Identifier) {
+        std::string_view ident = token.source(source);
+
+        if (const auto builtin = find_builtin(ident)) {
+            if (builtin->opcode == OpCode::Load) {
+                return push_value(builtin->value);
+            }
+            // Their bodies have to be evaluated many times, which is not
+            // possible while consuming one token at a time
+            if (builtin->opcode == OpCode::Sum ||
+                builtin->opcode == OpCode::Prod) {
+                return fail(index, "<", ident, "> can not be streamed");
+            }
+            m_pending.push_back({
+                .opcode = builtin->opcode,
+                .missing = static_cast<uint8_t>(builtin->arity),
+                .unary = builtin->arity == 1,
+            });
+            return;
+        }
+
+        return fail(index, "Unknown function or constant <", ident, ">");
+    }
+
+    if (const auto maybe_opcode = token_kind_to_binary_op(token.kind)) {
+        m_pending.push_back({.opcode = maybe_opcode.value(), .missing = 2});
+        return;
+    }
+
+    if (token.kind == TokenKind::Question) {
+        m_pending.push_back({.opcode = OpCode::JumpIfZero, .missing = 3});
+        return;
+    }
+
+    fail(index, "Expected expression, found <", token.name(), ">");
+}
+
+void Reducer::push_value(Number value) {
+    while (!m_pending.empty()) {
+        Pending& pending = m_pending.back();
+        if (pending.missing == 3 ||
+            (pending.missing == 2 && pending.opcode != OpCode::JumpIfZero)) {
+            pending.lhs = value;
+            pending.missing -= 1;
+            return;
+        }
+        if (pending.missing == 2) {
+            pending.then = value;
+            pending.missing = 1;
+            return;
+        }
+
+        if (pending.unary) {
+            value = apply_unary(pending.opcode, value);
+        } else if (pending.opcode == OpCode::JumpIfZero) {
+            value = pending.lhs != 0 ? pending.then : value;
+        } else {
+            value = apply_binary(pending.opcode, pending.lhs, value);
+        }
+        m_pending.pop_back();
+    }
+
+    m_result = value;
+}
+
+void Reducer::fail(const Report& report, size_t index) {
+    report.format_to(m_error, "");
+    m_error_index = index;
+}
+
+auto Reducer::finish(ResultWriter& results, size_t line) -> bool {
+    bool failed = true;
+    if (m_empty) {
+        failed = false;
+        // Skip empty lines
+    } else if (m_invalid_tokens > 0) {
+        // Replaces any other error of the line
+        m_error.clear();
+        fail(
+            m_first_invalid_index,
+            m_invalid_tokens > 1 ? "Invalid Tokens" : "Invalid Token"
+        );
+        results.error(line, m_error, m_error_index);
+    } else if (!m_error.empty()) {
+        results.error(line, m_error, m_error_index);
+    } else if (!m_result) {
+        fail(m_end, "Expected expression, found <EndOfInput>");
+        results.error(line, m_error, m_error_index);
+    } else {
+        results.value(line, m_result.value());
+        failed = false;
+    }
+
+    m_pending.clear();
+    m_result.reset();
+    m_error.clear();
+    m_invalid_tokens = 0;
+    m_empty = true;
+    m_end = 0;
+    return failed;
+}
+
+/**
+ * @brief Evaluates the lines of the next `length` bytes of `in`.
+ * @param in Stream to read expressions from.
+ * @param results Where results and error messages are written.
+ * @param length Amount of bytes to read at most.
+ * @param line Number of the first line.
+ * @param tracer Records reading and evaluating sampled blocks, if set.
+ * @param progress Counts lines, bytes and errors once per block, if set.
+ */
+static void stream_lines(
+    std::istream& in, ResultWriter& results, size_t length, size_t line,
+    Tracer* tracer, Progress* progress
+) {
+    Reducer reducer;
+    // Index of the next byte relative to the start of the current line
+    size_t line_offset = 0;
+    // Finished since the last block was counted
+    uint64_t lines = 0;
+    uint64_t errors = 0;
+
+    // Feeds all tokens of `piece` into the reducer, `piece` has to start and
+    // end at token boundaries
+    auto process = [&](std::string_view piece) {
+        while (true) {
+            const size_t newline = piece.find('\n');
+            std::string_view part = piece.substr(0, newline);
+
+            TokenCursor cursor(part);
+            while (const auto token = cursor.next()) {
+                reducer.feed(token.value(), part, line_offset);
+            }
+            if (newline == std::string_view::npos) {
+                line_offset += part.size();
+                return;
+            }
+
+            errors += reducer.finish(results, line) ? 1 : 0;
+            lines += 1;
+            line += 1;
+            line_offset = 0;
+            piece = piece.substr(newline + 1);
+        }
+    };
+
+    auto is_space = [](char c) {
+        return std::isspace(static_cast<unsigned char>(c)) != 0;
+    };
+
+    std::vector<char> block(BLOCK_SIZE);
+    // Bytes after the last whitespace of the previous blocks,
+    // which might be the start of a token that continues in the next block
+    std::string carry;
+
+    // Tokenizing, reducing and writing are interleaved, so whole blocks are
+    // traced instead of phases of single lines
+    size_t block_number = 0;
+    bool traced = false;
+    while (in && length > 0) {
+        block_number += 1;
+        traced = tracer && tracer->sampled(block_number);
+        if (traced) tracer->begin("read", block_number);
+        in.read(
+            block.data(),
+            static_cast<std::streamsize>(std::min(block.size(), length))
+        );
+        if (traced) tracer->begin("evaluate", block_number);
+        std::string_view data(block.data(), static_cast<size_t>(in.gcount()));
+        length -= data.size();
+        if (progress) {
+            progress->add(lines, data.size(), errors);
+            lines = 0;
+            errors = 0;
+        }
+
+        // Tokens never span whitespace, so everything before the first
+        // whitespace completes the carried over token
+        const auto first_space = std::ranges::find_if(data, is_space);
+        const size_t first_index = first_space - data.begin();
+        carry.append(data.substr(0, first_index));
+        if (first_space == data.end()) {
+            continue;
+        }
+        process(carry);
+        data = data.substr(first_index);
+
+        const auto last_space = std::ranges::find_if(
+            data.rbegin(), data.rend(), is_space
+        );
+        const size_t end_index = data.rend() - last_space;
+        process(data.substr(0, end_index));
+        carry.assign(data.substr(end_index));
+        if (traced) tracer->end();
+    }
+
+    process(carry);
+    // Only a last line without a newline counts as a line
+    lines += line_offset > 0 ? 1 : 0;
+    errors += reducer.finish(results, line) ? 1 : 0;
+    if (progress) progress->add(lines, 0, errors);
+    results.flush();
+}
+
+void stream(
+    std::istream& in, ResultWriter& results, Tracer* tracer,
+    Progress* progress
+) {
+    stream_lines(
+        in, results, std::numeric_limits<size_t>::max(), 1, tracer, progress
+    );
+}
+
+void stream(std::istream& in, std::ostream& out, Tracer* tracer) {
+    ResultWriter results(out, OutputFormat::Text);
+    stream(in, results, tracer);
+}
+
+/**
+ * @brief Index after the first newline at or after `position - 1`, so that
+ *        a line starting exactly at `position` is not skipped.
+ * @param in Stream to search in, its position is changed.
+ * @param position Byte index to start at.
+ * @param size Size of the whole input.
+ * @param block Buffer to read into.
+ * @return Start of the first line that starts at or after `position`.
+ */
+static auto next_line_start(
+    std::istream& in, size_t position, size_t size, std::vector<char>& block
+) -> size_t {
+    if (position == 0 || position >= size) {
+        return std::min(position, size);
+    }
+    size_t start = position - 1;
+    in.seekg(static_cast<std::streamoff>(start));
+    while (in && start < size) {
+        in.read(block.data(), static_cast<std::streamsize>(block.size()));
+        const std::string_view data(
+            block.data(), static_cast<size_t>(in.gcount())
+        );
+        const size_t newline = data.find('\n');
+        if (newline != std::string_view::npos) {
+            in.clear();
+            return start + newline + 1;
+        }
+        start += data.size();
+    }
+    in.clear();
+    return size;
+}
+
+/**
+ * @brief Amount of newlines in the first `length` bytes of `in`.
+ */
+static auto count_lines(
+    std::istream& in, size_t length, std::vector<char>& block
+) -> size_t {
+    in.seekg(0);
+    size_t lines = 0;
+    while (length > 0 && in) {
+        in.read(
+            block.data(),
+            static_cast<std::streamsize>(std::min(block.size(), length))
+        );
+        const auto read = static_cast<size_t>(in.gcount());
+        lines += static_cast<size_t>(
+            std::count(block.data(), block.data() + read, '\n')
+        );
+        length -= read;
+    }
+    in.clear();
+    return lines;
+}
+
+void stream_shard(
+    std::istream& in, std::ostream& out, Shard shard, Tracer* tracer
+) {
+    in.seekg(0, std::ios::end);
+    const auto size = static_cast<size_t>(in.tellg());
+
+    std::vector<char> block(BLOCK_SIZE);
+    // The end of each shard is the start of the next one
+    auto boundary = [&](size_t index) {
+        return next_line_start(in, size * index / shard.count, size, block);
+    };
+    const size_t begin = boundary(shard.index);
+    const size_t end = boundary(shard.index + 1);
+    const size_t line = 1 + count_lines(in, begin, block);
+
+    in.seekg(static_cast<std::streamoff>(begin));
+    ResultWriter results(out, OutputFormat::Text, nullptr, true);
+    stream_lines(in, results, end - begin, line, tracer, nullptr);
+}
+
+/**
+ * @brief The current line of a shard in `merge_shards`.
+ */
+struct ShardCursor {
+    std::istream* in;
+    std::string line;
+    /// Line number of the tag of `line`
+    size_t number = 0;
+
+    /**
+     * @brief Reads the next line and its tag.
+     * @return Whether there was a line, or a report if it has no tag.
+     */
+    auto next() -> std::expected<bool, Report> {
+        if (!std::getline(*in, line)) {
+            return false;
+        }
+        const size_t previous = number;
+        const auto [end, error] =
+            std::from_chars(line.data(), line.data() + line.size(), number);
+        if (error != std::errc() || end == line.data() + line.size() ||
+            *end != '\t' || number < previous) {
+            return std::unexpected(Report{
+                .kind = ReportKind::Error,
+                .message = concat(
+                    "Not the sorted output of a shard: '", line, "'"
+                ),
+                .spans = {},
+                .comments = {},
+            });
+        }
+        return true;
+    }
+
+    /**
+     * @brief `line` without its tag.
+     */
+    auto text() const -> std::string_view {
+        return std::string_view(line).substr(line.find('\t') + 1);
+    }
+};
+
+auto merge_shards(std::span<std::istream* const> shards, std::ostream& out)
+    -> std::optional<Report> {
+    std::vector<ShardCursor> cursors;
+    for (std::istream* in : shards) {
+        cursors.push_back(ShardCursor{.in = in, .line = {}});
+    }
+
+    // Shards with the smallest line number first, ties keep the shard order
+    auto later = [&cursors](size_t lhs, size_t rhs) {
+        return std::pair(cursors[lhs].number, lhs) >
+               std::pair(cursors[rhs].number, rhs);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(
+        later
+    );
+    for (size_t i = 0; i < cursors.size(); i += 1) {
+        const auto has_line = cursors[i].next();
+        if (!has_line) return has_line.error();
+        if (has_line.value()) heads.push(i);
+    }
+
+    while (!heads.empty()) {
+        const size_t shard = heads.top();
+        heads.pop();
+        ShardCursor& cursor = cursors[shard];
+        writeln(out, cursor.text());
+
+        const auto has_line = cursor.next();
+        if (!has_line) return has_line.error();
+        if (has_line.value()) heads.push(shard);
+    }
+    out.flush();
+    return {};
+}
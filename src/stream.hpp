@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <span>
+
+#include "output.hpp"
+#include "report.hpp"
+
+class Progress;
+class Tracer;
+
+/**
+ * @brief Evaluates newline separated expressions without ever holding a whole
+ *        line, its tokens or its `Chunk` in memory.
+ *
+ * Input is read in fixed size blocks, tokenized up to the last whitespace of
+ * each block and reduced online with a stack of pending operators.
+ * Memory usage only grows with the nesting depth of an expression and the
+ * length of its longest token.
+ *
+ * Prints one result or error message per non empty line, like `--plain`.
+ * As the source is not kept around, error messages contain the position of the
+ * error instead of underlining it.
+ *
+ * @param in Stream to read expressions from.
+ * @param out Stream to write results and error messages into.
+ * @param tracer Records reading and evaluating sampled blocks, if set.
+ */
+void stream(std::istream& in, std::ostream& out, Tracer* tracer = nullptr);
+
+/**
+ * @brief Evaluates newline separated expressions like `stream`, writing the
+ *        results in any `OutputFormat`.
+ * @param in Stream to read expressions from.
+ * @param results Where results and error messages are written.
+ * @param tracer Records reading and evaluating sampled blocks, if set.
+ * @param progress Counts lines, bytes and errors, if set.
+ */
+void stream(
+    std::istream& in, ResultWriter& results, Tracer* tracer = nullptr,
+    Progress* progress = nullptr
+);
+
+/**
+ * @brief One of `count` equally sized byte ranges of the input.
+ */
+struct Shard {
+    /// Starting at 0
+    size_t index;
+    size_t count;
+};
+
+/**
+ * @brief Evaluates only the lines of a single shard of the input, like
+ *        `stream` does for all of them.
+ *
+ * The byte range of the shard is moved to the start of the next line, so
+ * every line belongs to the shard that its first byte falls into and the
+ * shards of all `count` processes cover each line exactly once. Only the
+ * newlines in front of the shard are scanned, to know the global number of
+ * its first line.
+ *
+ * Every output line is prefixed with the global number of the input line it
+ * belongs to and a tab, @see `merge_shards`.
+ *
+ * @param in Seekable stream to read expressions from.
+ * @param out Stream to write tagged results and error messages into.
+ * @param shard Which part of the input to evaluate.
+ * @param tracer Records reading and evaluating sampled blocks, if set.
+ */
+void stream_shard(
+    std::istream& in, std::ostream& out, Shard shard, Tracer* tracer = nullptr
+);
+
+/**
+ * @brief Combines the outputs of `stream_shard` into the output `stream`
+ *        would have written for the whole input.
+ *
+ * Lines are merged by their line numbers, so the shards can be passed in any
+ * order. The line numbers and tabs are removed.
+ *
+ * @param shards Outputs of `stream_shard`, each sorted by line number.
+ * @param out Stream to write the merged output into.
+ * @return A report if one of the shards is not a tagged output.
+ */
+auto merge_shards(std::span<std::istream* const> shards, std::ostream& out)
+    -> std::optional<Report>;
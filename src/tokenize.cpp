@@ -1,10 +1,12 @@
 #include "tokenize.hpp"
 
+#include <algorithm>
 #include <cctype>
 
 #include "format.hpp"
+#include "pool.hpp"
 
-auto Token::name() const -> std::string_view {
+auto token_kind_to_string(TokenKind kind) -> std::string_view {
     switch (kind) {
         case TokenKind::Identifier:
             return "Identifier";
@@ -16,6 +18,22 @@ auto Token::name() const -> std::string_view {
             return "Star";
         case TokenKind::Slash:
             return "Slash";
+        case TokenKind::Equals:
+            return "Equals";
+        case TokenKind::Question:
+            return "Question";
+        case TokenKind::Less:
+            return "Less";
+        case TokenKind::LessEqual:
+            return "LessEqual";
+        case TokenKind::Greater:
+            return "Greater";
+        case TokenKind::GreaterEqual:
+            return "GreaterEqual";
+        case TokenKind::EqualEqual:
+            return "EqualEqual";
+        case TokenKind::BangEqual:
+            return "BangEqual";
         case TokenKind::Number:
             return "Number";
         case TokenKind::Error:
@@ -30,6 +48,10 @@ auto Token::name() const -> std::string_view {
     }
 }
 
+auto Token::name() const -> std::string_view {
+    return token_kind_to_string(kind);
+}
+
 auto Token::source(std::string_view source) const -> std::string_view {
     return span.source(source);
 }
@@ -90,7 +112,7 @@ static auto validate_number(std::string_view source) -> size_t {
 
 /**
  * @brief Try to consume as many alphabetical, and special characters as
- * possible.
+ * possible, and digits after the first one (like `atan2`).
  * @param source Slice of the input string that is to be checked.
  * @return Length, in bytes, of the consumed characters.
  */
@@ -99,7 +121,7 @@ static constexpr auto validate_identifier(std::string_view source) -> size_t {
 
     for (const auto& [scalar, length] : utf8::Scalars(source)) {
         if (std::iswspace(scalar) || std::iswpunct(scalar) ||
-            std::iswdigit(scalar))
+            (length_ident == 0 && std::iswdigit(scalar)))
             break;
 
         length_ident += length;
@@ -108,54 +130,276 @@ static constexpr auto validate_identifier(std::string_view source) -> size_t {
     return length_ident;
 }
 
-auto tokenize(std::string_view source) -> std::vector<Token> {
-    std::vector<Token> tokens;
-    // Index to first character of current token
-    size_t start = 0;
-
-    auto push = [&tokens](TokenKind kind, Span span) {
-        tokens.push_back(Token(kind, span));
-    };
+TokenCursor::TokenCursor(std::string_view source) : m_source(source) {}
 
-    while (start < source.length()) {
-        std::string_view rest = source.substr(start);
-        char chr = source.at(start);
+auto TokenCursor::next() -> std::optional<Token> {
+    while (m_start < m_source.length()) {
+        const size_t start = m_start;
+        std::string_view rest = m_source.substr(start);
+        char chr = m_source.at(start);
 
         size_t whitespace_len = validate_whitespace(rest);
         if (whitespace_len > 0) {
-            start += whitespace_len;
+            m_start += whitespace_len;
             continue;
         }
 
         size_t number_len = validate_number(rest);
         if (number_len > 0) {
-            push(TokenKind::Number, Span(start, number_len));
-            start += number_len;
-            continue;
+            m_start += number_len;
+            return Token(TokenKind::Number, Span(start, number_len));
         }
 
         size_t identifier_len = validate_identifier(rest);
         if (identifier_len > 0) {
-            push(TokenKind::Identifier, Span(start, identifier_len));
-            start += identifier_len;
-            continue;
+            m_start += identifier_len;
+            return Token(TokenKind::Identifier, Span(start, identifier_len));
+        }
+
+        m_start += 1;
+
+        // Operators of two characters
+        const bool equals_next =
+            m_start < m_source.length() && m_source[m_start] == '=';
+        if (equals_next && (chr == '<' || chr == '>' || chr == '=' ||
+                            chr == '!')) {
+            m_start += 1;
+            const TokenKind kind = chr == '<'   ? TokenKind::LessEqual
+                                   : chr == '>' ? TokenKind::GreaterEqual
+                                   : chr == '=' ? TokenKind::EqualEqual
+                                                : TokenKind::BangEqual;
+            return Token(kind, Span(start, 2));
         }
 
         // Operators
         if (chr == '+') {
-            push(TokenKind::Plus, Span(start, 1));
+            return Token(TokenKind::Plus, Span(start, 1));
         } else if (chr == '-') {
-            push(TokenKind::Minus, Span(start, 1));
+            return Token(TokenKind::Minus, Span(start, 1));
         } else if (chr == '*') {
-            push(TokenKind::Star, Span(start, 1));
+            return Token(TokenKind::Star, Span(start, 1));
         } else if (chr == '/') {
-            push(TokenKind::Slash, Span(start, 1));
+            return Token(TokenKind::Slash, Span(start, 1));
+        } else if (chr == '=') {
+            return Token(TokenKind::Equals, Span(start, 1));
+        } else if (chr == '?') {
+            return Token(TokenKind::Question, Span(start, 1));
+        } else if (chr == '<') {
+            return Token(TokenKind::Less, Span(start, 1));
+        } else if (chr == '>') {
+            return Token(TokenKind::Greater, Span(start, 1));
         } else {
-            push(TokenKind::Error, Span(start, 1));
+            return Token(TokenKind::Error, Span(start, 1));
         }
+    }
+
+    return {};
+}
+
+TokenBuffer::TokenBuffer(std::string_view source)
+    : TokenBuffer(source, source.size() > UINT32_MAX) {}
 
-        start += 1;
+TokenBuffer::TokenBuffer(std::string_view source, bool wide_offsets)
+    : m_wide(wide_offsets) {
+    append(source, 0);
+}
+
+void TokenBuffer::append(std::string_view source, size_t offset) {
+    TokenCursor cursor(source);
+    while (const auto token = cursor.next()) {
+        const size_t start = offset + token->span.start;
+        m_kinds.push_back(token->kind);
+        if (m_wide) {
+            m_wide_starts.push_back(start);
+            m_wide_lengths.push_back(token->span.length);
+        } else {
+            m_starts.push_back(static_cast<uint32_t>(start));
+            m_lengths.push_back(static_cast<uint32_t>(token->span.length));
+        }
+    }
+}
+
+/**
+ * @brief Splits a source into pieces of about `size` bytes, each of which
+ *        (except the first) starts with whitespace.
+ * @return Start of every piece and the size of the source.
+ */
+static auto split_at_whitespace(std::string_view source, size_t size)
+    -> std::vector<size_t> {
+    std::vector<size_t> bounds = {0};
+    size_t target = size;
+    while (target < source.size()) {
+        const auto whitespace = std::find_if(
+            source.begin() + static_cast<ptrdiff_t>(target), source.end(),
+            [](char chr) { return std::isspace(chr); }
+        );
+        if (whitespace == source.end()) {
+            break;
+        }
+        const auto bound = static_cast<size_t>(whitespace - source.begin());
+        bounds.push_back(bound);
+        target = bound + size;
+    }
+    bounds.push_back(source.size());
+    return bounds;
+}
+
+/**
+ * @brief Copies `part` into `whole`, starting at `index`.
+ */
+template <typename T>
+static void copy_into(
+    std::vector<T>& whole, size_t index, const std::vector<T>& part
+) {
+    std::ranges::copy(part, whole.begin() + static_cast<ptrdiff_t>(index));
+}
+
+TokenBuffer::TokenBuffer(
+    std::string_view source, ThreadPool& pool, size_t grain
+)
+    : m_wide(source.size() > UINT32_MAX) {
+    // A few pieces per thread, so that threads that finish early can steal
+    const size_t pieces = pool.size() * 4;
+    const std::vector<size_t> bounds = split_at_whitespace(
+        source, std::max({grain, source.size() / pieces, size_t(1)})
+    );
+    if (bounds.size() <= 2) {
+        append(source, 0);
+        return;
     }
 
+    std::vector<TokenBuffer> parts(bounds.size() - 1, TokenBuffer(m_wide));
+    pool.for_each(0, parts.size(), [&](size_t i) {
+        parts[i].append(
+            source.substr(bounds[i], bounds[i + 1] - bounds[i]), bounds[i]
+        );
+    });
+
+    std::vector<size_t> indices(parts.size() + 1, 0);
+    for (size_t i = 0; i < parts.size(); i += 1) {
+        indices[i + 1] = indices[i] + parts[i].size();
+    }
+    const size_t count = indices.back();
+    m_kinds.resize(count);
+    if (m_wide) {
+        m_wide_starts.resize(count);
+        m_wide_lengths.resize(count);
+    } else {
+        m_starts.resize(count);
+        m_lengths.resize(count);
+    }
+    pool.for_each(0, parts.size(), [&](size_t i) {
+        const TokenBuffer& part = parts[i];
+        copy_into(m_kinds, indices[i], part.m_kinds);
+        copy_into(m_starts, indices[i], part.m_starts);
+        copy_into(m_lengths, indices[i], part.m_lengths);
+        copy_into(m_wide_starts, indices[i], part.m_wide_starts);
+        copy_into(m_wide_lengths, indices[i], part.m_wide_lengths);
+    });
+}
+
+auto TokenBuffer::memory_usage() const -> size_t {
+    const size_t offset_size = m_wide ? sizeof(uint64_t) : sizeof(uint32_t);
+    return size() * (sizeof(TokenKind) + 2 * offset_size);
+}
+
+auto tokenize(std::string_view source) -> TokenBuffer {
+    return TokenBuffer(source);
+}
+
+/**
+ * @brief Report for a source with more bytes than `budget` allows.
+ */
+static auto bytes_report(const Budget& budget) -> Report {
+    return budget_report(budget.max_bytes, "bytes", "--max-bytes", {});
+}
+
+/**
+ * @brief Report for a source with more tokens than `budget` allows.
+ * @param span The first token that is over budget.
+ */
+static auto tokens_report(const Budget& budget, Span span) -> Report {
+    return budget_report(budget.max_tokens, "tokens", "--max-tokens", span);
+}
+
+auto tokenize(std::string_view source, const Budget& budget)
+    -> std::expected<TokenBuffer, Report> {
+    if (source.size() > budget.max_bytes) {
+        return std::unexpected(bytes_report(budget));
+    }
+    // Every token takes at least one byte, so short sources are never over
+    if (budget.max_tokens < source.size()) {
+        TokenCursor cursor(source);
+        size_t count = 0;
+        while (const auto token = cursor.next()) {
+            count += 1;
+            if (count > budget.max_tokens) {
+                return std::unexpected(tokens_report(budget, token->span));
+            }
+        }
+    }
+    return TokenBuffer(source);
+}
+
+auto tokenize_parallel(
+    std::string_view source, ThreadPool& pool, size_t grain
+) -> TokenBuffer {
+    return TokenBuffer(source, pool, grain);
+}
+
+auto tokenize_parallel(
+    std::string_view source, const Budget& budget, ThreadPool& pool
+) -> std::expected<TokenBuffer, Report> {
+    if (source.size() > budget.max_bytes) {
+        return std::unexpected(bytes_report(budget));
+    }
+    TokenBuffer tokens(source, pool, PARALLEL_TOKENIZE_GRAIN);
+    if (tokens.size() > budget.max_tokens) {
+        return std::unexpected(
+            tokens_report(budget, tokens.span(budget.max_tokens))
+        );
+    }
     return tokens;
 }
+
+/**
+ * @brief Bundles the spans of invalid tokens into one `Report`.
+ * @param error_spans Spans of all invalid tokens.
+ * @return The report or nothing if there are no invalid tokens.
+ */
+static auto invalid_tokens_report(std::vector<Span>&& error_spans)
+    -> std::optional<Report> {
+    if (error_spans.empty()) {
+        return {};
+    }
+    return Report{
+        .kind = ReportKind::Error,
+        .message = error_spans.size() > 1 ? "Invalid Tokens" : "Invalid Token",
+        .spans = std::move(error_spans)
+    };
+}
+
+auto invalid_tokens_report(std::string_view source)
+    -> std::optional<Report> {
+    std::vector<Span> error_spans;
+    TokenCursor cursor(source);
+    while (const auto token = cursor.next()) {
+        if (token->kind == TokenKind::Error) {
+            error_spans.push_back(token->span);
+        }
+    }
+    return invalid_tokens_report(std::move(error_spans));
+}
+
+auto invalid_tokens_report(const TokenBuffer& tokens)
+    -> std::optional<Report> {
+    // Only the kinds are scanned, offsets are loaded for invalid tokens
+    std::vector<Span> error_spans;
+    const std::span<const TokenKind> kinds = tokens.kinds();
+    for (size_t i = 0; i < kinds.size(); i += 1) {
+        if (kinds[i] == TokenKind::Error) {
+            error_spans.push_back(tokens.span(i));
+        }
+    }
+    return invalid_tokens_report(std::move(error_spans));
+}
@@ -1,18 +1,46 @@
 #pragma once
 
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "budget.hpp"
 #include "report.hpp"
 
-enum class TokenKind {
+class ThreadPool;
+
+/// Sources with fewer bytes per thread are tokenized in fewer pieces (at
+/// least this many bytes each)
+constexpr size_t PARALLEL_TOKENIZE_GRAIN = 1 << 20;
+
+enum class TokenKind : uint8_t {
     Identifier,
     Plus,
     Minus,
     Star,
     Slash,
+    Equals,
+    Question,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    EqualEqual,
+    BangEqual,
     Number,
     Error,
     EndOfInput,
 };
 
+/**
+ * @brief Name to be used when displaying a `TokenKind`.
+ * @param kind The `TokenKind`.
+ * @return Name of the `TokenKind`.
+ */
+auto token_kind_to_string(TokenKind kind) -> std::string_view;
+
 /**
  * @brief Section of source code used to simplify compilation (especially
  *        parsing).
@@ -38,9 +66,168 @@ struct Token {
     auto source(std::string_view source) const -> std::string_view;
 };
 
+/**
+ * @brief Pull based tokenizer, that produces one `Token` at a time instead of
+ *        materializing the whole token stream up front.
+ */
+struct TokenCursor {
+    TokenCursor(std::string_view source);
+
+    /**
+     * @brief Tokenizes the next section of the source.
+     * @return The next token or nothing if the end of input was reached.
+     */
+    auto next() -> std::optional<Token>;
+
+   private:
+    std::string_view m_source;
+    /// Index to first character of the next token
+    size_t m_start = 0;
+};
+
+/**
+ * @brief All tokens of a source, stored as one array per field (structure of
+ *        arrays) instead of an array of `Token`s.
+ *
+ * Kinds take one byte and offsets four, so a token takes 9 bytes instead of
+ * the 24 of a `Token`. Sources larger than 4 GiB switch to 8 byte offsets.
+ */
+struct TokenBuffer {
+    /**
+     * @brief Tokenizes the whole source, using 8 byte offsets only if needed.
+     * @param source Input source string.
+     */
+    explicit TokenBuffer(std::string_view source);
+
+    /**
+     * @brief Tokenizes the whole source.
+     * @param source Input source string.
+     * @param wide_offsets Use 8 byte offsets, even if 4 bytes would suffice.
+     */
+    TokenBuffer(std::string_view source, bool wide_offsets);
+
+    /**
+     * @brief Tokenizes pieces of the source on separate threads, with the
+     *        same result as tokenizing it on a single thread.
+     *
+     * No token contains whitespace, so the source is split at whitespace
+     * (which is always ASCII and thus never inside of a UTF-8 scalar). Each
+     * piece is tokenized with its offset added to the spans and the pieces
+     * are copied into place in parallel.
+     *
+     * @param source Input source string.
+     * @param pool Threads to tokenize the pieces on.
+     * @param grain Smallest size of a piece in bytes.
+     */
+    TokenBuffer(std::string_view source, ThreadPool& pool, size_t grain);
+
+    auto size() const -> size_t { return m_kinds.size(); }
+    auto kinds() const -> std::span<const TokenKind> { return m_kinds; }
+    auto kind(size_t index) const -> TokenKind { return m_kinds[index]; }
+    auto span(size_t index) const -> Span {
+        if (m_wide) {
+            return Span(m_wide_starts[index], m_wide_lengths[index]);
+        }
+        return Span(m_starts[index], m_lengths[index]);
+    }
+    auto operator[](size_t index) const -> Token {
+        return Token(kind(index), span(index));
+    }
+
+    /**
+     * @brief Whether offsets are stored with 8 bytes.
+     */
+    auto wide() const -> bool { return m_wide; }
+
+    /**
+     * @brief Amount of bytes used to store the tokens (without unused
+     *        capacity).
+     */
+    auto memory_usage() const -> size_t;
+
+   private:
+    explicit TokenBuffer(bool wide_offsets) : m_wide(wide_offsets) {}
+
+    /**
+     * @brief Tokenizes `source` and appends its tokens.
+     * @param source Input source string.
+     * @param offset Added to the start of every span, for pieces of a
+     *               larger source.
+     */
+    void append(std::string_view source, size_t offset);
+
+    std::vector<TokenKind> m_kinds;
+    bool m_wide;
+    /// Offsets of sources that fit into 4 GiB
+    std::vector<uint32_t> m_starts;
+    std::vector<uint32_t> m_lengths;
+    /// Offsets of larger sources
+    std::vector<uint64_t> m_wide_starts;
+    std::vector<uint64_t> m_wide_lengths;
+};
+
 /**
  * @brief Split the source string into tokens.
  * @param source Input source string.
  * @return All valid tokens and errors.
  */
-auto tokenize(std::string_view source) -> std::vector<Token>;
+auto tokenize(std::string_view source) -> TokenBuffer;
+
+/**
+ * @brief Split the source string into tokens, if it stays within the byte
+ *        and token limits of `budget`.
+ *
+ * The length is checked before tokenizing and tokens are counted without
+ * storing them, so a line that is over budget never allocates.
+ *
+ * @param source Input source string.
+ * @param budget Limits of the line.
+ * @return All valid tokens and errors, or a report about the exceeded limit.
+ */
+auto tokenize(std::string_view source, const Budget& budget)
+    -> std::expected<TokenBuffer, Report>;
+
+/**
+ * @brief Split the source string into tokens on several threads.
+ * @param source Input source string.
+ * @param pool Threads to tokenize on.
+ * @param grain Smallest amount of bytes that is tokenized as one piece.
+ * @return All valid tokens and errors, identical to `tokenize(source)`.
+ */
+auto tokenize_parallel(
+    std::string_view source, ThreadPool& pool,
+    size_t grain = PARALLEL_TOKENIZE_GRAIN
+) -> TokenBuffer;
+
+/**
+ * @brief Split the source string into tokens on several threads, if it
+ *        stays within the byte and token limits of `budget`.
+ *
+ * Unlike `tokenize`, the tokens of a line that is over budget are stored
+ * before they are counted.
+ *
+ * @param source Input source string.
+ * @param budget Limits of the line.
+ * @param pool Threads to tokenize on.
+ * @return All valid tokens and errors, or the same report as `tokenize`
+ *         about the exceeded limit.
+ */
+auto tokenize_parallel(
+    std::string_view source, const Budget& budget, ThreadPool& pool
+) -> std::expected<TokenBuffer, Report>;
+
+/**
+ * @brief Collects the spans of all invalid tokens into one `Report`.
+ * @param source The input string to tokenize.
+ * @return The report or nothing if all tokens are valid.
+ */
+auto invalid_tokens_report(std::string_view source) -> std::optional<Report>;
+
+/**
+ * @brief Collects the spans of all invalid tokens into one `Report`, without
+ *        tokenizing the source again.
+ * @param tokens Tokens of the source.
+ * @return The report or nothing if all tokens are valid.
+ */
+auto invalid_tokens_report(const TokenBuffer& tokens)
+    -> std::optional<Report>;
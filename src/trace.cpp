@@ -0,0 +1,125 @@
+#include "trace.hpp"
+
+#include <string>
+
+#include "format.hpp"
+
+/// How often the writer thread wakes up to write new spans
+constexpr auto TRACE_FLUSH_INTERVAL = std::chrono::milliseconds(20);
+
+Tracer::Tracer(std::ofstream file, size_t sample)
+    : m_file(std::move(file)),
+      m_sample(sample),
+      m_start(std::chrono::steady_clock::now()),
+      m_events(TRACE_CAPACITY) {
+    writeln(m_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    m_writer = std::thread([this]() { write_loop(); });
+}
+
+Tracer::~Tracer() {
+    end();
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_writer.join();
+
+    // Only the recording thread counts dropped spans
+    if (m_written) write(m_file, ",\n");
+    writeln(
+        m_file, "{\"name\":\"dropped spans\",\"ph\":\"C\",\"ts\":0,\"pid\":1,",
+        "\"args\":{\"dropped\":", m_dropped, "}}"
+    );
+    writeln(m_file, "]}");
+}
+
+void Tracer::begin(std::string_view name, size_t line) {
+    const uint64_t time = now();
+    if (m_open) {
+        m_current.duration = time - m_current.start;
+        push(m_current);
+    }
+    m_current = TraceEvent{
+        .name = name, .start = time, .duration = 0, .line = line
+    };
+    m_open = true;
+}
+
+void Tracer::end() {
+    if (!m_open) return;
+    m_current.duration = now() - m_current.start;
+    push(m_current);
+    m_open = false;
+}
+
+void Tracer::push(const TraceEvent& event) {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == m_events.size()) {
+        m_dropped += 1;
+        return;
+    }
+    m_events[head % m_events.size()] = event;
+    m_head.store(head + 1, std::memory_order_release);
+    // Wakes the writer early, instead of waiting for the buffer to overflow
+    if ((head + 1) % (m_events.size() / 2) == 0) {
+        m_wake.notify_one();
+    }
+}
+
+auto Tracer::now() const -> uint64_t {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start
+        )
+            .count()
+    );
+}
+
+/**
+ * @brief Appends nanoseconds as microseconds with three decimals, the unit
+ *        of timestamps in trace events.
+ */
+static void format_microseconds(std::string& out, uint64_t nanoseconds) {
+    const uint64_t fraction = nanoseconds % 1000;
+    format_to(
+        out, nanoseconds / 1000, ".", fraction < 100 ? "0" : "",
+        fraction < 10 ? "0" : "", fraction
+    );
+}
+
+void Tracer::flush() {
+    const size_t head = m_head.load(std::memory_order_acquire);
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == head) return;
+
+    std::string& text = m_text;
+    text.clear();
+    for (; tail != head; tail += 1) {
+        const TraceEvent& event = m_events[tail % m_events.size()];
+        format_to(
+            text, m_written ? ",\n" : "", "{\"name\":\"", event.name,
+            "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+        );
+        format_microseconds(text, event.start);
+        format_to(text, ",\"dur\":");
+        format_microseconds(text, event.duration);
+        format_to(text, ",\"args\":{\"line\":", event.line, "}}");
+        m_written = true;
+    }
+    // The slots can be reused as soon as they are formatted
+    m_tail.store(tail, std::memory_order_release);
+    m_file.write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+void Tracer::write_loop() {
+    std::unique_lock lock(m_mutex);
+    while (!m_stop) {
+        m_wake.wait_for(lock, TRACE_FLUSH_INTERVAL);
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+    lock.unlock();
+    flush();
+}
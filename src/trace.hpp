@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/// Spans the ring buffer holds before the writer has to catch up
+constexpr size_t TRACE_CAPACITY = 1 << 16;
+
+/**
+ * @brief A finished span, as it is stored in the ring buffer.
+ */
+struct TraceEvent {
+    /// Has to outlive the `Tracer`, usually a string literal
+    std::string_view name;
+    /// Nanoseconds since the `Tracer` was created
+    uint64_t start;
+    uint64_t duration;
+    /// Line (or block) of the input that the span belongs to
+    size_t line;
+};
+
+/**
+ * @brief Records the phases of the pipeline as Chrome trace event JSON,
+ *        which can be opened in Perfetto or `chrome://tracing`.
+ *
+ * Spans are pushed into a fixed size single producer ring buffer and
+ * formatted and written to the file by a background thread, so recording a
+ * span never allocates or blocks. Spans that do not fit into a full buffer
+ * are dropped and counted instead. Only spans of every `sample`th line are
+ * recorded at all, to keep traces of huge inputs manageable.
+ *
+ * Spans must only be recorded from a single thread.
+ */
+class Tracer {
+   public:
+    /**
+     * @param file Where the trace is written into.
+     * @param sample Record every `sample`th line (at least 1).
+     */
+    Tracer(std::ofstream file, size_t sample);
+    /**
+     * @brief Ends the current span and writes all remaining spans.
+     */
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    auto operator=(const Tracer&) -> Tracer& = delete;
+
+    /**
+     * @brief Whether the spans of a line should be recorded.
+     * @param line Number of the line (or block), starting at 1.
+     */
+    auto sampled(size_t line) const -> bool {
+        return (line - 1) % m_sample == 0;
+    }
+
+    /**
+     * @brief Ends the current span (if there is one) and begins a new one.
+     * @param name Name of the phase, has to outlive the tracer.
+     * @param line Line (or block) the phase belongs to.
+     */
+    void begin(std::string_view name, size_t line);
+
+    /**
+     * @brief Ends the current span, if there is one.
+     */
+    void end();
+
+   private:
+    auto now() const -> uint64_t;
+    /**
+     * @brief Hands a finished span to the writer, or drops it if the buffer
+     *        is full.
+     */
+    void push(const TraceEvent& event);
+    /**
+     * @brief Formats and writes all spans in the buffer.
+     */
+    void flush();
+    void write_loop();
+
+    std::ofstream m_file;
+    const size_t m_sample;
+    const std::chrono::steady_clock::time_point m_start;
+
+    /// The span that has begun but not ended yet
+    bool m_open = false;
+    TraceEvent m_current{};
+
+    std::vector<TraceEvent> m_events;
+    /// Amount of spans ever pushed, only written by the recording thread
+    std::atomic<size_t> m_head = 0;
+    /// Amount of spans ever written, only written by the writer thread
+    std::atomic<size_t> m_tail = 0;
+    size_t m_dropped = 0;
+    /// Whether any span was written yet, to separate them with commas
+    bool m_written = false;
+    /// Formatted spans, reused by every flush
+    std::string m_text;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+    std::thread m_writer;
+};
@@ -0,0 +1,290 @@
+#include "verify.hpp"
+
+#include <algorithm>
+#include <expected>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "format.hpp"
+
+/**
+ * @brief Creates the report for an invalid chunk.
+ * @param index Index of the opcode that caused the problem.
+ * @param ...args Message describing the problem.
+ */
+template <typename... Args>
+static auto invalid(size_t index, Args... args) -> std::unexpected<Report> {
+    return std::unexpected(Report{
+        .kind = ReportKind::Error,
+        .message = concat("Invalid chunk: ", args..., " (OpCode ", index, ")"),
+        .spans = {},
+    });
+}
+
+/**
+ * @brief State of the stack and chunk at the target of a jump.
+ */
+struct JumpTarget {
+    size_t opcode;
+    size_t literal;
+    size_t operand;
+    uint32_t depth;
+
+    auto operator>(const JumpTarget& other) const -> bool {
+        return opcode > other.opcode;
+    }
+};
+
+/**
+ * @brief Verifies a chunk or the body of a reduction.
+ * @param chunk The Chunk to verify.
+ * @param environment Variables and functions that the chunk refers to.
+ * @param arity Amount of parameters of the function that contains the chunk.
+ * @param is_body Whether the chunk is the body of a function.
+ * @param levels Amount of enclosing reductions.
+ * @return Limits of the chunk or a report describing the first problem.
+ */
+static auto verify_code(
+    const Chunk& chunk, const Environment& environment, uint32_t arity,
+    bool is_body, uint32_t levels
+) -> std::expected<ChunkLimits, Report> {
+    const size_t length = chunk.opcodes.size();
+
+    ChunkLimits limits;
+    uint32_t depth = 0;
+    size_t literal_index = 0;
+    size_t operand_index = 0;
+
+    // Jumps whose target has not been reached yet, the closest one first
+    std::priority_queue<
+        JumpTarget, std::vector<JumpTarget>, std::greater<JumpTarget>>
+        targets;
+    // Whether the current opcode can be reached without jumping
+    bool reachable = true;
+
+    // All paths into `index` have to agree on the state, otherwise the
+    // following opcodes would consume different values
+    auto land = [&](size_t index) -> bool {
+        while (!targets.empty() && targets.top().opcode == index) {
+            const JumpTarget& target = targets.top();
+            if (!reachable) {
+                literal_index = target.literal;
+                operand_index = target.operand;
+                depth = target.depth;
+                reachable = true;
+            } else if (target.literal != literal_index ||
+                       target.operand != operand_index ||
+                       target.depth != depth) {
+                return false;
+            }
+            targets.pop();
+        }
+        return true;
+    };
+
+    // Pops `count` values, fails if there are not enough
+    auto pop = [&depth](uint32_t count) -> bool {
+        if (depth < count) {
+            return false;
+        }
+        depth -= count;
+        return true;
+    };
+    auto push = [&depth, &limits]() {
+        depth += 1;
+        limits.max_stack_depth = std::max(limits.max_stack_depth, depth);
+    };
+
+    for (size_t i = 0; i < length; i += 1) {
+        const OpCode opcode = chunk.opcodes[i];
+        if (!land(i)) {
+            return invalid(i, "Jumps disagree about the stack");
+        }
+        if (!reachable) {
+            return invalid(i, "Unreachable code");
+        }
+
+        const size_t operand_count =
+            static_cast<size_t>(opcode) < OPCODE_COUNT ? opcode_operands(opcode)
+                                                       : 0;
+        if (chunk.operands.size() - operand_index < operand_count) {
+            return invalid(i, "Missing operand");
+        }
+        const uint32_t* operands = chunk.operands.data() + operand_index;
+        const uint32_t operand = operand_count > 0 ? operands[0] : 0;
+        operand_index += operand_count;
+
+        switch (opcode) {
+            case OpCode::Load:
+                if (literal_index == chunk.literals.size()) {
+                    return invalid(i, "Missing literal");
+                }
+                literal_index += 1;
+                push();
+                break;
+            case OpCode::Variable:
+                if (operand >= environment.values.size() ||
+                    environment.arity(operand) != 0) {
+                    return invalid(i, "Unknown variable <", operand, ">");
+                }
+                push();
+                break;
+            case OpCode::LoadArg:
+                if (operand >= arity) {
+                    return invalid(i, "Unknown argument <", operand, ">");
+                }
+                push();
+                break;
+            case OpCode::Index:
+                if (operand >= levels) {
+                    return invalid(i, "Unknown index <", operand, ">");
+                }
+                push();
+                break;
+            case OpCode::Sum:
+            case OpCode::Prod: {
+                if (operand >= chunk.reductions.size()) {
+                    return invalid(i, "Unknown reduction <", operand, ">");
+                }
+                // The body runs on its own stack
+                const auto body = verify_code(
+                    chunk.reductions[operand], environment, arity, false,
+                    levels + 1
+                );
+                if (!body) {
+                    return body;
+                }
+                if (!pop(2)) {
+                    return invalid(i, "Stack underflow");
+                }
+                push();
+                break;
+            }
+            case OpCode::Call: {
+                if (operand >= environment.bodies.size() ||
+                    !environment.bodies[operand] ||
+                    !environment.bodies[operand]->limits) {
+                    return invalid(i, "Unknown function <", operand, ">");
+                }
+                const uint32_t call_arity = environment.arity(operand);
+                const ChunkLimits& body = *environment.bodies[operand]->limits;
+                if (depth < call_arity) {
+                    return invalid(i, "Stack underflow");
+                }
+                // The body runs on top of its arguments
+                limits.max_stack_depth = std::max(
+                    limits.max_stack_depth, depth + body.max_stack_depth
+                );
+                limits.max_call_depth =
+                    std::max(limits.max_call_depth, 1 + body.max_call_depth);
+                pop(call_arity);
+                push();
+                break;
+            }
+            case OpCode::Ret:
+                if (!is_body || i + 1 != length) {
+                    return invalid(
+                        i, "Return outside of the end of a function"
+                    );
+                }
+                if (depth != 1) {
+                    return invalid(i, "Function returns ", depth, " values");
+                }
+                break;
+            case OpCode::Cos:
+            case OpCode::Sin:
+            case OpCode::Tan:
+            case OpCode::Exp:
+            case OpCode::Log:
+            case OpCode::Sqrt:
+            case OpCode::Abs:
+            case OpCode::Atan:
+                if (!pop(1)) {
+                    return invalid(i, "Stack underflow");
+                }
+                push();
+                break;
+            case OpCode::Add:
+            case OpCode::Sub:
+            case OpCode::Mul:
+            case OpCode::Div:
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::Pow:
+            case OpCode::Min:
+            case OpCode::Max:
+            case OpCode::Hypot:
+            case OpCode::Atan2:
+                if (!pop(2)) {
+                    return invalid(i, "Stack underflow");
+                }
+                push();
+                break;
+            case OpCode::JumpIfZero:
+            case OpCode::Jump: {
+                if (opcode == OpCode::JumpIfZero && !pop(1)) {
+                    return invalid(i, "Stack underflow");
+                }
+                const JumpTarget target{
+                    .opcode = i + 1 + operands[0],
+                    .literal = literal_index + operands[1],
+                    .operand = operand_index + operands[2],
+                    .depth = depth,
+                };
+                // Function bodies must not jump over their `Ret`
+                if (target.opcode > length ||
+                    (is_body && target.opcode >= length) ||
+                    target.literal > chunk.literals.size() ||
+                    target.operand > chunk.operands.size()) {
+                    return invalid(i, "Jump out of the chunk");
+                }
+                targets.push(target);
+                if (opcode == OpCode::Jump) {
+                    reachable = false;
+                }
+                break;
+            }
+            default:
+                return invalid(
+                    i, "Unknown OpCode <", static_cast<uint32_t>(opcode), ">"
+                );
+        }
+    }
+
+    if (!land(length)) {
+        return invalid(length, "Jumps disagree about the stack");
+    }
+    if (!reachable) {
+        return invalid(length, "Unreachable code");
+    }
+    if (literal_index != chunk.literals.size()) {
+        return invalid(length, "Unused literals");
+    }
+    if (operand_index != chunk.operands.size()) {
+        return invalid(length, "Unused operands");
+    }
+    if (is_body && (length == 0 || chunk.opcodes.back() != OpCode::Ret)) {
+        return invalid(length, "Function does not return");
+    }
+    if (!is_body && depth != 1) {
+        return invalid(length, "Expression leaves ", depth, " values");
+    }
+
+    return limits;
+}
+
+auto verify(Chunk& chunk, const Environment& environment, uint32_t arity)
+    -> std::optional<Report> {
+    const auto limits =
+        verify_code(chunk, environment, arity, arity > 0, 0);
+    if (!limits) {
+        return limits.error();
+    }
+    chunk.limits = limits.value();
+    return {};
+}
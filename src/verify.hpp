@@ -0,0 +1,37 @@
+#pragma once
+
+#include <optional>
+
+#include "chunk.hpp"
+#include "environment.hpp"
+#include "report.hpp"
+
+/**
+ * @brief Checks that a Chunk can be executed without any runtime checks and
+ *        stores its `ChunkLimits` in `chunk.limits`.
+ *
+ * A chunk is valid if:
+ * - every opcode is known and finds enough values on the stack
+ * - every literal and operand is consumed exactly once
+ * - variables and called functions exist in `environment`, called functions
+ *   have verified bodies and arguments are within the parameters
+ * - expressions leave exactly one value on the stack, function bodies end
+ *   with their only `Ret`
+ * - jumps stay within the chunk and every path into an opcode arrives with
+ *   the same stack depth and the same literals and operands consumed, no
+ *   opcode is unreachable
+ * - the bodies of reductions are valid expressions, that only refer to the
+ *   indices of enclosing reductions
+ *
+ * Chunks produced by the compiler are always valid, but inlining or
+ * redefinitions create new ones that have to be verified again.
+ *
+ * @param chunk The Chunk to verify.
+ * @param environment Variables and functions that the chunk refers to.
+ * @param arity Amount of parameters if `chunk` is the body of a function,
+ *              zero for expressions.
+ * @return A report describing the first problem or nothing if the chunk is
+ *         valid.
+ */
+auto verify(Chunk& chunk, const Environment& environment, uint32_t arity = 0)
+    -> std::optional<Report>;
@@ -0,0 +1,405 @@
+#include "watch.hpp"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <vector>
+
+#include "compile.hpp"
+#include "environment.hpp"
+#include "format.hpp"
+#include "fold.hpp"
+#include "inliner.hpp"
+#include "interpret.hpp"
+#include "verify.hpp"
+#include "report.hpp"
+#include "tokenize.hpp"
+
+/**
+ * @brief A single `let name = expr` line of a sheet.
+ */
+struct Definition {
+    /// Whether the current version of the sheet contains this definition
+    bool defined = false;
+    /// Number of the line that contains this definition
+    size_t line = 0;
+    /// Amount of parameters, zero for variables
+    uint32_t arity = 0;
+    /// Entire line, including `let name =`
+    std::string source;
+    /// Nothing if compilation failed
+    std::optional<Chunk> chunk;
+    /// Slots of all variables and functions that the expression refers to
+    std::vector<uint32_t> dependencies;
+    /// Formatted error message, if compilation or evaluation failed
+    std::optional<std::string> error;
+};
+
+/**
+ * @brief State of a sheet, that is kept between edits.
+ */
+struct Sheet {
+    /**
+     * @brief Replaces the sheet with a new version and re-evaluates all
+     *        definitions that changed and their dependents.
+     * @param text Contents of the sheet.
+     * @param out Stream to write values and error messages into.
+     */
+    void update(std::string_view text, std::ostream& out);
+
+   private:
+    /**
+     * @brief Tokenizes and compiles a definition, storing either its chunk
+     *        and dependencies or an error.
+     * @param definition The definition with up to date source.
+     */
+    void compile(Definition& definition);
+
+    /**
+     * @brief Evaluates a definition after all of its dirty dependencies.
+     * @param slot Slot of the definition.
+     * @param dirty Which definitions need to be evaluated again.
+     * @param visited Evaluation state of each slot
+     *                (0 = not yet, 1 = in progress, 2 = done).
+     */
+    void evaluate(
+        uint32_t slot, const std::vector<bool>& dirty,
+        std::vector<uint8_t>& visited
+    );
+
+    Environment m_environment;
+    /// Indexed by slot
+    std::vector<Definition> m_definitions;
+};
+
+/**
+ * @brief Name and amount of parameters of the variable or function that a
+ *        line defines.
+ * @param line Source of the line.
+ * @return Name and arity or nothing if the line does not start with
+ *         `let name`.
+ */
+static auto definition_header(std::string_view line)
+    -> std::optional<std::pair<std::string_view, uint32_t>> {
+    TokenCursor cursor(line);
+    const auto keyword = cursor.next();
+    if (!keyword || keyword->kind != TokenKind::Identifier ||
+        keyword->source(line) != "let") {
+        return {};
+    }
+    const auto name = cursor.next();
+    if (!name || name->kind != TokenKind::Identifier) {
+        return {};
+    }
+
+    uint32_t arity = 0;
+    auto parameter = cursor.next();
+    while (parameter && parameter->kind == TokenKind::Identifier) {
+        arity += 1;
+        parameter = cursor.next();
+    }
+    return std::pair(name->source(line), arity);
+}
+
+void Sheet::update(std::string_view text, std::ostream& out) {
+    std::vector<bool> dirty(m_definitions.size(), false);
+    std::vector<bool> seen(m_definitions.size(), false);
+
+    // Assign slots to all names first, so that definitions may refer to
+    // names that are defined further down in the sheet
+    size_t line_number = 0;
+    for (const auto part : std::views::split(text, '\n')) {
+        std::string_view line(part.begin(), part.end());
+        line_number += 1;
+        if (line.find_first_not_of(" \t\r\v\f") == std::string_view::npos) {
+            continue;
+        }
+
+        const auto header = definition_header(line);
+        if (!header) {
+            Report report{
+                .kind = ReportKind::Error,
+                .message = concat("Expected definition on line ", line_number),
+                .spans = {Span(0, line.size())},
+                .comments = {{ReportKind::Note, "Use 'let name = expr'"}}
+            };
+            write(out, report.format(line));
+            continue;
+        }
+
+        const auto [name, arity] = header.value();
+        const uint32_t slot = m_environment.define(name, arity);
+        if (slot >= m_definitions.size()) {
+            m_definitions.resize(slot + 1);
+            dirty.resize(slot + 1, false);
+            seen.resize(slot + 1, false);
+        }
+        if (seen[slot]) {
+            Report report{
+                .kind = ReportKind::Error,
+                .message = concat("<", name, "> is defined twice"),
+            };
+            write(out, report.format(""));
+            continue;
+        }
+        seen[slot] = true;
+
+        Definition& definition = m_definitions[slot];
+        definition.line = line_number;
+        definition.arity = arity;
+        // Failed definitions are retried, they might refer to a new name
+        if (!definition.defined || definition.source != line ||
+            !definition.chunk) {
+            definition.defined = true;
+            definition.source = line;
+            dirty[slot] = true;
+        }
+    }
+
+    // Removed definitions
+    for (uint32_t slot = 0; slot < m_definitions.size(); slot += 1) {
+        Definition& definition = m_definitions[slot];
+        if (definition.defined && !seen[slot]) {
+            definition.defined = false;
+            definition.source.clear();
+            definition.chunk.reset();
+            definition.dependencies.clear();
+            definition.error.reset();
+            m_environment.values[slot] = NAN;
+            m_environment.bodies[slot].reset();
+            dirty[slot] = true;
+        }
+    }
+
+    // Everything that (transitively) depends on a changed definition is dirty
+    // and gets compiled again, as it might have inlined a changed function
+    std::vector<bool> compiled(m_definitions.size(), false);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t slot = 0; slot < m_definitions.size(); slot += 1) {
+            if (dirty[slot] && !compiled[slot] && m_definitions[slot].defined) {
+                compile(m_definitions[slot]);
+                compiled[slot] = true;
+            }
+        }
+        for (uint32_t slot = 0; slot < m_definitions.size(); slot += 1) {
+            if (dirty[slot]) continue;
+            for (uint32_t dependency : m_definitions[slot].dependencies) {
+                if (dirty[dependency]) {
+                    dirty[slot] = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<uint8_t> visited(m_definitions.size(), 0);
+    size_t recomputed = 0;
+    size_t total = 0;
+    for (uint32_t slot = 0; slot < m_definitions.size(); slot += 1) {
+        if (!m_definitions[slot].defined) continue;
+        total += 1;
+        if (!dirty[slot]) continue;
+        evaluate(slot, dirty, visited);
+        recomputed += 1;
+    }
+
+    // Print recomputed definitions in the order of the sheet
+    std::vector<uint32_t> order;
+    for (uint32_t slot = 0; slot < m_definitions.size(); slot += 1) {
+        if (dirty[slot] && m_definitions[slot].defined) order.push_back(slot);
+    }
+    std::ranges::sort(order, [&](uint32_t lhs, uint32_t rhs) {
+        return m_definitions[lhs].line < m_definitions[rhs].line;
+    });
+    for (uint32_t slot : order) {
+        const Definition& definition = m_definitions[slot];
+        if (definition.error) {
+            write(out, definition.error.value());
+        } else if (definition.arity > 0) {
+            writeln(
+                out, m_environment.name(slot), " = <function with ",
+                definition.arity, " parameters>"
+            );
+        } else {
+            writeln(
+                out, m_environment.name(slot), " = ",
+                m_environment.values[slot]
+            );
+        }
+    }
+
+    writeln(out, "Recomputed ", recomputed, " of ", total, " definitions");
+    out.flush();
+}
+
+/**
+ * @brief Appends the slots of all variables and functions that a chunk
+ *        refers to, including the bodies of its reductions.
+ * @param chunk The chunk.
+ * @param dependencies Vector to append the slots to.
+ */
+static void collect_dependencies(
+    const Chunk& chunk, std::vector<uint32_t>& dependencies
+) {
+    size_t operand_index = 0;
+    for (OpCode opcode : chunk.opcodes) {
+        if (opcode == OpCode::Variable || opcode == OpCode::Call) {
+            dependencies.push_back(chunk.operands[operand_index]);
+        }
+        operand_index += opcode_operands(opcode);
+    }
+    for (const Chunk& reduction : chunk.reductions) {
+        collect_dependencies(reduction, dependencies);
+    }
+}
+
+void Sheet::compile(Definition& definition) {
+    definition.chunk.reset();
+    definition.dependencies.clear();
+    definition.error.reset();
+
+    auto maybe_statement = Compiler::compile_statement(
+        TokenCursor(definition.source), definition.source, m_environment
+    );
+    if (!maybe_statement.has_value()) {
+        if (const auto report = invalid_tokens_report(definition.source)) {
+            definition.error = report->format(definition.source);
+        } else {
+            definition.error =
+                maybe_statement.error().format(definition.source);
+        }
+        return;
+    }
+
+    const Chunk& chunk = definition.chunk.emplace(maybe_statement->chunk);
+    collect_dependencies(chunk, definition.dependencies);
+}
+
+void Sheet::evaluate(
+    uint32_t slot, const std::vector<bool>& dirty,
+    std::vector<uint8_t>& visited
+) {
+    Definition& definition = m_definitions[slot];
+    if (visited[slot] != 0) return;
+    visited[slot] = 1;
+
+    auto fail = [&](std::string message) {
+        Report report{.kind = ReportKind::Error, .message = std::move(message)};
+        definition.error = report.format("");
+        m_environment.values[slot] = NAN;
+        m_environment.bodies[slot].reset();
+        visited[slot] = 2;
+    };
+
+    if (!definition.chunk) {
+        // Compilation failed, the error has already been stored
+        m_environment.values[slot] = NAN;
+        m_environment.bodies[slot].reset();
+        visited[slot] = 2;
+        return;
+    }
+    definition.error.reset();
+
+    for (uint32_t dependency : definition.dependencies) {
+        const std::string_view name = m_environment.name(dependency);
+        if (!m_definitions[dependency].defined) {
+            return fail(concat("Unknown function or constant <", name, ">"));
+        }
+        if (dirty[dependency]) {
+            if (visited[dependency] == 1) {
+                return fail(concat("<", name, "> depends on itself"));
+            }
+            evaluate(dependency, dirty, visited);
+        }
+        if (m_definitions[dependency].error) {
+            return fail(concat("<", name, "> has errors"));
+        }
+    }
+
+    // Dependencies are up to date now, so their bodies can be inlined
+    Chunk inlined = inline_calls(*definition.chunk, m_environment);
+    std::optional<Chunk> folded = fold_constants(inlined, m_environment);
+    Chunk& chunk = folded ? *folded : inlined;
+    if (const auto report = verify(chunk, m_environment, definition.arity)) {
+        return fail(report->message);
+    }
+    if (definition.arity > 0) {
+        m_environment.bodies[slot].emplace(chunk);
+    } else {
+        m_environment.values[slot] = interpret(chunk, m_environment);
+    }
+    visited[slot] = 2;
+}
+
+/**
+ * @brief Reads an entire file.
+ * @param path Path of the file.
+ * @return Contents of the file or nothing if it could not be read.
+ */
+static auto read_file(const std::string& path) -> std::optional<std::string> {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return {};
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+[[noreturn]]
+void watch(const std::string& path, std::ostream& out) {
+    constexpr auto max_precision = std::numeric_limits<Number>::digits10 + 1;
+    out.precision(max_precision);
+
+    // Editors often replace files instead of writing into them,
+    // so the whole directory has to be watched
+    const std::filesystem::path file(path);
+    std::filesystem::path directory = file.parent_path();
+    if (directory.empty()) directory = ".";
+
+    const int inotify = inotify_init1(IN_CLOEXEC);
+    if (inotify < 0 || inotify_add_watch(
+                           inotify, directory.c_str(),
+                           IN_CLOSE_WRITE | IN_MOVED_TO
+                       ) < 0) {
+        writeln(out, "Error: Could not watch '", path, "'");
+        exit(-1);
+    }
+
+    Sheet sheet;
+    auto reload = [&]() {
+        if (const auto text = read_file(path)) {
+            sheet.update(text.value(), out);
+        } else {
+            writeln(out, "Error: Could not open '", path, "'");
+            out.flush();
+        }
+    };
+    reload();
+
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        const ssize_t length = read(inotify, buffer, sizeof(buffer));
+        if (length <= 0) {
+            panic("Internal Error: Reading inotify events failed");
+        }
+
+        bool changed = false;
+        for (ssize_t offset = 0; offset < length;) {
+            const auto* event =
+                reinterpret_cast<const inotify_event*>(buffer + offset);
+            if (event->len > 0 && file.filename() == event->name) {
+                changed = true;
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+        if (changed) reload();
+    }
+}
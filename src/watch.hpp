@@ -0,0 +1,18 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+
+/**
+ * @brief Evaluates a sheet of definitions (one `let name = expr` per line)
+ *        and re-evaluates it every time the file is changed.
+ *
+ * Definitions may refer to each other in any order. After an edit only the
+ * definitions whose source changed are tokenized and compiled again, and only
+ * those and their (transitive) dependents are re-evaluated.
+ *
+ * @param path Path of the sheet.
+ * @param out Stream to write values and error messages into.
+ */
+[[noreturn]]
+void watch(const std::string& path, std::ostream& out);